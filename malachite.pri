@@ -17,7 +17,9 @@ mac {
 	QMAKE_LFLAGS_X86_64 = $$QMAKE_CFLAGS_X86_64
 }
 
-LIBS += -lfreeimage
+QT += concurrent
+
+LIBS += -lfreeimage -lz
 QMAKE_CXXFLAGS += -std=c++11 -msse2
 QMAKE_LFLAGS += -std=c++11
 
@@ -143,6 +143,17 @@ public:
 		return Affine2D(m, v);
 	}
 	
+	/**
+	 * Constructs one from the affine part of a QTransform.
+	 * The projective components are ignored.
+	 * @param transform
+	 * @return 
+	 */
+	static Affine2D fromQTransform(const QTransform &transform)
+	{
+		return Affine2D(transform.m11(), transform.m21(), transform.m12(), transform.m22(), transform.dx(), transform.dy());
+	}
+	
 	/**
 	 * Returns the QTransform version of this.
 	 * Note that the QTransform is "transposed" affine matrix.
@@ -169,5 +180,26 @@ inline Vec2D operator*(const Affine2D &m, const Vec2D &v)
 	return m.mat() * v + m.delta();
 }
 
+/**
+ * Transforms points in bulk.
+ * src and dst may be the same array.
+ * @param m The transformation
+ * @param src The source points
+ * @param dst The destination points
+ * @param count The number of points
+ */
+inline void transformPoints(const Affine2D &m, const Vec2D *src, Vec2D *dst, int count)
+{
+	Vec2D v1 = m.mat().v1();
+	Vec2D v2 = m.mat().v2();
+	Vec2D delta = m.delta();
+	
+	for (int i = 0; i < count; ++i)
+	{
+		Vec2D p = src[i];
+		dst[i] = v1 * p.extractX() + v2 * p.extractY() + delta;
+	}
+}
+
 }
 
@@ -1,5 +1,9 @@
+#include <QVarLengthArray>
+#include <QAtomicInteger>
+#include <xmmintrin.h>
 #include "blendmode.h"
 #include "blendop.h"
+#include "private/spanrun.h"
 
 // Pixel blend mode based on SVG compositing specification
 
@@ -9,6 +13,11 @@ namespace Malachite
 static const PixelVec pixelVecZero(0.f);
 static const PixelVec pixelVecOne(1.f);
 
+#ifdef ML_SPAN_STATISTICS
+static QAtomicInteger<quint64> skippedPixelCount(0);
+static QAtomicInteger<quint64> collapsedPixelCount(0);
+#endif
+
 struct BlendTraitsClear
 {
 	static Pixel blend(const Pixel &dst, const Pixel &src)
@@ -490,6 +499,85 @@ inline static Pixel setSat(const Pixel &c, float s)
 	return cv;
 }
 
+// 4 colors in the structure-of-arrays layout for the non-separable blend modes
+
+struct ColorQuad
+{
+	__m128 b, g, r;
+};
+
+inline static __m128 selectQuad(__m128 mask, __m128 ifTrue, __m128 ifFalse)
+{
+	return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+}
+
+inline static __m128 lumQuad(const ColorQuad &c)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.3f), c.r), _mm_mul_ps(_mm_set1_ps(0.59f), c.g)), _mm_mul_ps(_mm_set1_ps(0.11f), c.b));
+}
+
+inline static __m128 minQuad(const ColorQuad &c)
+{
+	return _mm_min_ps(_mm_min_ps(c.r, c.g), c.b);
+}
+
+inline static __m128 maxQuad(const ColorQuad &c)
+{
+	return _mm_max_ps(_mm_max_ps(c.r, c.g), c.b);
+}
+
+inline static ColorQuad clipColorQuad(const ColorQuad &c)
+{
+	__m128 l = lumQuad(c);
+	__m128 n = minQuad(c);
+	__m128 x = maxQuad(c);
+	
+	__m128 belowZero = _mm_cmplt_ps(n, _mm_setzero_ps());
+	__m128 overOne = _mm_andnot_ps(belowZero, _mm_cmpgt_ps(x, _mm_set1_ps(1.f)));
+	
+	__m128 lowDivisor = _mm_sub_ps(l, n);
+	__m128 highFactor = _mm_sub_ps(_mm_set1_ps(1.f), l);
+	__m128 highDivisor = _mm_sub_ps(x, l);
+	
+	auto clip = [&](__m128 v)
+	{
+		__m128 d = _mm_sub_ps(v, l);
+		__m128 low = _mm_add_ps(l, _mm_div_ps(_mm_mul_ps(d, l), lowDivisor));
+		__m128 high = _mm_add_ps(l, _mm_div_ps(_mm_mul_ps(d, highFactor), highDivisor));
+		return selectQuad(belowZero, low, selectQuad(overOne, high, v));
+	};
+	
+	return { clip(c.b), clip(c.g), clip(c.r) };
+}
+
+inline static ColorQuad setLumQuad(const ColorQuad &c, __m128 l)
+{
+	__m128 d = _mm_sub_ps(l, lumQuad(c));
+	return clipColorQuad({ _mm_add_ps(c.b, d), _mm_add_ps(c.g, d), _mm_add_ps(c.r, d) });
+}
+
+inline static __m128 satQuad(const ColorQuad &c)
+{
+	return _mm_sub_ps(maxQuad(c), minQuad(c));
+}
+
+inline static ColorQuad setSatQuad(const ColorQuad &c, __m128 s)
+{
+	__m128 n = minQuad(c);
+	__m128 x = maxQuad(c);
+	__m128 range = _mm_sub_ps(x, n);
+	__m128 chromatic = _mm_cmpgt_ps(x, n);
+	
+	auto set = [&](__m128 v)
+	{
+		__m128 mid = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(v, n), s), range);
+		__m128 r = selectQuad(_mm_cmpeq_ps(v, x), s, selectQuad(_mm_cmpeq_ps(v, n), _mm_setzero_ps(), mid));
+		return _mm_and_ps(chromatic, r);
+	};
+	
+	return { set(c.b), set(c.g), set(c.r) };
+}
+
 struct BlendTraitsHue : public BlendTraitsSourceOver
 {
 	static Pixel blend(const Pixel &dst, const Pixel &src)
@@ -508,6 +596,11 @@ struct BlendTraitsHue : public BlendTraitsSourceOver
 		ret.ra() = src.a() + dst.a() - src.a() * dst.a();
 		return ret;
 	}
+	
+	static ColorQuad blendColorQuad(const ColorQuad &dst, const ColorQuad &src)
+	{
+		return setLumQuad(setSatQuad(src, satQuad(dst)), lumQuad(dst));
+	}
 };
 
 struct BlendTraitsSaturation : public BlendTraitsSourceOver
@@ -528,6 +621,11 @@ struct BlendTraitsSaturation : public BlendTraitsSourceOver
 		ret.ra() = src.a() + dst.a() - src.a() * dst.a();
 		return ret;
 	}
+	
+	static ColorQuad blendColorQuad(const ColorQuad &dst, const ColorQuad &src)
+	{
+		return setLumQuad(setSatQuad(dst, satQuad(src)), lumQuad(dst));
+	}
 };
 
 struct BlendTraitsColor : public BlendTraitsSourceOver
@@ -548,6 +646,11 @@ struct BlendTraitsColor : public BlendTraitsSourceOver
 		ret.ra() = src.a() + dst.a() - src.a() * dst.a();
 		return ret;
 	}
+	
+	static ColorQuad blendColorQuad(const ColorQuad &dst, const ColorQuad &src)
+	{
+		return setLumQuad(src, lumQuad(dst));
+	}
 };
 
 struct BlendTraitsLuminosity : public BlendTraitsSourceOver
@@ -568,14 +671,167 @@ struct BlendTraitsLuminosity : public BlendTraitsSourceOver
 		ret.ra() = src.a() + dst.a() - src.a() * dst.a();
 		return ret;
 	}
+	
+	static ColorQuad blendColorQuad(const ColorQuad &dst, const ColorQuad &src)
+	{
+		return setLumQuad(dst, lumQuad(src));
+	}
+};
+
+/*
+ * Blend op for the modes in which an opaque source replaces the destination (Source and SourceOver).
+ */
+template <typename TBlendTraits>
+class OpaqueCopyingBlendOp : public TemplateBlendOp<TBlendTraits>
+{
+public:
+	
+	bool copiesOpaqueSource() { return true; }
+};
+
+/*
+ * Blend op for the non-separable modes (Hue, Saturation, Color and Luminosity).
+ * 4 pixels are blended at once in the structure-of-arrays layout without branches,
+ * and the remaining pixels with the scalar TBlendTraits::blend().
+ */
+template <typename TBlendTraits>
+class NonSeparableBlendOp : public TemplateBlendOp<TBlendTraits>
+{
+public:
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src)
+	{
+		blendQuads(count, dst, [&](int i) { return src[i]; });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const Pixel> masks)
+	{
+		blendQuads(count, dst, [&](int i) { return Pixel(src[i].v() * masks[i].aV()); });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const float> opacities)
+	{
+		blendQuads(count, dst, [&](int i) { return src[i] * opacities[i]; });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, const Pixel &mask)
+	{
+		auto factor = mask.aV();
+		blendQuads(count, dst, [&](int i) { return Pixel(src[i].v() * factor); });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, float opacity)
+	{
+		auto factor = PixelVec(opacity);
+		blendQuads(count, dst, [&](int i) { return Pixel(src[i].v() * factor); });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src)
+	{
+		blendQuads(count, dst, [&](int) { return src; });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const Pixel> masks)
+	{
+		blendQuads(count, dst, [&](int i) { return Pixel(src.v() * masks[i].aV()); });
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const float> opacities)
+	{
+		blendQuads(count, dst, [&](int i) { return src * opacities[i]; });
+	}
+	
+	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src)
+	{
+		blendQuads(count, dst, [&](int i) { return src[count - 1 - i]; });
+	}
+	
+	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const Pixel> masks)
+	{
+		blendQuads(count, dst, [&](int i) { return Pixel(src[count - 1 - i].v() * masks[i].aV()); });
+	}
+	
+	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const float> opacities)
+	{
+		blendQuads(count, dst, [&](int i) { return src[count - 1 - i] * opacities[i]; });
+	}
+	
+	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, const Pixel &mask)
+	{
+		auto factor = mask.aV();
+		blendQuads(count, dst, [&](int i) { return Pixel(src[count - 1 - i].v() * factor); });
+	}
+	
+	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, float opacity)
+	{
+		auto factor = PixelVec(opacity);
+		blendQuads(count, dst, [&](int i) { return Pixel(src[count - 1 - i].v() * factor); });
+	}
+	
+private:
+	
+	template <typename TSourceFunc>
+	static void blendQuads(int count, Pointer<Pixel> dst, TSourceFunc sourceAt)
+	{
+		int i = 0;
+		
+		for (; i + 4 <= count; i += 4)
+			blendQuad(dst + i, sourceAt(i), sourceAt(i + 1), sourceAt(i + 2), sourceAt(i + 3));
+		
+		for (; i < count; ++i)
+			dst[i] = TBlendTraits::blend(dst[i], sourceAt(i));
+	}
+	
+	static void blendQuad(Pointer<Pixel> dst, const Pixel &src0, const Pixel &src1, const Pixel &src2, const Pixel &src3)
+	{
+		// the rows become B, G, R and A of the 4 pixels
+		__m128 d0 = dst[0].v(), d1 = dst[1].v(), d2 = dst[2].v(), d3 = dst[3].v();
+		__m128 s0 = src0.v(), s1 = src1.v(), s2 = src2.v(), s3 = src3.v();
+		_MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+		_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+		
+		__m128 da = d3;
+		__m128 sa = s3;
+		
+		ColorQuad dstUnmul = { _mm_div_ps(d0, da), _mm_div_ps(d1, da), _mm_div_ps(d2, da) };
+		ColorQuad srcUnmul = { _mm_div_ps(s0, sa), _mm_div_ps(s1, sa), _mm_div_ps(s2, sa) };
+		
+		ColorQuad blended = TBlendTraits::blendColorQuad(dstUnmul, srcUnmul);
+		
+		__m128 oneMinusDa = _mm_sub_ps(_mm_set1_ps(1.f), da);
+		__m128 oneMinusSa = _mm_sub_ps(_mm_set1_ps(1.f), sa);
+		__m128 sada = _mm_mul_ps(sa, da);
+		
+		// the pixels with zero alpha are returned as in the scalar version
+		__m128 daZero = _mm_cmpeq_ps(da, _mm_setzero_ps());
+		__m128 saZero = _mm_cmpeq_ps(sa, _mm_setzero_ps());
+		
+		auto composite = [&](__m128 d, __m128 s, __m128 b)
+		{
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(oneMinusDa, s), _mm_mul_ps(oneMinusSa, d)), _mm_mul_ps(sada, b));
+			return selectQuad(daZero, s, selectQuad(saZero, d, r));
+		};
+		
+		__m128 r0 = composite(d0, s0, blended.b);
+		__m128 r1 = composite(d1, s1, blended.g);
+		__m128 r2 = composite(d2, s2, blended.r);
+		__m128 r3 = selectQuad(daZero, sa, selectQuad(saZero, da, _mm_sub_ps(_mm_add_ps(sa, da), sada)));
+		
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		
+		dst[0].rv() = r0;
+		dst[1].rv() = r1;
+		dst[2].rv() = r2;
+		dst[3].rv() = r3;
+	}
 };
 
 BlendOpDictionary::BlendOpDictionary()
 {
 	_blendOps[BlendMode::Clear] = new TemplateBlendOp<BlendTraitsClear>;
-	_blendOps[BlendMode::Source] = new TemplateBlendOp<BlendTraitsSource>;
+	_blendOps[BlendMode::Source] = new OpaqueCopyingBlendOp<BlendTraitsSource>;
 	_blendOps[BlendMode::Destination] = new TemplateBlendOp<BlendTraitsDestination>;
-	_blendOps[BlendMode::SourceOver] = new TemplateBlendOp<BlendTraitsSourceOver>;
+	_blendOps[BlendMode::SourceOver] = new OpaqueCopyingBlendOp<BlendTraitsSourceOver>;
 	_blendOps[BlendMode::DestinationOver] = new TemplateBlendOp<BlendTraitsDestinationOver>;
 	_blendOps[BlendMode::SourceIn] = new TemplateBlendOp<BlendTraitsSourceIn>;
 	_blendOps[BlendMode::DestinationIn] = new TemplateBlendOp<BlendTraitsDestinationIn>;
@@ -598,10 +854,10 @@ BlendOpDictionary::BlendOpDictionary()
 	_blendOps[BlendMode::SoftLight] = new TemplateBlendOp<BlendTraitsSoftLight>;
 	_blendOps[BlendMode::Difference] = new TemplateBlendOp<BlendTraitsDifference>;
 	_blendOps[BlendMode::Exclusion] = new TemplateBlendOp<BlendTraitsExclusion>;
-	_blendOps[BlendMode::Hue] = new TemplateBlendOp<BlendTraitsHue>;
-	_blendOps[BlendMode::Saturation] = new TemplateBlendOp<BlendTraitsSaturation>;
-	_blendOps[BlendMode::Color] = new TemplateBlendOp<BlendTraitsColor>;
-	_blendOps[BlendMode::Luminosity] = new TemplateBlendOp<BlendTraitsLuminosity>;
+	_blendOps[BlendMode::Hue] = new NonSeparableBlendOp<BlendTraitsHue>;
+	_blendOps[BlendMode::Saturation] = new NonSeparableBlendOp<BlendTraitsSaturation>;
+	_blendOps[BlendMode::Color] = new NonSeparableBlendOp<BlendTraitsColor>;
+	_blendOps[BlendMode::Luminosity] = new NonSeparableBlendOp<BlendTraitsLuminosity>;
 	
 	_defaultBlendOp = _blendOps[BlendMode::SourceOver];
 }
@@ -613,5 +869,141 @@ BlendOpDictionary *blendOpDictionary()
 	return &_BlendOpDictionary;
 }
 
+BlendOp::SpanStatistics BlendOp::spanStatistics()
+{
+	SpanStatistics statistics;
+#ifdef ML_SPAN_STATISTICS
+	statistics.skippedPixelCount = skippedPixelCount.load();
+	statistics.collapsedPixelCount = collapsedPixelCount.load();
+#else
+	statistics.skippedPixelCount = 0;
+	statistics.collapsedPixelCount = 0;
+#endif
+	return statistics;
+}
+
+void BlendOp::resetSpanStatistics()
+{
+#ifdef ML_SPAN_STATISTICS
+	skippedPixelCount.store(0);
+	collapsedPixelCount.store(0);
+#endif
+}
+
+void BlendOp::addSkippedPixels(int count)
+{
+#ifdef ML_SPAN_STATISTICS
+	skippedPixelCount.fetchAndAddRelaxed(count);
+#else
+	Q_UNUSED(count);
+#endif
+}
+
+void BlendOp::addCollapsedPixels(int count)
+{
+#ifdef ML_SPAN_STATISTICS
+	collapsedPixelCount.fetchAndAddRelaxed(count);
+#else
+	Q_UNUSED(count);
+#endif
+}
+
+namespace
+{
+
+enum FusedKernel
+{
+	FusedKernelNone,
+	FusedKernelSourceOver,
+	FusedKernelMultiply,
+	FusedKernelScreen,
+	FusedKernelPlus
+};
+
+FusedKernel fusedKernel(BlendOp *op)
+{
+	if (op == blendOpDictionary()->blendOp(BlendMode::SourceOver))
+		return FusedKernelSourceOver;
+	if (op == blendOpDictionary()->blendOp(BlendMode::Multiply))
+		return FusedKernelMultiply;
+	if (op == blendOpDictionary()->blendOp(BlendMode::Screen))
+		return FusedKernelScreen;
+	if (op == blendOpDictionary()->blendOp(BlendMode::Plus))
+		return FusedKernelPlus;
+	return FusedKernelNone;
+}
+
+}
+
+void BlendOp::blendLayers(int count, Pointer<Pixel> dst, const Layer *layers, int layerCount)
+{
+	// 64 pixels (1KB) of dst stay in L1 while the layers are applied
+	constexpr int chunkSize = 64;
+	
+	QVarLengthArray<FusedKernel, 64> kernels(layerCount);
+	
+	for (int i = 0; i < layerCount; ++i)
+		kernels[i] = fusedKernel(layers[i].op);
+	
+	for (int chunkStart = 0; chunkStart < count; chunkStart += chunkSize)
+	{
+		int chunkCount = qMin(chunkSize, count - chunkStart);
+		Pointer<Pixel> chunk = dst + chunkStart;
+		
+		int i = 0;
+		
+		while (i < layerCount)
+		{
+			if (kernels[i] == FusedKernelNone)
+			{
+				const Layer &layer = layers[i];
+				
+				if (layer.opacity == 1.f)
+					layer.op->blend(chunkCount, chunk, layer.src + chunkStart);
+				else
+					layer.op->blend(chunkCount, chunk, layer.src + chunkStart, layer.opacity);
+				
+				++i;
+				continue;
+			}
+			
+			int runEnd = i + 1;
+			while (runEnd < layerCount && kernels[runEnd] != FusedKernelNone)
+				++runEnd;
+			
+			for (int x = 0; x < chunkCount; ++x)
+			{
+				PixelVec d = chunk[x].v();
+				
+				for (int l = i; l < runEnd; ++l)
+				{
+					PixelVec s = layers[l].src[chunkStart + x].v() * PixelVec(layers[l].opacity);
+					
+					switch (kernels[l])
+					{
+						default:
+						case FusedKernelSourceOver:
+							d = s + (pixelVecOne - s.extract(Pixel::Index::A)) * d;
+							break;
+						case FusedKernelMultiply:
+							d = s * d + s * (pixelVecOne - d.extract(Pixel::Index::A)) + d * (pixelVecOne - s.extract(Pixel::Index::A));
+							break;
+						case FusedKernelScreen:
+							d = s + d - s * d;
+							break;
+						case FusedKernelPlus:
+							d = (d + s).bound(pixelVecZero, pixelVecOne);
+							break;
+					}
+				}
+				
+				chunk[x].rv() = d;
+			}
+			
+			i = runEnd;
+		}
+	}
+}
+
 }
 
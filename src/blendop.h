@@ -32,6 +32,23 @@ public:
 	virtual void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const Pixel> masks) = 0;
 	virtual void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const float> opacities) = 0;
 	
+	// single-channel masks
+	
+	virtual void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const AlphaU8> masks) = 0;
+	virtual void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const AlphaU16> masks) = 0;
+	virtual void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const AlphaU8> masks) = 0;
+	virtual void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const AlphaU16> masks) = 0;
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const AlphaF> masks)
+	{
+		blend(count, dst, src, masks.reinterpret<const float>());
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const AlphaF> masks)
+	{
+		blend(count, dst, src, masks.reinterpret<const float>());
+	}
+	
 	virtual void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src) = 0;
 	virtual void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const Pixel> masks) = 0;
 	virtual void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const float> opacities) = 0;
@@ -39,6 +56,54 @@ public:
 	virtual void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, float opacity) = 0;
 	
 	virtual TileCombination tileRequirement(TileCombination combination) = 0;
+	
+	/**
+	 * @return Whether blending a transparent source (or a source with zero coverage) leaves the destination unchanged
+	 */
+	bool ignoresTransparentSource() { return tileRequirement(TileDestination) == TileDestination; }
+	
+	/**
+	 * @return Whether blending an opaque source with full coverage results in the source itself
+	 */
+	virtual bool copiesOpaqueSource() { return false; }
+	
+	/**
+	 * Numbers of the pixels which the renderers did not blend one by one, accumulated from all threads.
+	 * They are counted only by debug builds of the library and are zero otherwise,
+	 * as the shared counters would be contended by the rendering threads.
+	 */
+	struct SpanStatistics
+	{
+		quint64 skippedPixelCount;		///< Pixels left untouched because they contribute nothing
+		quint64 collapsedPixelCount;	///< Pixels written by a plain copy or fill
+	};
+	
+	static SpanStatistics spanStatistics();
+	static void resetSpanStatistics();
+	
+	static void addSkippedPixels(int count);
+	static void addCollapsedPixels(int count);
+	
+	/**
+	 * A source row of blendLayers().
+	 */
+	struct Layer
+	{
+		Pointer<const Pixel> src;
+		BlendOp *op;
+		float opacity;
+	};
+	
+	/**
+	 * Blends multiple source rows into dst in order, with the same result as calling blend() for each layer.
+	 * dst is processed in small chunks which stay in the cache while all layers are applied,
+	 * and consecutive SourceOver, Multiply, Screen and Plus layers are applied with each pixel kept in a register.
+	 * @param count The number of pixels
+	 * @param dst
+	 * @param layers The layers from bottom to top
+	 * @param layerCount
+	 */
+	static void blendLayers(int count, Pointer<Pixel> dst, const Layer *layers, int layerCount);
 };
 
 template <typename TBlendTraits>
@@ -130,6 +195,26 @@ public:
 		}
 	}
 	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const AlphaU8> masks)
+	{
+		blendAlphaMasks(count, dst, src, masks);
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const AlphaU16> masks)
+	{
+		blendAlphaMasks(count, dst, src, masks);
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const AlphaU8> masks)
+	{
+		blendAlphaMasks(count, dst, src, masks);
+	}
+	
+	void blend(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const AlphaU16> masks)
+	{
+		blendAlphaMasks(count, dst, src, masks);
+	}
+	
 	
 	void blendReversed(int count, Pointer<Pixel> dst, Pointer<const Pixel> src)
 	{
@@ -201,6 +286,31 @@ public:
 	{
 		return TBlendTraits::tileRequirement(combination);
 	}
+	
+private:
+	
+	template <class T_Mask>
+	static void blendAlphaMasks(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const T_Mask> masks)
+	{
+		while (count--)
+		{
+			*dst = TBlendTraits::blend(*dst, *src * masks->alphaF());
+			++dst;
+			++src;
+			++masks;
+		}
+	}
+	
+	template <class T_Mask>
+	static void blendAlphaMasks(int count, Pointer<Pixel> dst, const Pixel &src, Pointer<const T_Mask> masks)
+	{
+		while (count--)
+		{
+			*dst = TBlendTraits::blend(*dst, src * masks->alphaF());
+			++dst;
+			++masks;
+		}
+	}
 };
 
 class MALACHITESHARED_EXPORT BlendOpDictionary
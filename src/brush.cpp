@@ -1,6 +1,41 @@
+#include "private/gradientgenerator.h"
 #include "brush.h"
 
 namespace Malachite
 {
 
+QSharedPointer<const ColorGradientCache> Brush::gradientCache(int sampleCount) const
+{
+	if (!d->gradient)
+		return QSharedPointer<const ColorGradientCache>();
+	
+	BrushGradientCaches *caches = d->gradientCaches.data();
+	QMutexLocker locker(&caches->mutex);
+	
+	if (!caches->gradientCache || caches->gradientCache->sampleCount() < sampleCount)
+		caches->gradientCache = QSharedPointer<const ColorGradientCache>(new ColorGradientCache(d->gradient.data(), sampleCount));
+	
+	return caches->gradientCache;
+}
+
+QSharedPointer<const GradientLine> Brush::gradientLine(Malachite::SpreadType spreadType, double start, double end) const
+{
+	if (!d->gradient)
+		return QSharedPointer<const GradientLine>();
+	
+	BrushGradientCaches *caches = d->gradientCaches.data();
+	QMutexLocker locker(&caches->mutex);
+	
+	if (!caches->gradientLine || !caches->gradientLine->matches(spreadType, start, end))
+	{
+		auto line = GradientLine::create(d->gradient.data(), spreadType, start, end);
+		if (!line)
+			return line;
+		
+		caches->gradientLine = line;
+	}
+	
+	return caches->gradientLine;
+}
+
 }
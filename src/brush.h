@@ -11,10 +11,24 @@
 #include "surface.h"
 #include <QTransform>
 #include <QScopedPointer>
+#include <QSharedPointer>
+#include <QMutex>
 
 namespace Malachite
 {
 
+class GradientLine;
+
+/**
+ * The tables which the paint engines build from the gradient of a brush.
+ */
+struct BrushGradientCaches
+{
+	QMutex mutex;
+	QSharedPointer<const ColorGradientCache> gradientCache;
+	QSharedPointer<const GradientLine> gradientLine;
+};
+
 class BrushData : public QSharedData
 {
 public:
@@ -39,14 +53,16 @@ public:
 		type(Malachite::BrushTypeLinearGradient),
 		spreadType(Malachite::SpreadTypePad),
 		data(QVariant::fromValue(shape)),
-		gradient(gradient.clone())
+		gradient(gradient.clone()),
+		gradientCaches(new BrushGradientCaches)
 	{}
 	
 	BrushData(const ColorGradient &gradient, const RadialGradientShape &shape) :
 		type(Malachite::BrushTypeRadialGradient),
 		spreadType(Malachite::SpreadTypePad),
 		data(QVariant::fromValue(shape)),
-		gradient(gradient.clone())
+		gradient(gradient.clone()),
+		gradientCaches(new BrushGradientCaches)
 	{}
 	
 	BrushData(const Surface &surface) :
@@ -61,7 +77,8 @@ public:
 		spreadType(other.spreadType),
 		data(other.data),
 		transform(other.transform),
-		gradient(gradient->clone())
+		gradient(other.gradient ? other.gradient->clone() : 0),
+		gradientCaches(other.gradientCaches)
 	{}
 	
 	Malachite::BrushType type;
@@ -69,6 +86,10 @@ public:
 	QVariant data;
 	QTransform transform;
 	QScopedPointer<ColorGradient> gradient;
+	
+	// the tables built from the gradient, which never changes after construction;
+	// they are kept outside and shared by all copies, including detached ones
+	QSharedPointer<BrushGradientCaches> gradientCaches;
 };
 
 
@@ -149,6 +170,25 @@ public:
 	
 	const ColorGradient *gradient() const { return d->gradient.data(); }
 	
+	/**
+	 * Returns a lookup table of the gradient which has at least sampleCount intervals.
+	 * The table is built on demand and shared by the copies of this brush.
+	 * @param sampleCount
+	 * @return The lookup table, or null if the brush has no gradient
+	 */
+	QSharedPointer<const ColorGradientCache> gradientCache(int sampleCount) const;
+	
+	/**
+	 * Returns a pregenerated line of the gradient along an axis-aligned linear gradient on the device.
+	 * The last line is kept and shared by the copies of this brush (e.g. the painters of each surface tile),
+	 * and is built again when the spread type or the device coordinates of the gradient change.
+	 * @param spreadType
+	 * @param start The start coordinate of the gradient along the axis
+	 * @param end The end coordinate of the gradient along the axis
+	 * @return The line, or null if the brush has no gradient or the line cannot represent it
+	 */
+	QSharedPointer<const GradientLine> gradientLine(Malachite::SpreadType spreadType, double start, double end) const;
+	
 	void setTransform(const QTransform &transform) { d->transform = transform; }
 	QTransform transform() const { return d->transform; }
 	
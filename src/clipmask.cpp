@@ -0,0 +1,127 @@
+#include "surfacepainter.h"
+#include "clipmask.h"
+
+namespace Malachite
+{
+
+ClipMask::ClipMask(const MaskSurface &mask)
+{
+	QSharedPointer<Data> data(new Data);
+	constexpr int width = MaskSurface::tileWidth();
+	
+	for (auto i = mask.begin(); i != mask.end(); ++i)
+	{
+		const MaskImage &tile = i.value();
+		bool empty = true, full = true;
+		
+		for (int y = 0; y < width; ++y)
+		{
+			auto p = tile.constScanline(y);
+			
+			for (int x = 0; x < width; ++x)
+			{
+				float a = p[x].a();
+				empty = empty && a == 0.f;
+				full = full && a == 1.f;
+			}
+		}
+		
+		if (full)
+			data->fullKeys << i.key();
+		else if (!empty)
+			data->partialTiles.setTile(i.key(), tile);
+	}
+	
+	_data = data;
+}
+
+ClipMask ClipMask::fromPath(const QPainterPath &path)
+{
+	Surface surface;
+	
+	SurfacePainter painter(&surface);
+	painter.drawPath(path);
+	painter.flush();
+	
+	return ClipMask(MaskSurface::fromSurface(surface));
+}
+
+ClipMask::Coverage ClipMask::rectCoverage(const QRect &rect) const
+{
+	if (isNull())
+		return CoverageFull;
+	
+	if (rect.isEmpty())
+		return CoverageNone;
+	
+	QRect r = rect.translated(_offset);
+	QPoint topLeft = MaskSurface::keyForPixel(r.topLeft());
+	QPoint bottomRight = MaskSurface::keyForPixel(r.bottomRight());
+	
+	bool hasNone = false, hasFull = false;
+	
+	for (int y = topLeft.y(); y <= bottomRight.y(); ++y)
+	{
+		for (int x = topLeft.x(); x <= bottomRight.x(); ++x)
+		{
+			switch (keyCoverage(QPoint(x, y)))
+			{
+			case CoverageNone:
+				hasNone = true;
+				break;
+			case CoverageFull:
+				hasFull = true;
+				break;
+			default:
+				return CoveragePartial;
+			}
+			
+			if (hasNone && hasFull)
+				return CoveragePartial;
+		}
+	}
+	
+	return hasFull ? CoverageFull : CoverageNone;
+}
+
+void ClipMask::multiplyCovers(const QPoint &pos, int count, Pointer<float> covers) const
+{
+	if (isNull())
+		return;
+	
+	constexpr int width = MaskSurface::tileWidth();
+	
+	QPoint p = pos + _offset;
+	QPoint key, rem;
+	IntDivision::dividePoint(p, width, &key, &rem);
+	
+	int i = 0;
+	
+	while (i < count)
+	{
+		int segment = qMin(count - i, width - rem.x());
+		
+		switch (keyCoverage(key))
+		{
+		case CoverageNone:
+			(covers + i).fill(0.f, segment);
+			break;
+		case CoverageFull:
+			break;
+		default:
+		{
+			auto maskRow = _data->partialTiles.tilePointer(key)->constScanline(rem.y()) + rem.x();
+			
+			for (int j = 0; j < segment; ++j)
+				covers[i + j] *= maskRow[j].a();
+			break;
+		}
+		}
+		
+		i += segment;
+		key.rx()++;
+		rem.rx() = 0;
+	}
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef MLCLIPMASK_H
+#define MLCLIPMASK_H
+
+//ExportName: ClipMask
+
+#include <QSharedPointer>
+#include <QPainterPath>
+#include "maskimage.h"
+
+namespace Malachite
+{
+
+/**
+ * The clip of painting in device coordinates.
+ *
+ * The mask is classified by tiles into empty, full and partial ones,
+ * so that painting skips empty tiles entirely and needs no per-pixel multiplication in full tiles.
+ * ClipMask is implicitly shared and cheap to copy.
+ */
+class MALACHITESHARED_EXPORT ClipMask
+{
+public:
+	
+	enum Coverage
+	{
+		CoverageNone,
+		CoverageFull,
+		CoveragePartial
+	};
+	
+	/**
+	 * Constructs a null clip mask, which does not clip anything.
+	 */
+	ClipMask() {}
+	
+	/**
+	 * Constructs a clip mask from a mask surface.
+	 * Pixels outside the tiles of the mask are clipped out.
+	 * @param mask
+	 */
+	ClipMask(const MaskSurface &mask);
+	
+	/**
+	 * Rasterizes a path into a clip mask.
+	 * @param path The path in device coordinates
+	 * @return The clip mask
+	 */
+	static ClipMask fromPath(const QPainterPath &path);
+	
+	bool isNull() const { return !_data; }
+	
+	/**
+	 * @param offset
+	 * @return The clip mask whose pixel p is the pixel p + offset of this one
+	 */
+	ClipMask translated(const QPoint &offset) const
+	{
+		ClipMask mask = *this;
+		mask._offset += offset;
+		return mask;
+	}
+	
+	/**
+	 * @param rect
+	 * @return How the rect is covered by the mask
+	 */
+	Coverage rectCoverage(const QRect &rect) const;
+	
+	/**
+	 * Multiplies coverages of a horizontal span by the mask.
+	 * @param pos The start of the span
+	 * @param count The number of pixels
+	 * @param covers The coverages
+	 */
+	void multiplyCovers(const QPoint &pos, int count, Pointer<float> covers) const;
+	
+private:
+	
+	struct Data
+	{
+		MaskSurface partialTiles;
+		QSet<QPoint> fullKeys;
+	};
+	
+	Coverage keyCoverage(const QPoint &key) const
+	{
+		if (_data->fullKeys.contains(key))
+			return CoverageFull;
+		return _data->partialTiles.contains(key) ? CoveragePartial : CoverageNone;
+	}
+	
+	QSharedPointer<const Data> _data;
+	QPoint _offset;
+};
+
+}
+
+#endif // MLCLIPMASK_H
@@ -3,7 +3,7 @@
 namespace Malachite
 {
 
-ColorGradientCache::ColorGradientCache(ColorGradient *gradient, int sampleCount) :
+ColorGradientCache::ColorGradientCache(const ColorGradient *gradient, int sampleCount) :
 	ColorGradient(),
 	_sampleCount(sampleCount),
 	_cache(sampleCount + 1)
@@ -17,35 +17,27 @@ ColorGradientCache::ColorGradientCache(ColorGradient *gradient, int sampleCount)
 
 Pixel ArgbGradient::at(float x) const
 {
-	int count = _stops.size();
-	if (count == 0)
+	if (_stops.isEmpty())
 		return Pixel(0);
-	if (count == 1)
-		return _stops.value(0);
 	
-	QMapIterator<float, Pixel> i(_stops);
+	auto upper = _stops.upperBound(x);
 	
-	if (x <= i.peekNext().key()) return i.peekNext().value();
-	i.next();
+	if (upper == _stops.constBegin())
+		return upper.value();
+	if (upper == _stops.constEnd())
+		return (_stops.constEnd() - 1).value();
 	
-	for (; i.hasNext(); i.next())
-	{
-		float x1 = i.peekNext().key();
-		if (x < x1)
-		{
-			float x0 = i.peekPrevious().key();
-			Pixel y0 = i.peekPrevious().value();
-			Pixel y1 = i.peekNext().value();
-			
-			Pixel r;
-			r.rv() = y0.v() + (x - x0) / (x1 - x0) * (y1.v() - y0.v());
-			return r;
-		}
-		if (x == x1)
-			return i.peekNext().value();
-	}
+	auto lower = upper - 1;
+	
+	float x0 = lower.key();
+	float x1 = upper.key();
+	
+	if (x == x0)
+		return lower.value();
 	
-	return _stops.values().last();
+	Pixel r;
+	r.rv() = lower.value().v() + (x - x0) / (x1 - x0) * (upper.value().v() - lower.value().v());
+	return r;
 }
 
 }
@@ -20,11 +20,18 @@ public:
 	virtual ColorGradient *clone() const { return 0; }
 };
 
+/**
+ * The ColorGradientCache is a lookup table which samples a gradient at regular intervals.
+ */
 class MALACHITESHARED_EXPORT ColorGradientCache : public ColorGradient
 {
 public:
 	
-	ColorGradientCache(ColorGradient *gradient, int sampleCount);
+	/**
+	 * @param gradient The gradient to sample
+	 * @param sampleCount The number of intervals; sampleCount + 1 samples are taken including both ends
+	 */
+	ColorGradientCache(const ColorGradient *gradient, int sampleCount);
 	
 	Pixel at(float x) const
 	{
@@ -33,6 +40,11 @@ public:
 	
 	int sampleCount() const { return _sampleCount; }
 	
+	/**
+	 * @return The samples; the sample of x (0 <= x <= 1) is samples()[round(x * sampleCount())]
+	 */
+	const Pixel *samples() const { return _cache.constData(); }
+	
 private:
 	
 	int _sampleCount;
@@ -3,6 +3,7 @@
 
 #include "private/agg_array.h"
 #include "private/agg_math.h"
+#include <QVarLengthArray>
 #include "curvesubdivision.h"
 
 namespace agg
@@ -424,4 +425,134 @@ CurveSubdivision::CurveSubdivision(const Vec2D &start, const Vec2D &control1, co
 	}
 }
 
+// forward differencing state of one curve
+struct CurveStepper
+{
+	CurveStepper() {}
+	
+	CurveStepper(const Curve4 &curve, int stepCount)
+	{
+		double h = 1.0 / stepCount;
+		double h2 = h * h;
+		double h3 = h2 * h;
+		
+		Vec2D a = (curve.control1 - curve.control2) * 3.0 - curve.start + curve.end;
+		Vec2D b = (curve.start - 2.0 * curve.control1 + curve.control2) * 3.0;
+		Vec2D c = (curve.control1 - curve.start) * 3.0;
+		
+		f = curve.start;
+		df = a * h3 + b * h2 + c * h;
+		ddf = a * (6.0 * h3) + b * (2.0 * h2);
+		dddf = a * (6.0 * h3);
+	}
+	
+	Vec2D step()
+	{
+		f += df;
+		df += ddf;
+		ddf += dddf;
+		return f;
+	}
+	
+	Vec2D f, df, ddf, dddf;
+};
+
+// Wang's formula; the number of segments that keeps the chordal deviation under the tolerance
+static int flatteningStepCount(const Curve4 &curve, double tolerance)
+{
+	constexpr int maxStepCount = 1024;
+	
+	Vec2D dd1 = curve.start - 2.0 * curve.control1 + curve.control2;
+	Vec2D dd2 = curve.control1 - 2.0 * curve.control2 + curve.end;
+	
+	double lengthSquare = std::max(dd1.lengthSquare(), dd2.lengthSquare());
+	double count = std::ceil(std::sqrt(0.75 * std::sqrt(lengthSquare) / tolerance));
+	
+	if (!(count >= 1.0))
+		return 1;
+	if (count > maxStepCount)
+		return maxStepCount;
+	return count;
+}
+
+void CurveSubdivision::flatten(const Curve4 *curves, int count, double tolerance, Polygon *output)
+{
+	if (count <= 0)
+		return;
+	
+	// count points first so that the output is resized only once
+	
+	QVarLengthArray<int, 256> stepCounts(count);
+	QVarLengthArray<int, 256> offsets(count);
+	
+	int size = output->size();
+	
+	for (int i = 0; i < count; ++i)
+	{
+		const Curve4 &curve = curves[i];
+		bool continuous = (i == 0) ? (size && output->last() == curve.start) : (curves[i - 1].end == curve.start);
+		
+		offsets[i] = continuous ? size : size + 1;
+		stepCounts[i] = flatteningStepCount(curve, tolerance);
+		size = offsets[i] + stepCounts[i];
+	}
+	
+	output->resize(size);
+	Vec2D *points = output->data();
+	
+	// curves are stepped in pairs so that the two dependency chains overlap
+	
+	int i = 0;
+	
+	for (; i + 1 < count; i += 2)
+	{
+		const Curve4 &curve0 = curves[i];
+		const Curve4 &curve1 = curves[i + 1];
+		
+		int n0 = stepCounts[i];
+		int n1 = stepCounts[i + 1];
+		
+		Vec2D *p0 = points + offsets[i];
+		Vec2D *p1 = points + offsets[i + 1];
+		
+		p0[-1] = curve0.start;
+		p1[-1] = curve1.start;
+		
+		CurveStepper stepper0(curve0, n0);
+		CurveStepper stepper1(curve1, n1);
+		
+		int common = std::min(n0, n1) - 1;
+		
+		for (int j = 0; j < common; ++j)
+		{
+			p0[j] = stepper0.step();
+			p1[j] = stepper1.step();
+		}
+		
+		for (int j = common; j < n0 - 1; ++j)
+			p0[j] = stepper0.step();
+		for (int j = common; j < n1 - 1; ++j)
+			p1[j] = stepper1.step();
+		
+		p0[n0 - 1] = curve0.end;
+		p1[n1 - 1] = curve1.end;
+	}
+	
+	if (i < count)
+	{
+		const Curve4 &curve = curves[i];
+		int n = stepCounts[i];
+		Vec2D *p = points + offsets[i];
+		
+		p[-1] = curve.start;
+		
+		CurveStepper stepper(curve, n);
+		
+		for (int j = 0; j < n - 1; ++j)
+			p[j] = stepper.step();
+		
+		p[n - 1] = curve.end;
+	}
+}
+
 }
@@ -30,6 +30,24 @@ public:
 	
 	Polygon polygon() const { return _polygon; }
 	
+	/**
+	 * Flattens a batch of curves into one polygon by forward differencing.
+	 * The number of segments of each curve is chosen from its control polygon so that the distance between the curve and the polyline does not exceed the tolerance.
+	 * A start point equal to the previous end point is not duplicated.
+	 * @param curves The curves
+	 * @param count The number of curves
+	 * @param tolerance The maximum distance between the curves and the result
+	 * @param output The polygon the points are appended to
+	 */
+	static void flatten(const Curve4 *curves, int count, double tolerance, Polygon *output);
+	
+	static Polygon flatten(const QVector<Curve4> &curves, double tolerance = 0.25)
+	{
+		Polygon polygon;
+		flatten(curves.constData(), curves.size(), tolerance, &polygon);
+		return polygon;
+	}
+	
 private:
 	Polygon _polygon;
 };
@@ -1,9 +1,67 @@
+#include <limits>
+#include <cmath>
 #include "private/clipper.hpp"
 #include "fixedpolygon.h"
 
 namespace Malachite
 {
 
+// SSE2 has no 64-bit integer min / max, so coordinates are compared as packed doubles (exact below 2^53)
+static void accumulateFixedPointBounds(const FixedPoint *points, int count, Vec2D &min, Vec2D &max)
+{
+	Vec2D min1 = min, max1 = max;
+	Vec2D min2 = min, max2 = max;
+	
+	int i = 0;
+	
+	for (; i + 1 < count; i += 2)
+	{
+		Vec2D p1(double(points[i].x), double(points[i].y));
+		Vec2D p2(double(points[i + 1].x), double(points[i + 1].y));
+		
+		min1 = Vec2D::minimum(min1, p1);
+		max1 = Vec2D::maximum(max1, p1);
+		min2 = Vec2D::minimum(min2, p2);
+		max2 = Vec2D::maximum(max2, p2);
+	}
+	
+	if (i < count)
+	{
+		Vec2D p(double(points[i].x), double(points[i].y));
+		min1 = Vec2D::minimum(min1, p);
+		max1 = Vec2D::maximum(max1, p);
+	}
+	
+	min = Vec2D::minimum(min1, min2);
+	max = Vec2D::maximum(max1, max2);
+}
+
+static QRectF boundsToRect(const Vec2D &min, const Vec2D &max)
+{
+	if (min.x() > max.x())
+		return QRectF();
+	
+	Vec2D xy = min * (1.0 / FixedPoint::SubpixelPrecision);
+	Vec2D wh = max * (1.0 / FixedPoint::SubpixelPrecision) - xy;
+	
+	return QRectF(xy.x(), xy.y(), wh.x(), wh.y());
+}
+
+/*
+ * Rounds half away from zero like round() in FixedPoint(const Vec2D &), so both conversions give the same points.
+ * (The conversion instructions round half to even.)
+ */
+static inline int64_t roundToFixed(double x)
+{
+#ifdef __x86_64__
+	int64_t truncated = _mm_cvttsd_si64(_mm_set_sd(x));
+	double fraction = x - double(truncated);	// exact
+	return truncated + (fraction >= 0.5) - (fraction <= -0.5);
+#else
+	return std::llround(x);
+#endif
+}
+
 FixedPolygon::FixedPolygon(const Polygon &polygon) :
     FixedPolygon(polygon.size())
 {
@@ -16,6 +74,31 @@ FixedPolygon::FixedPolygon(const Polygon &polygon) :
 		*dst++ = FixedPoint(*src++);
 }
 
+FixedPolygon::FixedPolygon(const Polygon &polygon, const Affine2D &transform) :
+    FixedPolygon(polygon.size())
+{
+	// fold the fixed point scale into the transformation
+	
+	Vec2D v1 = transform.mat().v1() * double(FixedPoint::SubpixelPrecision);
+	Vec2D v2 = transform.mat().v2() * double(FixedPoint::SubpixelPrecision);
+	Vec2D delta = transform.delta() * double(FixedPoint::SubpixelPrecision);
+	
+	int size = polygon.size();
+	
+	FixedPoint *dst = data();
+	const Vec2D *src = polygon.constData();
+	
+	for (int i = 0; i < size; ++i)
+	{
+		Vec2D p = *src++;
+		Vec2D r = v1 * p.extractX() + v2 * p.extractY() + delta;
+		
+		dst->x = roundToFixed(r.x());
+		dst->y = roundToFixed(r.y());
+		dst++;
+	}
+}
+
 void FixedPolygon::translate(const FixedPoint &delta)
 {
 	FixedPoint *p = data();
@@ -24,6 +107,15 @@ void FixedPolygon::translate(const FixedPoint &delta)
 		*p++ += delta;
 }
 
+QRectF FixedPolygon::boundingRect() const
+{
+	Vec2D min(std::numeric_limits<double>::infinity());
+	Vec2D max(-std::numeric_limits<double>::infinity());
+	
+	accumulateFixedPointBounds(constData(), size(), min, max);
+	return boundsToRect(min, max);
+}
+
 FixedPolygon FixedPolygon::fromRect(const QRect &rect)
 {
 	FixedPolygon result(4);
@@ -44,42 +136,114 @@ FixedMultiPolygon FixedMultiPolygon::fromPolygons(const MultiPolygon &polygons)
 	return result;
 }
 
+FixedMultiPolygon FixedMultiPolygon::fromPolygons(const MultiPolygon &polygons, const Affine2D &transform)
+{
+	FixedMultiPolygon result(polygons.size());
+	FixedPolygon *dst = result.data();
+	
+	for (const Polygon &polygon : polygons)
+		*dst++ = FixedPolygon(polygon, transform);
+	
+	return result;
+}
+
+FixedMultiPolygon FixedMultiPolygon::fromPolygons(const MultiPolygon &polygons, const QTransform &transform)
+{
+	if (transform.isAffine())
+		return fromPolygons(polygons, Affine2D::fromQTransform(transform));
+	
+	return fromPolygons(polygons * transform);
+}
+
 QRectF FixedMultiPolygon::boundingRect() const
 {
-	FixedMultiPolygon polys = *this;
+	Vec2D min(std::numeric_limits<double>::infinity());
+	Vec2D max(-std::numeric_limits<double>::infinity());
 	
-	for (int i = 0; i < polys.size(); ++i)
+	for (const FixedPolygon &polygon : *this)
+		accumulateFixedPointBounds(polygon.constData(), polygon.size(), min, max);
+	
+	return boundsToRect(min, max);
+}
+
+// Sutherland-Hodgman clipping against one edge of a rectangle
+template <class T_Inside, class T_Intersect>
+static void clipToEdge(const FixedPolygon &src, FixedPolygon &dst, T_Inside inside, T_Intersect intersect)
+{
+	dst.resize(0);
+	
+	int count = src.size();
+	if (count == 0)
+		return;
+	
+	FixedPoint prev = src.at(count - 1);
+	bool prevInside = inside(prev);
+	
+	for (int i = 0; i < count; ++i)
 	{
-		if (polys.at(i).size() == 0)
-			polys.remove(i);
+		const FixedPoint &p = src.at(i);
+		bool pInside = inside(p);
+		
+		if (pInside != prevInside)
+			dst << intersect(prev, p);
+		if (pInside)
+			dst << p;
+		
+		prev = p;
+		prevInside = pInside;
 	}
+}
+
+FixedMultiPolygon FixedMultiPolygon::clipped(const QRect &rect) const
+{
+	int64_t left = int64_t(rect.left()) << FixedPoint::SubpixelWidth;
+	int64_t top = int64_t(rect.top()) << FixedPoint::SubpixelWidth;
+	int64_t right = int64_t(rect.left() + rect.width()) << FixedPoint::SubpixelWidth;
+	int64_t bottom = int64_t(rect.top() + rect.height()) << FixedPoint::SubpixelWidth;
 	
-	if (polys.size() == 0)
-		return QRectF();
+	auto intersectX = [](const FixedPoint &p1, const FixedPoint &p2, int64_t x)
+	{
+		double t = double(x - p1.x) / double(p2.x - p1.x);
+		return FixedPoint::fromRawData(x, p1.y + std::llround((p2.y - p1.y) * t));
+	};
+	
+	auto intersectY = [](const FixedPoint &p1, const FixedPoint &p2, int64_t y)
+	{
+		double t = double(y - p1.y) / double(p2.y - p1.y);
+		return FixedPoint::fromRawData(p1.x + std::llround((p2.x - p1.x) * t), y);
+	};
 	
-	FixedPoint min, max;
-	min = max = polys.at(0).at(0);
+	FixedMultiPolygon result;
+	FixedPolygon buffer1, buffer2;
 	
-	foreach (const FixedPolygon &poly, polys)
+	for (const FixedPolygon &polygon : *this)
 	{
-		foreach (const FixedPoint &p, poly)
+		if (polygon.size() < 3)
+			continue;
+		
+		Vec2D min(std::numeric_limits<double>::infinity());
+		Vec2D max(-std::numeric_limits<double>::infinity());
+		accumulateFixedPointBounds(polygon.constData(), polygon.size(), min, max);
+		
+		if (max.x() <= left || max.y() <= top || min.x() >= right || min.y() >= bottom)
+			continue;
+		
+		if (min.x() >= left && min.y() >= top && max.x() <= right && max.y() <= bottom)
 		{
-			if (p.x < min.x)
-				min.x = p.x;
-			if (p.y < min.y)
-				min.y = p.y;
-			if (p.x > max.x)
-				max.x = p.x;
-			if (p.y > max.y)
-				max.y = p.y;
+			result << polygon;
+			continue;
 		}
+		
+		clipToEdge(polygon, buffer1, [=](const FixedPoint &p) { return p.x >= left; }, [=](const FixedPoint &p1, const FixedPoint &p2) { return intersectX(p1, p2, left); });
+		clipToEdge(buffer1, buffer2, [=](const FixedPoint &p) { return p.x <= right; }, [=](const FixedPoint &p1, const FixedPoint &p2) { return intersectX(p1, p2, right); });
+		clipToEdge(buffer2, buffer1, [=](const FixedPoint &p) { return p.y >= top; }, [=](const FixedPoint &p1, const FixedPoint &p2) { return intersectY(p1, p2, top); });
+		clipToEdge(buffer1, buffer2, [=](const FixedPoint &p) { return p.y <= bottom; }, [=](const FixedPoint &p1, const FixedPoint &p2) { return intersectY(p1, p2, bottom); });
+		
+		if (buffer2.size() >= 3)
+			result << buffer2;
 	}
 	
-	Vec2D xy, wh;
-	xy = min.toMLVec2D();
-	wh = max.toMLVec2D() - xy;
-	
-	return QRectF(xy.x(), xy.y(), wh.x(), wh.y());
+	return result;
 }
 
 using namespace ClipperLib;
@@ -71,8 +71,20 @@ public:
 	FixedPolygon(int size) : QVector<FixedPoint>(size) {}
 	FixedPolygon(const Polygon &polygon);
 	
+	/**
+	 * Transforms the points and converts them to fixed point in one pass.
+	 * @param polygon
+	 * @param transform
+	 */
+	FixedPolygon(const Polygon &polygon, const Affine2D &transform);
+	
 	void translate(const FixedPoint &delta);
 	
+	/**
+	 * Returns the bounding rectangle of the points without allocation.
+	 */
+	QRectF boundingRect() const;
+	
 	static FixedPolygon fromRect(const QRectF &rect) { return Polygon::fromRect(rect); }
 	static FixedPolygon fromRect(const QRect &rect);
 };
@@ -90,9 +102,22 @@ public:
 			i->translate(delta);
 	}
 	
+	/**
+	 * Returns the bounding rectangle of all points without allocation.
+	 */
 	QRectF boundingRect() const;
 	
+	/**
+	 * Clips each polygon to a rectangle independently.
+	 * Unlike the boolean operators, this keeps the winding of overlapping polygons, so the result fills the same with the non-zero rule.
+	 * @param rect The clip rectangle in pixels
+	 * @return The clipped polygons
+	 */
+	FixedMultiPolygon clipped(const QRect &rect) const;
+	
 	static FixedMultiPolygon fromPolygons(const MultiPolygon &polygons);
+	static FixedMultiPolygon fromPolygons(const MultiPolygon &polygons, const Affine2D &transform);
+	static FixedMultiPolygon fromPolygons(const MultiPolygon &polygons, const QTransform &transform);
 	static FixedMultiPolygon fromQPainterPath(const QPainterPath &path) { return fromPolygons(MultiPolygon::fromQPainterPath(path)); }
 };
 
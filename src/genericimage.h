@@ -208,7 +208,7 @@ public:
 	}
 	
 	template <class NewPixel>
-	GenericImage<NewPixel> convert()
+	GenericImage<NewPixel> convert() const
 	{
 		if (!p)
 			return GenericImage<NewPixel>();
@@ -219,11 +219,12 @@ public:
 		for (int y = 0; y < s.height(); ++y)
 		{
 			NewPixel *dp = newImage.scanline(y);
-			PixelType *sp = constScanline(y);
+			const PixelType *sp = constScanline(y);
 			
-			for (int x = 0; x < s.width(); ++x)
-				*dp++ = *sp++;
+			PixelRowConverter<NewPixel, PixelType>::convert(dp, sp, s.width());
 		}
+		
+		return newImage;
 	}
 	
 	template <ImagePasteInversionMode InversionMode = ImagePasteNotInverted, class SrcImage>
@@ -251,8 +252,7 @@ public:
 			
 			sp += (r.left() - point.x());
 			
-			for (int x = 0; x < r.width(); ++x)
-				*dp++ = *sp++;
+			PixelRowConverter<PixelType, typename SrcImage::PixelType>::convert(dp, sp, r.width());
 		}
 	}
 	
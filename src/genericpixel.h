@@ -262,9 +262,61 @@ protected:
 	VectorType _v;
 };
 
+/**
+ * Pixel with only an alpha channel, used for masks and selections.
+ */
+template <typename T_Channel>
+class AlphaPixel
+{
+public:
+	
+	typedef T_Channel ChannelType;
+	typedef typename ChannelType::ValueType ValueType;
+	
+	static constexpr bool hasAlpha() { return true; }
+	static constexpr size_t count() { return 1; }
+	
+	AlphaPixel() {}
+	
+	AlphaPixel(ValueType a) : _a(a) {}
+	
+	template <typename Other_Channel>
+	AlphaPixel(const AlphaPixel<Other_Channel> &other) : _a(ChannelType(Other_Channel(other.a())).value) {}
+	
+	/**
+	 * Takes the alpha channel of a color pixel.
+	 */
+	template <PixelParams::Premult Other_Premult, PixelParams::Alpha Other_Alpha, typename Other_Index, typename Other_Channel>
+	explicit AlphaPixel(const RgbPixel<Other_Premult, Other_Alpha, Other_Index, Other_Channel> &other)
+	{
+		_a = other.hasAlpha() ? ChannelType(Other_Channel(other.a())).value : ChannelType::max();
+	}
+	
+	ValueType a() const { return _a; }
+	void setA(ValueType a) { _a = a; }
+	ValueType &ra() { return _a; }
+	
+	/**
+	 * @return The alpha value in [0, 1]
+	 */
+	float alphaF() const { return PixelParams::ChannelFloat(ChannelType(_a)).value; }
+	
+	bool operator==(const AlphaPixel &other) const { return _a == other._a; }
+	bool operator!=(const AlphaPixel &other) const { return _a != other._a; }
+	
+private:
+	
+	ValueType _a;
+};
+
+typedef AlphaPixel<PixelParams::ChannelFloat> AlphaF;
+typedef AlphaPixel<PixelParams::ChannelU8> AlphaU8;
+typedef AlphaPixel<PixelParams::ChannelU16> AlphaU16;
+
 typedef RgbPixel<PixelParams::HasPremult, PixelParams::HasAlpha, PixelParams::IndexBGRA, PixelParams::ChannelFloat> BgraPremultF;
 typedef RgbPixel<PixelParams::HasPremult, PixelParams::HasAlpha, PixelParams::IndexBGRA, PixelParams::ChannelU8> BgraPremultU8;
 typedef RgbPixel<PixelParams::HasPremult, PixelParams::HasAlpha, PixelParams::IndexBGRA, PixelParams::ChannelU16> BgraPremultU16;
+typedef RgbPixel<PixelParams::HasPremult, PixelParams::HasAlpha, PixelParams::IndexRGBA, PixelParams::ChannelFloat> RgbaPremultF;
 
 typedef RgbPixel<PixelParams::NoPremult, PixelParams::HasAlpha, PixelParams::IndexBGRA, PixelParams::ChannelFloat> BgraF;
 typedef RgbPixel<PixelParams::NoPremult, PixelParams::HasAlpha, PixelParams::IndexBGRA, PixelParams::ChannelU8> BgraU8;
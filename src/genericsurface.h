@@ -50,6 +50,18 @@ public:
 	ImageType tile(const QPoint &key, const ImageType &defaultImage) const { return _hash.value(key, defaultImage); }
 	ImageType tile(int x, int y, const ImageType &defaultImage) const { return tile(QPoint(x, y), defaultImage); }
 	
+	/**
+	 * Returns a pointer to the tile without copying it.
+	 * The pointer is valid until the surface is modified.
+	 * @param key
+	 * @return The tile, or null if it does not exist
+	 */
+	const ImageType *tilePointer(const QPoint &key) const
+	{
+		auto i = _hash.constFind(key);
+		return i == _hash.constEnd() ? 0 : &i.value();
+	}
+	
 	ImageType &tileRef(const QPoint &key)
 	{
 		if (!_hash.contains(key))
@@ -75,7 +87,9 @@ public:
 	{
 		QPoint key, rem;
 		IntDivision::dividePoint(pos, tileWidth(), &key, &rem);
-		return tile(key).pixel(rem);
+		
+		const ImageType *tile = tilePointer(key);
+		return tile ? tile->pixel(rem) : defaultPixel();
 	}
 	
 	bool contains(const QPoint &key) const { return _hash.contains(key); }
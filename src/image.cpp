@@ -214,31 +214,67 @@ Image &Image::operator*=(float factor)
 	return *this;
 }
 
+/*
+ * Stream format
+ *
+ * version 1 (old): int32 width, int32 height, then a, r, g, b of each pixel as QDataStream floats
+ * version 2: int32 -1 (never a valid width), int32 version, int32 width, int32 height, int32 byte order,
+ *            then the scanlines as raw 32bit floats (b, g, r, a) in the declared byte order
+ *
+ * Version 2 is written in the host byte order, so bytes are swapped only when reading on a host of the other order.
+ */
+
+namespace
+{
+
+constexpr int32_t imageStreamMarker = -1;
+constexpr int32_t imageStreamVersion = 2;
+
+// reverses the bytes of each 32bit value
+void swapDwordBytes(void *data, int count)
+{
+	auto dwords = static_cast<uint32_t *>(data);
+	int i = 0;
+	
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dwords + i));
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+		x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dwords + i), x);
+	}
+	
+	for (; i < count; ++i)
+		dwords[i] = qbswap(dwords[i]);
+}
+
+}
+
 QDataStream &operator<<(QDataStream &out, const Image &image)
 {
+	out << imageStreamMarker << imageStreamVersion;
 	out << int32_t(image.width()) << int32_t(image.height());
+	out << int32_t(QSysInfo::ByteOrder);
 	
-	int count = image.width() * image.height();
-	
-	Pointer<const Pixel> p = image.constBits();
+	int rowBytes = image.width() * sizeof(Pixel);
 	
-	for (int i = 0; i < count; ++i)
+	for (int y = 0; y < image.height(); ++y)
 	{
-		out << p->a();
-		out << p->r();
-		out << p->g();
-		out << p->b();
-		p++;
+		const Pixel *row = image.constScanline(y);
+		
+		if (out.writeRawData(reinterpret_cast<const char *>(row), rowBytes) != rowBytes)
+		{
+			out.setStatus(QDataStream::WriteFailed);
+			break;
+		}
 	}
 	
 	return out;
 }
 
-QDataStream &operator>>(QDataStream &in, Image &image)
+static Image readImageVersion1(QDataStream &in, int32_t w, int32_t h)
 {
-	int32_t w, h;
-	in >> w >> h;
-	
 	Image result(w, h);
 	int count = w * h;
 	
@@ -253,6 +289,50 @@ QDataStream &operator>>(QDataStream &in, Image &image)
 		p++;
 	}
 	
+	return result;
+}
+
+QDataStream &operator>>(QDataStream &in, Image &image)
+{
+	int32_t w, h;
+	in >> w;
+	
+	if (w != imageStreamMarker)
+	{
+		in >> h;
+		image = readImageVersion1(in, w, h);
+		return in;
+	}
+	
+	int32_t version, byteOrder;
+	in >> version >> w >> h >> byteOrder;
+	
+	if (in.status() != QDataStream::Ok || version != imageStreamVersion || w < 0 || h < 0)
+	{
+		in.setStatus(QDataStream::ReadCorruptData);
+		image = Image();
+		return in;
+	}
+	
+	Image result(w, h);
+	int rowBytes = w * sizeof(Pixel);
+	bool swapped = byteOrder != QSysInfo::ByteOrder;
+	
+	for (int y = 0; y < h; ++y)
+	{
+		Pixel *row = result.scanline(y);
+		
+		if (in.readRawData(reinterpret_cast<char *>(row), rowBytes) != rowBytes)
+		{
+			in.setStatus(QDataStream::ReadPastEnd);
+			image = Image();
+			return in;
+		}
+		
+		if (swapped)
+			swapDwordBytes(row, w * 4);
+	}
+	
 	image = result;
 	
 	return in;
@@ -1,4 +1,9 @@
+#include <limits>
 #include <QFile>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include "private/pngwriter.h"
 #include "imageio.h"
 
 #include <FreeImage.h>
@@ -57,8 +62,16 @@ static void outputMessage(FREE_IMAGE_FORMAT fif, const char *message)
 }
 
 
+/*
+ * OpenEXR stores premultiplied colors; the other float formats (TIFF, PFM, Radiance) are taken as straight.
+ */
+static bool isFloatPremultiplied(FREE_IMAGE_FORMAT format)
+{
+	return format == FIF_EXR;
+}
+
 template <class T_Image>
-static bool pasteFIBITMAPToImage(const QPoint &pos, T_Image *dst, FIBITMAP *src)
+static bool pasteFIBITMAPToImage(const QPoint &pos, T_Image *dst, FIBITMAP *src, bool floatPremultiplied = false)
 {
 	FREE_IMAGE_TYPE srcType = FreeImage_GetImageType(src);
 	QSize srcSize(FreeImage_GetWidth(src), FreeImage_GetHeight(src));
@@ -97,7 +110,7 @@ static bool pasteFIBITMAPToImage(const QPoint &pos, T_Image *dst, FIBITMAP *src)
 		}
 		case FIT_RGB16:
 		{
-			dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbaU16>::wrap(srcBits, srcSize, srcPitch), pos);
+			dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbU16>::wrap(srcBits, srcSize, srcPitch), pos);
 			break;
 		}
 		case FIT_RGBA16:
@@ -105,6 +118,28 @@ static bool pasteFIBITMAPToImage(const QPoint &pos, T_Image *dst, FIBITMAP *src)
 			dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbaU16>::wrap(srcBits, srcSize, srcPitch), pos);
 			break;
 		}
+		case FIT_RGBF:
+		{
+			dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbF>::wrap(srcBits, srcSize, srcPitch), pos);
+			break;
+		}
+		case FIT_RGBAF:
+		{
+			if (floatPremultiplied)
+				dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbaPremultF>::wrap(srcBits, srcSize, srcPitch), pos);
+			else
+				dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbaF>::wrap(srcBits, srcSize, srcPitch), pos);
+			break;
+		}
+		case FIT_FLOAT:
+		{
+			FIBITMAP *newBitmap = FreeImage_ConvertToRGBF(src);	// gray to RGB
+			if (!newBitmap)
+				return false;
+			dst->template paste<ImagePasteSourceInverted>(GenericImage<RgbF>::wrap(FreeImage_GetBits(newBitmap), srcSize, FreeImage_GetPitch(newBitmap)), pos);
+			FreeImage_Unload(newBitmap);
+			break;
+		}
 		default:
 			qWarning() << Q_FUNC_INFO << ": Unsupported data type";
 			return false;
@@ -114,7 +149,7 @@ static bool pasteFIBITMAPToImage(const QPoint &pos, T_Image *dst, FIBITMAP *src)
 }
 
 template <class T_Image>
-static bool pasteImageToFIBITMAP(const QPoint &pos, FIBITMAP *dst, const T_Image &src)
+static bool pasteImageToFIBITMAP(const QPoint &pos, FIBITMAP *dst, const T_Image &src, bool floatPremultiplied = false)
 {
 	FREE_IMAGE_TYPE dstType = FreeImage_GetImageType(dst);
 	QSize dstSize(FreeImage_GetWidth(dst), FreeImage_GetHeight(dst));
@@ -160,6 +195,26 @@ static bool pasteImageToFIBITMAP(const QPoint &pos, FIBITMAP *dst, const T_Image
 			wrapper.paste<ImagePasteDestinationInverted>(src, pos);
 			break;
 		}
+		case FIT_RGBF:
+		{
+			auto wrapper = GenericImage<RgbF>::wrap(dstBits, dstSize, dstPitch);
+			wrapper.paste<ImagePasteDestinationInverted>(src, pos);
+			break;
+		}
+		case FIT_RGBAF:
+		{
+			if (floatPremultiplied)
+			{
+				auto wrapper = GenericImage<RgbaPremultF>::wrap(dstBits, dstSize, dstPitch);
+				wrapper.paste<ImagePasteDestinationInverted>(src, pos);
+			}
+			else
+			{
+				auto wrapper = GenericImage<RgbaF>::wrap(dstBits, dstSize, dstPitch);
+				wrapper.paste<ImagePasteDestinationInverted>(src, pos);
+			}
+			break;
+		}
 		default:
 			qWarning() << Q_FUNC_INFO << ": Unsupported data type";
 			return false;
@@ -169,9 +224,97 @@ static bool pasteImageToFIBITMAP(const QPoint &pos, FIBITMAP *dst, const T_Image
 }
 
 
+/*
+ * Returns a bitmap which pasteFIBITMAPToImage reads without converting it again,
+ * which is the bitmap itself unless it has an uncommon bit depth or is grayscale float.
+ * A new bitmap must be unloaded by the caller.
+ */
+static FIBITMAP *pastableBitmap(FIBITMAP *bitmap)
+{
+	switch (FreeImage_GetImageType(bitmap))
+	{
+		case FIT_BITMAP:
+		{
+			int bpp = FreeImage_GetBPP(bitmap);
+			return (bpp == 24 || bpp == 32) ? bitmap : FreeImage_ConvertTo32Bits(bitmap);
+		}
+		case FIT_FLOAT:
+			return FreeImage_ConvertToRGBF(bitmap);
+		default:
+			return bitmap;
+	}
+}
+
+// the JPEG decoder scales by 1/2, 1/4 or 1/8 in the DCT, keeping the size at least maxSize
+static int thumbnailJpegFlags(int maxSize)
+{
+	return JPEG_FAST | (qBound(0, maxSize, 0xFFFF) << 16);
+}
+
+static FIBITMAP *loadBitmap(QIODevice *device, int jpegFlags, FREE_IMAGE_FORMAT *formatOut)
+{
+	FreeImage_SetOutputMessage(outputMessage);
+	
+	FreeImageIO io;
+	io.read_proc = readFromQIODevice;
+	io.write_proc = 0;
+	io.seek_proc = seekQIODevice;
+	io.tell_proc = tellQIODevice;
+	
+	auto format = FreeImage_GetFileTypeFromHandle(&io, device);
+	*formatOut = format;
+	
+	if (format == FIF_UNKNOWN)
+		return 0;
+	
+	return FreeImage_LoadFromHandle(format, &io, device, format == FIF_JPEG ? jpegFlags : 0);
+}
+
+/*
+ * Loads a file through a memory map, so that the codec reads straight from the page cache
+ * instead of calling back into QIODevice for every small read.
+ * Falls back to the QIODevice path if the file cannot be mapped
+ * (or is too large for a FreeImage memory stream).
+ */
+static FIBITMAP *loadBitmapFromFile(const QString &filePath, int jpegFlags, FREE_IMAGE_FORMAT *formatOut)
+{
+	*formatOut = FIF_UNKNOWN;
+	
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return 0;
+	
+	qint64 size = file.size();
+	uchar *data = (size > 0 && size <= qint64(std::numeric_limits<DWORD>::max())) ? file.map(0, size) : 0;
+	
+	if (!data)
+		return loadBitmap(&file, jpegFlags, formatOut);
+	
+	FreeImage_SetOutputMessage(outputMessage);
+	
+	// the memory stream only reads from the mapped pages
+	FIMEMORY *stream = FreeImage_OpenMemory(data, DWORD(size));
+	FIBITMAP *bitmap = 0;
+	
+	if (stream)
+	{
+		auto format = FreeImage_GetFileTypeFromMemory(stream, 0);
+		*formatOut = format;
+		
+		if (format != FIF_UNKNOWN)
+			bitmap = FreeImage_LoadFromMemory(format, stream, format == FIF_JPEG ? jpegFlags : 0);
+		
+		FreeImage_CloseMemory(stream);
+	}
+	
+	file.unmap(data);
+	return bitmap;
+}
+
 struct ImageImporter::Data
 {
 	FIBITMAP *bitmap = 0;
+	FREE_IMAGE_FORMAT format = FIF_UNKNOWN;
 	QSize size;
 	
 	~Data()
@@ -187,6 +330,14 @@ struct ImageImporter::Data
 			bitmap = 0;
 		}
 	}
+	
+	bool setBitmap(FIBITMAP *newBitmap)
+	{
+		Q_ASSERT(!bitmap);
+		bitmap = newBitmap;
+		size = bitmap ? QSize(FreeImage_GetWidth(bitmap), FreeImage_GetHeight(bitmap)) : QSize();
+		return bitmap;
+	}
 };
 
 ImageImporter::ImageImporter() :
@@ -200,47 +351,27 @@ ImageImporter::~ImageImporter()
 
 bool ImageImporter::load(QIODevice *device)
 {
+	// the previous bitmap is released before decoding the next one
 	d->deleteBitmap();
-	
-	FreeImage_SetOutputMessage(outputMessage);
-	
-	FreeImageIO io;
-	io.read_proc = readFromQIODevice;
-	io.write_proc = 0;
-	io.seek_proc = seekQIODevice;
-	io.tell_proc = tellQIODevice;
-	
-	auto format = FreeImage_GetFileTypeFromHandle(&io, device);
-	
-	if (format != FIF_UNKNOWN)
-	{
-		int flags = 0;
-		
-		if (format == FIF_JPEG)
-			flags = JPEG_ACCURATE;
-		
-		d->bitmap = FreeImage_LoadFromHandle(format, &io, device, flags);
-	}
-	
-	if (d->bitmap)
-	{
-		int w = FreeImage_GetWidth(d->bitmap);
-		int h = FreeImage_GetHeight(d->bitmap);
-		
-		d->size = QSize(w, h);
-	}
-	
-	return d->bitmap;
+	return d->setBitmap(loadBitmap(device, JPEG_ACCURATE, &d->format));
 }
 
 bool ImageImporter::load(const QString &filepath)
 {
-	QFile file(filepath);
-	
-	if (!file.open(QIODevice::ReadOnly))
-		return false;
-	
-	return load(&file);
+	d->deleteBitmap();
+	return d->setBitmap(loadBitmapFromFile(filepath, JPEG_ACCURATE, &d->format));
+}
+
+bool ImageImporter::loadThumbnail(QIODevice *device, int maxSize)
+{
+	d->deleteBitmap();
+	return d->setBitmap(loadBitmap(device, thumbnailJpegFlags(maxSize), &d->format));
+}
+
+bool ImageImporter::loadThumbnail(const QString &filePath, int maxSize)
+{
+	d->deleteBitmap();
+	return d->setBitmap(loadBitmapFromFile(filePath, thumbnailJpegFlags(maxSize), &d->format));
 }
 
 bool ImageImporter::isValid() const
@@ -260,7 +391,7 @@ Image ImageImporter::toImage() const
 	
 	Image image(size());
 	
-	pasteFIBITMAPToImage(QPoint(), &image, d->bitmap);
+	pasteFIBITMAPToImage(QPoint(), &image, d->bitmap, isFloatPremultiplied(d->format));
 	return image;
 }
 
@@ -269,17 +400,204 @@ Surface ImageImporter::toSurface(const QPoint &p) const
 	if (!isValid())
 		return Surface();
 	
+	// convert uncommon bit depths once, not for each tile
+	FIBITMAP *bitmap = pastableBitmap(d->bitmap);
+	if (!bitmap)
+		return Surface();
+	
+	bool floatPremultiplied = isFloatPremultiplied(d->format);
+	
+	struct TileJob
+	{
+		QPoint key;
+		Image tile;
+	};
+	
+	const QRect bitmapRect(p, size());
+	QVector<TileJob> jobs;
+	
+	for (const QPoint &key : Surface::rectToKeys(bitmapRect))
+		jobs << TileJob { key, Image() };
+	
+	// each job converts only its own tile, and transparent tiles are dropped before they are inserted
+	
+	QtConcurrent::blockingMap(jobs, [&](TileJob &job)
+	{
+		Image tile(Surface::tileSize());
+		
+		if (!bitmapRect.contains(Surface::keyToRect(job.key)))
+			tile.clear();
+		
+		if (pasteFIBITMAPToImage(p - job.key * Surface::tileWidth(), &tile, bitmap, floatPremultiplied) && !tile.isBlank())
+			job.tile = tile;
+	});
+	
+	if (bitmap != d->bitmap)
+		FreeImage_Unload(bitmap);
+	
 	Surface surface;
-	pasteFIBITMAPToImage(p, &surface, d->bitmap);
+	
+	for (const TileJob &job : jobs)
+	{
+		if (job.tile.isValid())
+			surface.setTile(job.key, job.tile);
+	}
+	
 	return surface;
 }
 
+Image ImageImporter::toThumbnail(int maxSize) const
+{
+	if (!isValid() || maxSize <= 0)
+		return Image();
+	
+	const QSize srcSize = size();
+	const int factor = (qMax(srcSize.width(), srcSize.height()) + maxSize - 1) / maxSize;
+	
+	if (factor <= 1)
+		return toImage();
+	
+	FIBITMAP *bitmap = pastableBitmap(d->bitmap);
+	if (!bitmap)
+		return Image();
+	
+	bool floatPremultiplied = isFloatPremultiplied(d->format);
+	
+	// each band of factor rows is converted and averaged in boxes, so the full resolution is never converted at once
+	
+	Image thumbnail((srcSize.width() + factor - 1) / factor, (srcSize.height() + factor - 1) / factor);
+	Image band(srcSize.width(), factor);
+	
+	for (int ty = 0; ty < thumbnail.height(); ++ty)
+	{
+		int top = ty * factor;
+		int rowCount = qMin(factor, srcSize.height() - top);
+		
+		pasteFIBITMAPToImage(QPoint(0, -top), &band, bitmap, floatPremultiplied);
+		
+		Pixel *dst = thumbnail.scanline(ty);
+		
+		for (int tx = 0; tx < thumbnail.width(); ++tx)
+		{
+			int left = tx * factor;
+			int columnCount = qMin(factor, srcSize.width() - left);
+			
+			PixelVec sum(0.f);
+			
+			for (int y = 0; y < rowCount; ++y)
+			{
+				const Pixel *src = band.constScanline(y) + left;
+				
+				for (int x = 0; x < columnCount; ++x)
+					sum = sum + src[x].v();
+			}
+			
+			dst[tx] = sum * PixelVec(1.f / (rowCount * columnCount));
+		}
+	}
+	
+	if (bitmap != d->bitmap)
+		FreeImage_Unload(bitmap);
+	
+	return thumbnail;
+}
+
+QList<Image> ImageImporter::loadThumbnails(const QStringList &filePaths, int maxSize, int maxThreadCount)
+{
+	// a separate pool bounds the number of full-size bitmaps in memory to its thread count
+	QThreadPool pool;
+	if (maxThreadCount > 0)
+		pool.setMaxThreadCount(maxThreadCount);
+	
+	QList<QFuture<Image>> futures;
+	
+	for (const QString &filePath : filePaths)
+	{
+		futures << QtConcurrent::run(&pool, [filePath, maxSize]() -> Image
+		{
+			ImageImporter importer;
+			return importer.loadThumbnail(filePath, maxSize) ? importer.toThumbnail(maxSize) : Image();
+		});
+	}
+	
+	QList<Image> thumbnails;
+	
+	for (const QFuture<Image> &future : futures)
+		thumbnails << future.result();
+	
+	return thumbnails;
+}
+
 QStringList ImageImporter::importableExtensions()
 {
-	return { "bmp", "png", "jpg", "jpeg" };
+	return { "bmp", "png", "jpg", "jpeg", "exr", "pfm", "hdr", "tif", "tiff" };
 }
 
 
+/*
+ * Writes a region of a surface as a 16bit PNG, one band of tile rows at a time.
+ * The next band is converted in another thread while the current one is compressed,
+ * so at most two bands are in memory.
+ */
+template <class T_Pixel>
+static bool writeSurfaceToPng(QIODevice *device, const Surface &surface, const QRect &rect, PngWriter::ColorType colorType)
+{
+	typedef GenericImage<T_Pixel> BandImage;
+	
+	PngWriter writer(device, rect.size(), colorType);
+	if (!writer.begin())
+		return false;
+	
+	constexpr int tileWidth = Surface::tileWidth();
+	
+	QVector<QRect> bandRects;
+	
+	for (int y = Surface::keyForPixel(rect.topLeft()).y(); y <= Surface::keyForPixel(rect.bottomRight()).y(); ++y)
+		bandRects << (QRect(rect.left(), y * tileWidth, rect.width(), tileWidth) & rect);
+	
+	// the empty parts are filled with the conversion of a transparent pixel (white without alpha)
+	const T_Pixel blank = T_Pixel(Pixel(0));
+	
+	auto convertBand = [&surface, blank](const QRect &bandRect) -> BandImage
+	{
+		BandImage band(bandRect.size());
+		band.fill(blank);
+		
+		for (const QPoint &key : Surface::rectToKeys(bandRect))
+		{
+			if (surface.contains(key))
+				band.paste(surface.tile(key), key * tileWidth - bandRect.topLeft());
+		}
+		
+		return band;
+	};
+	
+	QFuture<BandImage> next = QtConcurrent::run([&convertBand, &bandRects]() { return convertBand(bandRects.first()); });
+	
+	for (int i = 0; i < bandRects.size(); ++i)
+	{
+		BandImage band = next.result();
+		
+		if (i + 1 < bandRects.size())
+		{
+			QRect nextRect = bandRects.at(i + 1);
+			next = QtConcurrent::run([&convertBand, nextRect]() { return convertBand(nextRect); });
+		}
+		
+		for (int y = 0; y < band.height(); ++y)
+		{
+			const T_Pixel *row = band.constScanline(y);
+			
+			if (!writer.writeRow(reinterpret_cast<const quint16 *>(row)))
+			{
+				next.waitForFinished();
+				return false;
+			}
+		}
+	}
+	
+	return writer.finish();
+}
 
 struct ImageExporter::Data
 {
@@ -296,6 +614,12 @@ struct ImageExporter::Data
 			format = FIF_JPEG;
 		else if (formatString == "png")
 			format = FIF_PNG;
+		else if (formatString == "exr")
+			format = FIF_EXR;
+		else if (formatString == "pfm")
+			format = FIF_PFM;
+		else if (formatString == "tif" || formatString == "tiff")
+			format = FIF_TIFF;
 		else
 			format = FIF_UNKNOWN;
 	}
@@ -321,14 +645,55 @@ struct ImageExporter::Data
 				else
 					bitmap = FreeImage_AllocateT(FIT_RGB16, size.width(), size.height());
 				break;
+			case FIF_EXR:
+			case FIF_TIFF:
+				// float formats keep the pixels without quantization
+				if (alphaEnabled)
+					bitmap = FreeImage_AllocateT(FIT_RGBAF, size.width(), size.height());
+				else
+					bitmap = FreeImage_AllocateT(FIT_RGBF, size.width(), size.height());
+				break;
+			case FIF_PFM:
+				bitmap = FreeImage_AllocateT(FIT_RGBF, size.width(), size.height());
+				break;
 			default:
 				bitmap = FreeImage_Allocate(size.width(), size.height(), 24);
 		}
 	}
 	
+	/*
+	 * Pastes the pending surface into a newly allocated bitmap.
+	 * Used when the surface cannot be streamed or another image is pasted onto it.
+	 */
+	bool pastePendingSurface()
+	{
+		if (!hasPendingSurface)
+			return true;
+		
+		hasPendingSurface = false;
+		allocate(pendingRect.size());
+		if (!bitmap)
+			return false;
+		
+		for (const QPoint &key : Surface::rectToKeys(pendingRect))
+		{
+			if (!pasteImageToFIBITMAP(key * Surface::tileWidth() - pendingRect.topLeft(), bitmap, pendingSurface.tile(key), isFloatPremultiplied(format)))
+				return false;
+		}
+		
+		pendingSurface = Surface();
+		return true;
+	}
+	
 	QSize size;
 	FIBITMAP *bitmap = 0;
 	FREE_IMAGE_FORMAT format;
+	
+	// a surface set for export, which is written without a full-size bitmap if possible
+	Surface pendingSurface;
+	QRect pendingRect;
+	bool hasPendingSurface = false;
+	
 	int quality = 80;
 	bool alphaEnabled = true;
 };
@@ -362,10 +727,18 @@ bool ImageExporter::isAlphaEnabled() const
 
 bool ImageExporter::save(QIODevice *device)
 {
-	if (!d->bitmap)
+	if (d->format == FIF_UNKNOWN)
 		return false;
 	
-	if (d->format == FIF_UNKNOWN)
+	if (d->hasPendingSurface && d->format == FIF_PNG)
+	{
+		if (d->alphaEnabled)
+			return writeSurfaceToPng<RgbaU16>(device, d->pendingSurface, d->pendingRect, PngWriter::ColorTypeRgba);
+		else
+			return writeSurfaceToPng<RgbU16>(device, d->pendingSurface, d->pendingRect, PngWriter::ColorTypeRgb);
+	}
+	
+	if (!d->pastePendingSurface() || !d->bitmap)
 		return false;
 	
 	int flags = 0;
@@ -395,6 +768,9 @@ bool ImageExporter::save(const QString &filePath)
 
 bool ImageExporter::setImage(const Image &image)
 {
+	d->hasPendingSurface = false;
+	d->pendingSurface = Surface();
+	
 	d->allocate(image.size());
 	if (!d->bitmap)
 		return false;
@@ -404,29 +780,24 @@ bool ImageExporter::setImage(const Image &image)
 
 bool ImageExporter::setSurface(const Surface &surface, const QRect &rect)
 {
-	auto size = rect.size();
-	
-	d->allocate(size);
-	if (!d->bitmap)
+	if (rect.isEmpty())
 		return false;
 	
-	auto pos = rect.topLeft();
-	
-	for (const QPoint &key : Surface::rectToKeys(QRect(pos, size)))
-	{
-		if (pasteImage(surface.tile(key), key * Surface::tileWidth() + pos) == false)
-			return false;
-	}
+	// the conversion is deferred to save(), where PNG is streamed band by band
+	d->deleteBitmap();
+	d->pendingSurface = surface;
+	d->pendingRect = rect;
+	d->hasPendingSurface = true;
 	
 	return true;
 }
 
 bool ImageExporter::pasteImage(const Image &image, const QPoint &pos)
 {
-	if (!d->bitmap)
+	if (!d->pastePendingSurface() || !d->bitmap)
 		return false;
 	
-	return pasteImageToFIBITMAP(pos, d->bitmap, image);
+	return pasteImageToFIBITMAP(pos, d->bitmap, image, isFloatPremultiplied(d->format));
 }
 
 
@@ -26,8 +26,27 @@ public:
 	 */
 	bool load(QIODevice *device);
 	
+	/**
+	 * Loads a file.
+	 * The file is memory-mapped, so that the codec reads from the page cache
+	 * instead of going through QIODevice for each read.
+	 * @param filepath
+	 * @return 
+	 */
 	bool load(const QString &filepath);
 	
+	/**
+	 * Loads an image for a thumbnail.
+	 * Codecs which can decode at a reduced resolution (JPEG) are asked for the smallest one
+	 * not smaller than maxSize, so size() may be smaller than the size of the file.
+	 * @param device
+	 * @param maxSize
+	 * @return 
+	 */
+	bool loadThumbnail(QIODevice *device, int maxSize);
+	
+	bool loadThumbnail(const QString &filePath, int maxSize);
+	
 	bool isValid() const;
 	
 	QSize size() const;
@@ -35,6 +54,24 @@ public:
 	Image toImage() const;
 	Surface toSurface(const QPoint &p = QPoint()) const;
 	
+	/**
+	 * Converts into an image whose width and height are at most maxSize,
+	 * averaging boxes of pixels while converting.
+	 * @param maxSize
+	 * @return 
+	 */
+	Image toThumbnail(int maxSize) const;
+	
+	/**
+	 * Loads thumbnails of files in parallel.
+	 * At most maxThreadCount files are decoded at once, which bounds the memory used.
+	 * @param filePaths
+	 * @param maxSize
+	 * @param maxThreadCount 0 for QThread::idealThreadCount()
+	 * @return The thumbnails in the order of filePaths (invalid images for the files which could not be loaded)
+	 */
+	static QList<Image> loadThumbnails(const QStringList &filePaths, int maxSize, int maxThreadCount = 0);
+	
 	static QStringList importableExtensions();
 	
 private:
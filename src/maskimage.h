@@ -0,0 +1,156 @@
+#ifndef MLMASKIMAGE_H
+#define MLMASKIMAGE_H
+
+//ExportName: MaskImage
+
+#include "genericimage.h"
+#include "genericsurface.h"
+#include "image.h"
+#include "surface.h"
+
+namespace Malachite
+{
+
+/**
+ * Image with only an alpha channel, used for masks and selections.
+ * Rows can be passed to BlendOp::blend() as masks directly.
+ */
+template <class T_Pixel>
+class GenericMaskImage : public GenericImage<T_Pixel>
+{
+public:
+	
+	typedef GenericImage<T_Pixel> super;
+	typedef T_Pixel PixelType;
+	
+	GenericMaskImage() : super() {}
+	GenericMaskImage(const super &other) : super(other) {}
+	GenericMaskImage(const QSize &size) : super(size) {}
+	GenericMaskImage(int width, int height) : super(width, height) {}
+	
+	/**
+	 * @return Whether all pixels are transparent
+	 */
+	bool isBlank() const
+	{
+		for (int y = 0; y < this->height(); ++y)
+		{
+			auto p = this->constScanline(y);
+			
+			for (int x = 0; x < this->width(); ++x)
+			{
+				if (p[x].a())
+					return false;
+			}
+		}
+		
+		return true;
+	}
+	
+	/**
+	 * Extracts the alpha channel of an image.
+	 * @param image
+	 * @return The mask
+	 */
+	static GenericMaskImage fromImage(const Image &image)
+	{
+		GenericMaskImage mask(image.size());
+		
+		for (int y = 0; y < image.height(); ++y)
+		{
+			auto sp = image.constScanline(y);
+			auto dp = mask.scanline(y);
+			
+			for (int x = 0; x < image.width(); ++x)
+				dp[x] = PixelType(sp[x]);
+		}
+		
+		return mask;
+	}
+	
+	/**
+	 * Expands the mask into a white image with the mask as its alpha channel.
+	 * @return The image
+	 */
+	Image toImage() const
+	{
+		Image image(this->size());
+		
+		for (int y = 0; y < this->height(); ++y)
+		{
+			auto sp = this->constScanline(y);
+			auto dp = image.scanline(y);
+			
+			for (int x = 0; x < this->width(); ++x)
+				dp[x] = Pixel(sp[x].alphaF());
+		}
+		
+		return image;
+	}
+};
+
+/**
+ * 32bit float mask image (4 bytes per pixel)
+ */
+typedef GenericMaskImage<AlphaF> MaskImage;
+
+/**
+ * 8bit mask image (1 byte per pixel)
+ */
+typedef GenericMaskImage<AlphaU8> MaskImageU8;
+
+/**
+ * 16bit mask image (2 bytes per pixel)
+ */
+typedef GenericMaskImage<AlphaU16> MaskImageU16;
+
+/**
+ * Tiled surface with only an alpha channel.
+ */
+template <class T_Image>
+class GenericMaskSurface : public GenericSurface<T_Image>
+{
+public:
+	
+	typedef GenericSurface<T_Image> super;
+	
+	GenericMaskSurface() : super() {}
+	GenericMaskSurface(const super &other) : super(other) {}
+	
+	/**
+	 * Extracts the alpha channel of a surface.
+	 * @param surface
+	 * @return The mask surface
+	 */
+	static GenericMaskSurface fromSurface(const Surface &surface)
+	{
+		GenericMaskSurface mask;
+		
+		for (auto i = surface.begin(); i != surface.end(); ++i)
+			mask.setTile(i.key(), T_Image::fromImage(i.value()));
+		
+		return mask;
+	}
+	
+	/**
+	 * Expands the mask into a white surface with the mask as its alpha channel.
+	 * @return The surface
+	 */
+	Surface toSurface() const
+	{
+		Surface surface;
+		
+		for (auto i = this->begin(); i != this->end(); ++i)
+			surface.setTile(i.key(), i.value().toImage());
+		
+		return surface;
+	}
+};
+
+typedef GenericMaskSurface<MaskImage> MaskSurface;
+typedef GenericMaskSurface<MaskImageU8> MaskSurfaceU8;
+typedef GenericMaskSurface<MaskImageU16> MaskSurfaceU16;
+
+}
+
+#endif // MLMASKIMAGE_H
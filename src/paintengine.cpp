@@ -22,7 +22,7 @@ void PaintEngine::drawPreTransformedPolygons(const MultiPolygon &polygons)
 
 void PaintEngine::drawPolygons(const MultiPolygon &polygons)
 {
-	drawPreTransformedPolygons(polygons * state()->shapeTransform);
+	drawPreTransformedPolygons(FixedMultiPolygon::fromPolygons(polygons, state()->shapeTransform));
 }
 
 void PaintEngine::drawPath(const QPainterPath &path)
@@ -75,8 +75,6 @@ void PaintEngine::drawSurface(const Vec2D &point, const Surface &surface)
 	_state.shapeTransform = QTransform::fromTranslate(point.x(), point.y()) * _state.shapeTransform;
 	_state.brush = Brush(surface);
 	
-	qDebug() << surface.keys();
-	
 	foreach (const QPoint &key, surface.keys())
 	{
 		Vec2D relativePos = key * Surface::tileWidth();
@@ -113,6 +111,51 @@ void PaintEngine::drawImage(const Vec2D &point, const Image &image)
 	popState();
 }
 
+void PaintEngine::drawDab(const Vec2D &center, double diameter, double hardness)
+{
+	double radius = diameter * 0.5;
+	hardness = qBound(0.0, hardness, 1.0);
+	
+	// the falloff of a soft color dab is a radial gradient, which is linear like that of the dab masks
+	// (an image or gradient brush would need a mask pass to be faded, so its dabs stay hard)
+	if (hardness < 1.0 && _state.brush.type() == Malachite::BrushTypeColor)
+	{
+		ArgbGradient gradient;
+		gradient.addStop(hardness, _state.brush.pixel());
+		gradient.addStop(1, Pixel(0));
+		
+		pushState();
+		_state.brush = Brush::fromRadialGradient(gradient, center, radius);
+		drawEllipse(center.x(), center.y(), radius, radius);
+		popState();
+		return;
+	}
+	
+	drawEllipse(center.x(), center.y(), radius, radius);
+}
+
+bool PaintEngine::mapDab(const Vec2D &center, double diameter, Vec2D *deviceCenter, double *deviceDiameter)
+{
+	if (_state.brush.type() != Malachite::BrushTypeColor)
+		return false;
+	
+	const QTransform &transform = _state.shapeTransform;
+	
+	if (!transform.isAffine())
+		return false;
+	
+	// rotation and uniform scaling, possibly mirrored
+	bool similar = (qFuzzyCompare(transform.m11(), transform.m22()) && qFuzzyCompare(transform.m12(), -transform.m21()))
+	            || (qFuzzyCompare(transform.m11(), -transform.m22()) && qFuzzyCompare(transform.m12(), transform.m21()));
+	
+	if (!similar)
+		return false;
+	
+	*deviceCenter = center * transform;
+	*deviceDiameter = diameter * std::sqrt(std::fabs(transform.determinant()));
+	return true;
+}
+
 void PaintEngine::pushState()
 {
 	_stateStack.push(_state);
@@ -11,6 +11,7 @@
 #include "surface.h"
 #include "brush.h"
 #include "fixedpolygon.h"
+#include "clipmask.h"
 
 namespace Malachite
 {
@@ -22,6 +23,7 @@ struct PaintEngineState
 	double opacity;
 	QTransform shapeTransform;
 	Malachite::ImageTransformType imageTransformType;
+	ClipMask clipMask;	///< in device coordinates; null if painting is not clipped
 };
 
 class MALACHITESHARED_EXPORT PaintEngine
@@ -46,11 +48,29 @@ public:
 	virtual void drawImage(const Vec2D &point, const Image &image);
 	virtual void drawSurface(const Vec2D &point, const Surface &surface);
 	
+	/**
+	 * Stamps a round dab.
+	 * The default implementation draws an ellipse, filled with a radial gradient for a soft dab of a color brush;
+	 * soft dabs of other brushes are drawn hard.
+	 * @param center
+	 * @param diameter
+	 * @param hardness The ratio of the fully opaque radius to the radius (0 ... 1)
+	 */
+	virtual void drawDab(const Vec2D &center, double diameter, double hardness);
+	
 	PaintEngineState *state() { return &_state; }
 	
 	void pushState();
 	void popState();
 	
+protected:
+	
+	/**
+	 * Maps a dab to the device coordinates for stamping with a cached mask.
+	 * @return Whether the dab can be stamped, that is, the brush is a color and the shape transform keeps circles round
+	 */
+	bool mapDab(const Vec2D &center, double diameter, Vec2D *deviceCenter, double *deviceDiameter);
+	
 private:
 	PaintEngineState _state;
 	QStack<PaintEngineState> _stateStack;
@@ -76,6 +76,22 @@ public:
 	void setShapeTransform(const QTransform &transform) { state()->shapeTransform = transform; }
 	QTransform shapeTransform() const { return state()->shapeTransform; }
 	
+	/**
+	 * Sets a clip mask in device coordinates.
+	 * Painting is multiplied by the mask and skips the tiles where the mask is empty.
+	 * @param mask
+	 */
+	void setClipMask(const MaskSurface &mask) { state()->clipMask = ClipMask(mask); }
+	
+	/**
+	 * Sets a clip path, which is transformed with the current shape transform.
+	 * @param path
+	 */
+	void setClipPath(const QPainterPath &path) { state()->clipMask = ClipMask::fromPath(path * state()->shapeTransform); }
+	
+	void clearClip() { state()->clipMask = ClipMask(); }
+	ClipMask clipMask() const { return state()->clipMask; }
+	
 	void setImageTransformType(Malachite::ImageTransformType type) { state()->imageTransformType = type; }
 	Malachite::ImageTransformType imageTransformType() const { return state()->imageTransformType; }
 	
@@ -156,6 +172,16 @@ public:
 	void drawEllipse(const Vec2D &center, double rx, double ry)
 		{ drawEllipse(center.x(), center.y(), rx, ry); }
 	
+	/**
+	 * Stamps a round dab with a pre-rasterized coverage mask.
+	 * Dabs with non-color brushes or non-similarity transforms are drawn as ellipses.
+	 * @param center
+	 * @param diameter
+	 * @param hardness The ratio of the fully opaque radius to the radius (0 ... 1)
+	 */
+	void drawDab(const Vec2D &center, double diameter, double hardness = 1.0)
+		{ Q_ASSERT(_paintEngine); _paintEngine->drawDab(center, diameter, hardness); }
+	
 	void drawRect(const QRectF &rect)
 		{ drawRect(rect.x(), rect.y(), rect.width(), rect.height()); }
 	
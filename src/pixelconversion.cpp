@@ -0,0 +1,431 @@
+#include <cstring>
+#include <emmintrin.h>
+#include "pixelconversion.h"
+
+namespace Malachite
+{
+
+static_assert(sizeof(Pixel) == 16, "Pixel must be 4 packed floats");
+static_assert(sizeof(BgrU8) == 3 && sizeof(BgraU8) == 4 && sizeof(BgraPremultU8) == 4, "8bit pixels must be packed");
+static_assert(sizeof(RgbU16) == 6 && sizeof(RgbaU16) == 8, "16bit pixels must be packed");
+static_assert(sizeof(RgbF) == 12 && sizeof(RgbaF) == 16 && sizeof(RgbaPremultF) == 16, "float pixels must be packed");
+
+namespace
+{
+
+inline __m128 loadPixel(const Pixel *p)
+{
+	return _mm_loadu_ps(reinterpret_cast<const float *>(p));
+}
+
+inline void storePixel(Pixel *p, __m128 v)
+{
+	_mm_storeu_ps(reinterpret_cast<float *>(p), v);
+}
+
+inline __m128 alphaLaneMask()
+{
+	return _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+}
+
+// replaces the alpha lane of v with that of a
+inline __m128 withAlphaOf(__m128 v, __m128 a)
+{
+	__m128 mask = alphaLaneMask();
+	return _mm_or_ps(_mm_andnot_ps(mask, v), _mm_and_ps(mask, a));
+}
+
+inline __m128 broadcastAlpha(__m128 v)
+{
+	return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// (b, g, r, a) -> (b * a, g * a, r * a, a)
+inline __m128 premultiply(__m128 v)
+{
+	return withAlphaOf(_mm_mul_ps(v, broadcastAlpha(v)), v);
+}
+
+// (b, g, r, a) -> (b / a, g / a, r / a, a), the color becomes 0 if a is 0
+inline __m128 unpremultiply(__m128 v)
+{
+	__m128 a = broadcastAlpha(v);
+	__m128 nonZero = _mm_cmpneq_ps(a, _mm_setzero_ps());
+	return withAlphaOf(_mm_and_ps(_mm_div_ps(v, a), nonZero), v);
+}
+
+// composites a premultiplied color onto white (the alpha lane becomes 1)
+inline __m128 removePremultipliedAlpha(__m128 v)
+{
+	return _mm_sub_ps(_mm_add_ps(v, _mm_set1_ps(1.f)), broadcastAlpha(v));
+}
+
+// BGRA <-> RGBA
+inline __m128 swapRedBlue(__m128 v)
+{
+	return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+// the low 4 uint32 lanes -> floats in [0, 1]
+inline __m128 normalize(__m128i x, float max)
+{
+	return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.f / max));
+}
+
+// the low 4 bytes -> floats in [0, 1]
+inline __m128 unpackU8(__m128i x)
+{
+	__m128i zero = _mm_setzero_si128();
+	return normalize(_mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero), 0xFF);
+}
+
+// the low 4 uint16 -> floats in [0, 1]
+inline __m128 unpackU16(__m128i x)
+{
+	return normalize(_mm_unpacklo_epi16(x, _mm_setzero_si128()), 0xFFFF);
+}
+
+// scales [0, 1] to [0, max], saturating and rounding half away from zero like std::round
+inline __m128i quantize(__m128 v, float max)
+{
+	__m128 vmax = _mm_set1_ps(max);
+	v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, vmax), _mm_setzero_ps()), vmax);
+	return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+
+// 4 x 4 lanes in [0, 0xFF] -> 16 bytes
+inline __m128i packU8(__m128i x0, __m128i x1, __m128i x2, __m128i x3)
+{
+	return _mm_packus_epi16(_mm_packs_epi32(x0, x1), _mm_packs_epi32(x2, x3));
+}
+
+// 2 x 4 lanes in [0, 0xFFFF] -> 8 uint16
+// (SSE2 has no unsigned 32 -> 16 bit pack, so the values are biased into the signed range)
+inline __m128i packU16(__m128i x0, __m128i x1)
+{
+	__m128i bias32 = _mm_set1_epi32(0x8000);
+	__m128i bias16 = _mm_set1_epi16(short(0x8000));
+	return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(x0, bias32), _mm_sub_epi32(x1, bias32)), bias16);
+}
+
+inline uint32_t loadDword(const void *p)
+{
+	uint32_t x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+template <bool Premultiply>
+void convertFromBgraU8(Pixel *dst, const void *src, int count)
+{
+	auto bytes = static_cast<const uint8_t *>(src);
+	__m128i zero = _mm_setzero_si128();
+	
+	auto finish = [](__m128 v) { return Premultiply ? premultiply(v) : v; };
+	
+	int i = 0;
+	
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i * 4));
+		__m128i lo = _mm_unpacklo_epi8(x, zero);
+		__m128i hi = _mm_unpackhi_epi8(x, zero);
+		
+		storePixel(dst + i, finish(normalize(_mm_unpacklo_epi16(lo, zero), 0xFF)));
+		storePixel(dst + i + 1, finish(normalize(_mm_unpackhi_epi16(lo, zero), 0xFF)));
+		storePixel(dst + i + 2, finish(normalize(_mm_unpacklo_epi16(hi, zero), 0xFF)));
+		storePixel(dst + i + 3, finish(normalize(_mm_unpackhi_epi16(hi, zero), 0xFF)));
+	}
+	
+	for (; i < count; ++i)
+		storePixel(dst + i, finish(unpackU8(_mm_cvtsi32_si128(loadDword(bytes + i * 4)))));
+}
+
+template <bool Unpremultiply>
+void convertToBgraU8(void *dst, const Pixel *src, int count)
+{
+	auto bytes = static_cast<uint8_t *>(dst);
+	
+	auto load = [&](int i)
+	{
+		__m128 v = loadPixel(src + i);
+		return quantize(Unpremultiply ? unpremultiply(v) : v, 0xFF);
+	};
+	
+	int i = 0;
+	
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i * 4), packU8(load(i), load(i + 1), load(i + 2), load(i + 3)));
+	
+	for (; i < count; ++i)
+	{
+		__m128i x = load(i);
+		uint32_t packed = _mm_cvtsi128_si32(packU8(x, x, x, x));
+		memcpy(bytes + i * 4, &packed, 4);
+	}
+}
+
+}
+
+void PixelRowConverter<Pixel, BgrU8>::convert(Pixel *dst, const BgrU8 *src, int count)
+{
+	auto bytes = reinterpret_cast<const uint8_t *>(src);
+	
+	// keeps the 3 color bytes of the lowest dword and sets the alpha byte
+	__m128i colorMask = _mm_cvtsi32_si128(0x00FFFFFF);
+	__m128i alphaByte = _mm_cvtsi32_si128(0xFF000000);
+	
+	auto toPixel = [&](__m128i x)
+	{
+		return unpackU8(_mm_or_si128(_mm_and_si128(x, colorMask), alphaByte));
+	};
+	
+	int i = 0;
+	
+	// 16 bytes are loaded for 4 pixels (12 bytes), so 2 more pixels must follow
+	for (; i + 6 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i * 3));
+		
+		storePixel(dst + i, toPixel(x));
+		storePixel(dst + i + 1, toPixel(_mm_srli_si128(x, 3)));
+		storePixel(dst + i + 2, toPixel(_mm_srli_si128(x, 6)));
+		storePixel(dst + i + 3, toPixel(_mm_srli_si128(x, 9)));
+	}
+	
+	for (; i < count; ++i)
+	{
+		const uint8_t *p = bytes + i * 3;
+		storePixel(dst + i, toPixel(_mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16))));
+	}
+}
+
+void PixelRowConverter<Pixel, BgraU8>::convert(Pixel *dst, const BgraU8 *src, int count)
+{
+	convertFromBgraU8<true>(dst, src, count);
+}
+
+void PixelRowConverter<Pixel, BgraPremultU8>::convert(Pixel *dst, const BgraPremultU8 *src, int count)
+{
+	convertFromBgraU8<false>(dst, src, count);
+}
+
+void PixelRowConverter<Pixel, RgbU16>::convert(Pixel *dst, const RgbU16 *src, int count)
+{
+	auto words = reinterpret_cast<const uint16_t *>(src);
+	
+	auto toPixel = [](__m128i x)
+	{
+		return swapRedBlue(unpackU16(_mm_insert_epi16(x, 0xFFFF, 3)));
+	};
+	
+	int i = 0;
+	
+	// 8 bytes are loaded for each pixel (6 bytes), so another pixel must follow
+	for (; i + 1 < count; ++i)
+		storePixel(dst + i, toPixel(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(words + i * 3))));
+	
+	if (i < count)
+	{
+		const uint16_t *p = words + i * 3;
+		storePixel(dst + i, toPixel(_mm_set_epi16(0, 0, 0, 0, 0, p[2], p[1], p[0])));
+	}
+}
+
+void PixelRowConverter<Pixel, RgbaU16>::convert(Pixel *dst, const RgbaU16 *src, int count)
+{
+	auto words = reinterpret_cast<const uint16_t *>(src);
+	__m128i zero = _mm_setzero_si128();
+	
+	auto toPixel = [](__m128i x)
+	{
+		return premultiply(swapRedBlue(normalize(x, 0xFFFF)));
+	};
+	
+	int i = 0;
+	
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + i * 4));
+		storePixel(dst + i, toPixel(_mm_unpacklo_epi16(x, zero)));
+		storePixel(dst + i + 1, toPixel(_mm_unpackhi_epi16(x, zero)));
+	}
+	
+	if (i < count)
+		storePixel(dst + i, toPixel(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(words + i * 4)), zero)));
+}
+
+void PixelRowConverter<Pixel, RgbF>::convert(Pixel *dst, const RgbF *src, int count)
+{
+	auto floats = reinterpret_cast<const float *>(src);
+	
+	auto toPixel = [](__m128 x)
+	{
+		return withAlphaOf(swapRedBlue(x), _mm_set1_ps(1.f));
+	};
+	
+	int i = 0;
+	
+	// 16 bytes are loaded for each pixel (12 bytes), so another pixel must follow
+	for (; i + 1 < count; ++i)
+		storePixel(dst + i, toPixel(_mm_loadu_ps(floats + i * 3)));
+	
+	if (i < count)
+	{
+		const float *p = floats + i * 3;
+		storePixel(dst + i, toPixel(_mm_set_ps(0.f, p[2], p[1], p[0])));
+	}
+}
+
+void PixelRowConverter<Pixel, RgbaF>::convert(Pixel *dst, const RgbaF *src, int count)
+{
+	auto floats = reinterpret_cast<const float *>(src);
+	
+	for (int i = 0; i < count; ++i)
+		storePixel(dst + i, premultiply(swapRedBlue(_mm_loadu_ps(floats + i * 4))));
+}
+
+void PixelRowConverter<Pixel, RgbaPremultF>::convert(Pixel *dst, const RgbaPremultF *src, int count)
+{
+	auto floats = reinterpret_cast<const float *>(src);
+	
+	for (int i = 0; i < count; ++i)
+		storePixel(dst + i, swapRedBlue(_mm_loadu_ps(floats + i * 4)));
+}
+
+void PixelRowConverter<BgrU8, Pixel>::convert(BgrU8 *dst, const Pixel *src, int count)
+{
+	auto bytes = reinterpret_cast<uint8_t *>(dst);
+	
+	auto load = [&](int i)
+	{
+		return quantize(removePremultipliedAlpha(loadPixel(src + i)), 0xFF);
+	};
+	
+	int i = 0;
+	
+	for (; i + 4 <= count; i += 4)
+	{
+		union
+		{
+			__m128i x;
+			uint8_t bytes[16];
+		} u;
+		
+		u.x = packU8(load(i), load(i + 1), load(i + 2), load(i + 3));
+		
+		for (int j = 0; j < 4; ++j)
+			memcpy(bytes + (i + j) * 3, u.bytes + j * 4, 3);
+	}
+	
+	for (; i < count; ++i)
+	{
+		__m128i x = load(i);
+		uint32_t packed = _mm_cvtsi128_si32(packU8(x, x, x, x));
+		memcpy(bytes + i * 3, &packed, 3);
+	}
+}
+
+void PixelRowConverter<BgraU8, Pixel>::convert(BgraU8 *dst, const Pixel *src, int count)
+{
+	convertToBgraU8<true>(dst, src, count);
+}
+
+void PixelRowConverter<BgraPremultU8, Pixel>::convert(BgraPremultU8 *dst, const Pixel *src, int count)
+{
+	convertToBgraU8<false>(dst, src, count);
+}
+
+void PixelRowConverter<RgbU16, Pixel>::convert(RgbU16 *dst, const Pixel *src, int count)
+{
+	auto words = reinterpret_cast<uint16_t *>(dst);
+	
+	auto load = [&](int i)
+	{
+		return quantize(swapRedBlue(removePremultipliedAlpha(loadPixel(src + i))), 0xFFFF);
+	};
+	
+	union
+	{
+		__m128i x;
+		uint16_t words[8];
+	} u;
+	
+	int i = 0;
+	
+	for (; i + 2 <= count; i += 2)
+	{
+		u.x = packU16(load(i), load(i + 1));
+		memcpy(words + i * 3, u.words, 6);
+		memcpy(words + i * 3 + 3, u.words + 4, 6);
+	}
+	
+	if (i < count)
+	{
+		__m128i x = load(i);
+		u.x = packU16(x, x);
+		memcpy(words + i * 3, u.words, 6);
+	}
+}
+
+void PixelRowConverter<RgbaU16, Pixel>::convert(RgbaU16 *dst, const Pixel *src, int count)
+{
+	auto words = reinterpret_cast<uint16_t *>(dst);
+	
+	auto load = [&](int i)
+	{
+		return quantize(swapRedBlue(unpremultiply(loadPixel(src + i))), 0xFFFF);
+	};
+	
+	int i = 0;
+	
+	for (; i + 2 <= count; i += 2)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i * 4), packU16(load(i), load(i + 1)));
+	
+	if (i < count)
+	{
+		__m128i x = load(i);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(words + i * 4), packU16(x, x));
+	}
+}
+
+void PixelRowConverter<RgbF, Pixel>::convert(RgbF *dst, const Pixel *src, int count)
+{
+	auto floats = reinterpret_cast<float *>(dst);
+	
+	auto load = [&](int i)
+	{
+		return swapRedBlue(removePremultipliedAlpha(loadPixel(src + i)));
+	};
+	
+	int i = 0;
+	
+	// 16 bytes are stored for each pixel (12 bytes); the extra lane is overwritten by the next pixel
+	for (; i + 1 < count; ++i)
+		_mm_storeu_ps(floats + i * 3, load(i));
+	
+	if (i < count)
+	{
+		float v[4];
+		_mm_storeu_ps(v, load(i));
+		memcpy(floats + i * 3, v, 12);
+	}
+}
+
+void PixelRowConverter<RgbaF, Pixel>::convert(RgbaF *dst, const Pixel *src, int count)
+{
+	auto floats = reinterpret_cast<float *>(dst);
+	
+	for (int i = 0; i < count; ++i)
+		_mm_storeu_ps(floats + i * 4, swapRedBlue(unpremultiply(loadPixel(src + i))));
+}
+
+void PixelRowConverter<RgbaPremultF, Pixel>::convert(RgbaPremultF *dst, const Pixel *src, int count)
+{
+	auto floats = reinterpret_cast<float *>(dst);
+	
+	for (int i = 0; i < count; ++i)
+		_mm_storeu_ps(floats + i * 4, swapRedBlue(loadPixel(src + i)));
+}
+
+}
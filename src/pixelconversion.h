@@ -3,214 +3,159 @@
 
 //ExportName: PixelConversion
 
-/*
-#include "global.h"
-#include "vector.h"
-#include <QDebug>
+#include "pixel.h"
 
 namespace Malachite
 {
 
-template <ImageFormat DstFormat, class DstColor, ImageFormat SrcFormat, class SrcColor>
-inline void convertPixel(DstColor &dst, const SrcColor &src)
+/**
+ * Converts pixels one by one through the RgbPixel conversions.
+ * @param dst
+ * @param src
+ * @param count The number of pixels
+ */
+template <class T_Dst, class T_Src>
+inline void convertPixelsGeneric(T_Dst *dst, const T_Src *src, int count)
 {
-	Q_UNUSED(dst); Q_UNUSED(src);
-	qWarning() << "uninplemented image format / type conversion";
+	for (int i = 0; i < count; ++i)
+		dst[i] = T_Dst(src[i]);
 }
 
-// 8bit unsigned rgb -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatRgb, Vec3U8>(Vec4F &dst, const Vec3U8 &src)
+/**
+ * Converts a row of pixels from T_Src to T_Dst.
+ * Used by GenericImage::paste.
+ * The pairs between Pixel and the 8bit / 16bit / float formats used in image import and export
+ * are specialized with SSE2 kernels.
+ */
+template <class T_Dst, class T_Src>
+struct PixelRowConverter
 {
-	dst.a = 0xFF;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFF;
-}
+	static constexpr bool isAccelerated() { return false; }
+	
+	static void convert(T_Dst *dst, const T_Src *src, int count)
+	{
+		convertPixelsGeneric(dst, src, count);
+	}
+};
+
+/*
+ * The accelerated kernels produce the same results as convertPixelsGeneric
+ * except that integer channels out of range are saturated
+ * and float channels may differ in the last bit.
+ */
 
-// 16bit unsigned rgb -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatRgb, Vec3U16>(Vec4F &dst, const Vec3U16 &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, BgrU8>
 {
-	dst.a = 0xFFFF;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFFFF;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const BgrU8 *src, int count);
+};
 
-// 8bit unsigned argb -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatArgb, Vec4U8>(Vec4F &dst, const Vec4U8 &src)
-{
-	dst.a = src.a;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFF;
-	dst.r *= dst.a;
-	dst.g *= dst.a;
-	dst.b *= dst.a;
-}
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, BgraU8>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const BgraU8 *src, int count);
+};
 
-// 16bit unsigned argb -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatArgb, Vec4U16>(Vec4F &dst, const Vec4U16 &src)
-{
-	dst.a = src.a;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFFFF;
-	dst.r *= dst.a;
-	dst.g *= dst.a;
-	dst.b *= dst.a;
-}
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, BgraPremultU8>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const BgraPremultU8 *src, int count);
+};
 
-// 8bit unsigned argb premultiplied -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatArgbFast, Vec4U8>(Vec4F &dst, const Vec4U8 &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, RgbU16>
 {
-	dst.a = src.a;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFF;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const RgbU16 *src, int count);
+};
 
-// 16bit unsigned argb premultiplied -> 32bit float argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4F, ImageFormatArgbFast, Vec4U16>(Vec4F &dst, const Vec4U16 &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, RgbaU16>
 {
-	dst.a = src.a;
-	dst.r = src.r;
-	dst.g = src.g;
-	dst.b = src.b;
-	dst *= 1.0 / 0xFFFF;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const RgbaU16 *src, int count);
+};
 
-// 32bit float argb premultiplied -> 8bit unsigned rgb
-template < >
-inline void convertPixel<ImageFormatRgb, Vec3U8, ImageFormatArgbFast, Vec4F>(Vec3U8 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, RgbF>
 {
-	Vec4F v = src + (Vec4F(1.f) - src.extract3()) * Vec4F(1.f);
-	v *= 0xFF;
-	Vec4I32 iv = vecRound(v);
-	
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const RgbF *src, int count);
+};
 
-// 32bit float argb premultiplied -> 16bit unsigned rgb
-template < >
-inline void convertPixel<ImageFormatRgb, Vec3U16, ImageFormatArgbFast, Vec4F>(Vec3U16 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, RgbaF>
 {
-	Vec4F v = src + (Vec4F(1.f) - src.extract3()) * Vec4F(1.f);
-	v *= 0xFFFF;
-	Vec4I32 iv = vecRound(v);
-	
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const RgbaF *src, int count);
+};
 
-// 32bit float argb premultiplied -> 8bit unsigned argb
-template < >
-inline void convertPixel<ImageFormatArgb, Vec4U8, ImageFormatArgbFast, Vec4F>(Vec4U8 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<Pixel, RgbaPremultF>
 {
-	Vec4F v = src;
-	
-	float a = v.a;
-	if (a)
-	{
-		v /= a;
-		v.a = a;
-	}
-	
-	v *= 0xFF;
-	
-	Vec4I32 iv = vecRound(v);
-	dst.a = iv.a;
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(Pixel *dst, const RgbaPremultF *src, int count);
+};
 
-// 32bit float argb premultiplied -> 16bit unsigned argb
-template < >
-inline void convertPixel<ImageFormatArgb, Vec4U16, ImageFormatArgbFast, Vec4F>(Vec4U16 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<BgrU8, Pixel>
 {
-	Vec4F v = src;
-	
-	float a = v.a;
-	if (a)
-	{
-		v /= a;
-		v.a = a;
-	}
-	
-	v *= 0xFFFF;
-	
-	Vec4I32 iv = vecRound(v);
-	
-	dst.a = iv.a;
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(BgrU8 *dst, const Pixel *src, int count);
+};
 
-// 32bit float argb premultiplied -> 16bit unsigned bgra
-template < >
-inline void convertPixel<ImageFormatBgra, Vec4U16, ImageFormatArgbFast, Vec4F>(Vec4U16 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<BgraU8, Pixel>
 {
-	Vec4F v = src;
-	
-	float a = v.a;
-	if (a)
-	{
-		v /= a;
-		v.a = a;
-	}
-	
-	v *= 0xFFFF;
-	
-	Vec4I32 iv = vecRound(v);
-	
-	dst.a = iv.a;
-	dst.b = iv.r;
-	dst.g = iv.g;
-	dst.r = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(BgraU8 *dst, const Pixel *src, int count);
+};
 
-// 32bit float argb premultiplied -> 8bit unsigned argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4U8, ImageFormatArgbFast, Vec4F>(Vec4U8 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<BgraPremultU8, Pixel>
 {
-	Vec4F v = src * 0xFF;
-	Vec4I32 iv = vecRound(v);
-	
-	dst.a = iv.a;
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(BgraPremultU8 *dst, const Pixel *src, int count);
+};
 
-// 32bit float argb premultiplied -> 16bit unsigned argb premultiplied
-template < >
-inline void convertPixel<ImageFormatArgbFast, Vec4U16, ImageFormatArgbFast, Vec4F>(Vec4U16 &dst, const Vec4F &src)
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<RgbU16, Pixel>
 {
-	Vec4F v = src * 0xFFFF;
-	Vec4I32 iv = vecRound(v);
-	
-	dst.a = iv.a;
-	dst.r = iv.r;
-	dst.g = iv.g;
-	dst.b = iv.b;
-}
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(RgbU16 *dst, const Pixel *src, int count);
+};
+
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<RgbaU16, Pixel>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(RgbaU16 *dst, const Pixel *src, int count);
+};
 
-}*/
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<RgbF, Pixel>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(RgbF *dst, const Pixel *src, int count);
+};
+
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<RgbaF, Pixel>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(RgbaF *dst, const Pixel *src, int count);
+};
 
+template <>
+struct MALACHITESHARED_EXPORT PixelRowConverter<RgbaPremultF, Pixel>
+{
+	static constexpr bool isAccelerated() { return true; }
+	static void convert(RgbaPremultF *dst, const Pixel *src, int count);
+};
+
+}
 
 #endif // MLPIXELCONVERSION_H
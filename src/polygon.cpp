@@ -95,12 +95,21 @@ Polygon::Polygon(const QVector<QPointF> &points) :
 
 Polygon &Polygon::operator*=(const QTransform &transform)
 {
+	if (transform.isAffine())
+		return *this *= Affine2D::fromQTransform(transform);
+	
 	for (Polygon::iterator i = begin(); i != end(); ++i)
 		*i *= transform;
 	
 	return *this;
 }
 
+Polygon &Polygon::operator*=(const Affine2D &transform)
+{
+	transformPoints(transform, constData(), data(), size());
+	return *this;
+}
+
 QPolygonF Polygon::toQPolygonF() const
 {
 	QPolygonF polygon(size());
@@ -182,11 +191,44 @@ MultiPolygon MultiPolygon::fromQPainterPath(const QPainterPath &path)
 
 MultiPolygon &MultiPolygon::operator*=(const QTransform &transform)
 {
+	if (transform.isAffine())
+		return *this *= Affine2D::fromQTransform(transform);
+	
 	for (MultiPolygon::iterator i = begin(); i != end(); ++i)
 		*i *= transform;
 	
 	return *this;
 }
 
+MultiPolygon &MultiPolygon::operator*=(const Affine2D &transform)
+{
+	for (MultiPolygon::iterator i = begin(); i != end(); ++i)
+		*i *= transform;
+	
+	return *this;
+}
+
+MultiPolygon operator*(const MultiPolygon &polygons, const QTransform &transform)
+{
+	if (transform.isAffine())
+		return Affine2D::fromQTransform(transform) * polygons;
+	
+	MultiPolygon result = polygons;
+	result *= transform;
+	return result;
+}
+
+MultiPolygon operator*(const Affine2D &transform, const MultiPolygon &polygons)
+{
+	// writes into fresh buffers instead of detaching and overwriting copies
+	
+	MultiPolygon result(polygons.size());
+	
+	for (int i = 0; i < polygons.size(); ++i)
+		result[i] = transform * polygons.at(i);
+	
+	return result;
+}
+
 }
 
@@ -3,7 +3,7 @@
 
 //ExportName: Polygon
 
-#include "vec2d.h"
+#include "affine2d.h"
 #include <QVector>
 #include <QPolygonF>
 
@@ -21,6 +21,7 @@ public:
 	static Polygon fromEllipse(const Vec2D &center, const Vec2D &radius);
 	
 	Polygon &operator*=(const QTransform &transform);
+	Polygon &operator*=(const Affine2D &transform);
 	
 	QPolygonF toQPolygonF() const;
 };
@@ -35,15 +36,19 @@ public:
 	static MultiPolygon fromQPainterPath(const QPainterPath &path);
 	
 	MultiPolygon &operator*=(const QTransform &transform);
+	MultiPolygon &operator*=(const Affine2D &transform);
 };
 
-inline MultiPolygon operator*(const MultiPolygon &polygons, const QTransform &transform)
+inline Polygon operator*(const Affine2D &transform, const Polygon &polygon)
 {
-	MultiPolygon result = polygons;
-	result *= transform;
+	Polygon result(polygon.size());
+	transformPoints(transform, polygon.constData(), result.data(), polygon.size());
 	return result;
 }
 
+MALACHITESHARED_EXPORT MultiPolygon operator*(const MultiPolygon &polygons, const QTransform &transform);
+MALACHITESHARED_EXPORT MultiPolygon operator*(const Affine2D &transform, const MultiPolygon &polygons);
+
 }
 
 #endif // MLPOLYGON_H
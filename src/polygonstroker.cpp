@@ -0,0 +1,253 @@
+#include "polygonstroker.h"
+
+namespace Malachite
+{
+
+namespace
+{
+
+inline Vec2D leftNormal(const Vec2D &d)
+{
+	return Vec2D(-d.y(), d.x());
+}
+
+inline double cross(const Vec2D &v1, const Vec2D &v2)
+{
+	return v1.x() * v2.y() - v1.y() * v2.x();
+}
+
+// appends a piece, reversing it if needed so that all pieces share the same orientation
+void appendPiece(FixedMultiPolygon &result, const Vec2D *points, int count)
+{
+	double area = 0;
+	
+	for (int i = 0; i < count; ++i)
+		area += cross(points[i], points[(i + 1) % count]);
+	
+	if (area == 0)
+		return;
+	
+	FixedPolygon piece(count);
+	FixedPoint *dst = piece.data();
+	
+	if (area > 0)
+	{
+		for (int i = 0; i < count; ++i)
+			dst[i] = FixedPoint(points[i]);
+	}
+	else
+	{
+		for (int i = 0; i < count; ++i)
+			dst[i] = FixedPoint(points[count - 1 - i]);
+	}
+	
+	result << piece;
+}
+
+void appendCircle(FixedMultiPolygon &result, const Vec2D &center, double radius)
+{
+	Polygon circle = Polygon::fromEllipse(center, Vec2D(radius));
+	appendPiece(result, circle.constData(), circle.size());
+}
+
+}
+
+FixedMultiPolygon PolygonStroker::stroke(const Polygon &polyline, bool closed) const
+{
+	FixedMultiPolygon result;
+	strokeTo(result, polyline, 0, closed);
+	return result;
+}
+
+FixedMultiPolygon PolygonStroker::stroke(const Polygon &polyline, const QVector<double> &widths, bool closed) const
+{
+	if (widths.size() != polyline.size())
+		return stroke(polyline, closed);
+	
+	FixedMultiPolygon result;
+	strokeTo(result, polyline, widths.constData(), closed);
+	return result;
+}
+
+FixedMultiPolygon PolygonStroker::stroke(const MultiPolygon &polylines, bool closed) const
+{
+	FixedMultiPolygon result;
+	
+	for (const Polygon &polyline : polylines)
+		strokeTo(result, polyline, 0, closed);
+	
+	return result;
+}
+
+FixedMultiPolygon PolygonStroker::stroke(const FixedPolygon &polyline, bool closed) const
+{
+	Polygon points(polyline.size());
+	
+	for (int i = 0; i < polyline.size(); ++i)
+		points[i] = polyline.at(i).toMLVec2D();
+	
+	return stroke(points, closed);
+}
+
+void PolygonStroker::strokeTo(FixedMultiPolygon &result, const Polygon &polyline, const double *widths, bool closed) const
+{
+	// drop repeated points
+	
+	Polygon points;
+	QVector<double> halfWidths;
+	points.reserve(polyline.size());
+	halfWidths.reserve(polyline.size());
+	
+	for (int i = 0; i < polyline.size(); ++i)
+	{
+		if (points.size() && points.last() == polyline.at(i))
+			continue;
+		
+		points << polyline.at(i);
+		halfWidths << 0.5 * (widths ? widths[i] : _width);
+	}
+	
+	if (closed && points.size() > 1 && points.first() == points.last())
+	{
+		points.removeLast();
+		halfWidths.removeLast();
+	}
+	
+	int count = points.size();
+	
+	if (count == 0)
+		return;
+	
+	auto appendCap = [&](const Vec2D &p, const Vec2D &outward, double h)
+	{
+		if (h <= 0)
+			return;
+		
+		switch (_capStyle)
+		{
+			case CapRound:
+			{
+				appendCircle(result, p, h);
+				break;
+			}
+			case CapSquare:
+			{
+				Vec2D n = leftNormal(outward) * h;
+				Vec2D d = outward * h;
+				Vec2D piece[4] = { p - n, p - n + d, p + n + d, p + n };
+				appendPiece(result, piece, 4);
+				break;
+			}
+			default:
+			case CapFlat:
+				break;
+		}
+	};
+	
+	if (count == 1)
+	{
+		// a dot; the cap shape is drawn around it
+		appendCap(points.first(), Vec2D(1, 0), halfWidths.first());
+		if (_capStyle == CapSquare)
+			appendCap(points.first(), Vec2D(-1, 0), halfWidths.first());
+		return;
+	}
+	
+	int segmentCount = closed ? count : count - 1;
+	
+	Polygon directions(segmentCount);
+	
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		Vec2D d = points.at((i + 1) % count) - points.at(i);
+		directions[i] = d / d.length();
+	}
+	
+	// segments (trapezoids if the width varies)
+	
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		int j = (i + 1) % count;
+		
+		const Vec2D &p1 = points.at(i);
+		const Vec2D &p2 = points.at(j);
+		
+		Vec2D n = leftNormal(directions.at(i));
+		Vec2D n1 = n * halfWidths.at(i);
+		Vec2D n2 = n * halfWidths.at(j);
+		
+		Vec2D piece[4] = { p1 - n1, p2 - n2, p2 + n2, p1 + n1 };
+		appendPiece(result, piece, 4);
+	}
+	
+	// joins
+	
+	int firstJoin = closed ? 0 : 1;
+	int lastJoin = closed ? count - 1 : count - 2;
+	
+	for (int i = firstJoin; i <= lastJoin; ++i)
+	{
+		const Vec2D &p = points.at(i);
+		const Vec2D &d1 = directions.at((i + segmentCount - 1) % segmentCount);
+		const Vec2D &d2 = directions.at(i);
+		double h = halfWidths.at(i);
+		
+		if (h <= 0)
+			continue;
+		
+		double c = cross(d1, d2);
+		
+		if (std::fabs(c) < 1e-12 && Vec2D::dot(d1, d2) > 0)
+			continue;
+		
+		if (_joinStyle == JoinRound)
+		{
+			appendCircle(result, p, h);
+			continue;
+		}
+		
+		// the outer side is opposite to the turning direction
+		double side = c > 0 ? -1.0 : 1.0;
+		Vec2D n1 = leftNormal(d1) * side;
+		Vec2D n2 = leftNormal(d2) * side;
+		
+		Vec2D a = p + n1 * h;
+		Vec2D b = p + n2 * h;
+		
+		if (std::fabs(c) < 1e-12)
+		{
+			// a 180 degree turn has no corner to miter or bevel, so it is closed with a square end
+			Vec2D d = d1 * h;
+			Vec2D piece[4] = { a, a + d, b + d, b };
+			appendPiece(result, piece, 4);
+			continue;
+		}
+		
+		if (_joinStyle == JoinMiter)
+		{
+			// 1 + cos(theta) = 2 * cos^2(theta / 2); the miter length is h / cos(theta / 2)
+			double cosine = 1.0 + Vec2D::dot(n1, n2);
+			
+			if (cosine > 0 && 2.0 <= _miterLimit * _miterLimit * cosine)
+			{
+				Vec2D m = p + (n1 + n2) * (h / cosine);
+				Vec2D piece[4] = { p, a, m, b };
+				appendPiece(result, piece, 4);
+				continue;
+			}
+		}
+		
+		Vec2D piece[3] = { p, a, b };
+		appendPiece(result, piece, 3);
+	}
+	
+	// caps
+	
+	if (!closed)
+	{
+		appendCap(points.first(), directions.first() * -1.0, halfWidths.first());
+		appendCap(points.last(), directions.last(), halfWidths.last());
+	}
+}
+
+}
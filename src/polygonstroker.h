@@ -0,0 +1,92 @@
+#ifndef MLPOLYGONSTROKER_H
+#define MLPOLYGONSTROKER_H
+
+//ExportName: PolygonStroker
+
+#include "fixedpolygon.h"
+
+namespace Malachite
+{
+
+/**
+ * The PolygonStroker generates stroke outlines of polylines.
+ *
+ * The outline is emitted as overlapping pieces (segments, joins and caps) that all have the same orientation,
+ * so it is filled correctly with the non-zero rule and no boolean union is needed.
+ */
+class MALACHITESHARED_EXPORT PolygonStroker
+{
+public:
+	
+	enum JoinStyle
+	{
+		JoinMiter,
+		JoinBevel,
+		JoinRound
+	};
+	
+	enum CapStyle
+	{
+		CapFlat,
+		CapSquare,
+		CapRound
+	};
+	
+	PolygonStroker(double width = 1.0) :
+		_width(width),
+		_miterLimit(4.0),
+		_joinStyle(JoinMiter),
+		_capStyle(CapFlat)
+	{}
+	
+	double width() const { return _width; }
+	void setWidth(double width) { _width = width; }
+	
+	/**
+	 * The miter limit is the maximum ratio of the miter length to the half width.
+	 * Miter joins exceeding it are beveled.
+	 */
+	double miterLimit() const { return _miterLimit; }
+	void setMiterLimit(double limit) { _miterLimit = limit; }
+	
+	/**
+	 * Miter and bevel joins of 180 degree turns are squared off like square caps.
+	 */
+	JoinStyle joinStyle() const { return _joinStyle; }
+	void setJoinStyle(JoinStyle style) { _joinStyle = style; }
+	
+	CapStyle capStyle() const { return _capStyle; }
+	void setCapStyle(CapStyle style) { _capStyle = style; }
+	
+	/**
+	 * Strokes a polyline with the uniform width.
+	 * @param polyline
+	 * @param closed Whether the last point is connected to the first one
+	 * @return The stroke outline in fixed point
+	 */
+	FixedMultiPolygon stroke(const Polygon &polyline, bool closed = false) const;
+	
+	/**
+	 * Strokes a polyline with the width varying along the path.
+	 * @param polyline
+	 * @param widths The width at each point of the polyline
+	 * @param closed Whether the last point is connected to the first one
+	 * @return The stroke outline in fixed point
+	 */
+	FixedMultiPolygon stroke(const Polygon &polyline, const QVector<double> &widths, bool closed = false) const;
+	
+	FixedMultiPolygon stroke(const MultiPolygon &polylines, bool closed = false) const;
+	FixedMultiPolygon stroke(const FixedPolygon &polyline, bool closed = false) const;
+	
+private:
+	
+	void strokeTo(FixedMultiPolygon &result, const Polygon &polyline, const double *widths, bool closed) const;
+	
+	double _width, _miterLimit;
+	JoinStyle _joinStyle;
+	CapStyle _capStyle;
+};
+
+}
+
+#endif // MLPOLYGONSTROKER_H
@@ -0,0 +1,119 @@
+#include <cmath>
+#include "dabmaskcache.h"
+#include "spanrun.h"
+
+namespace Malachite
+{
+
+QSharedPointer<const DabMask> DabMaskCache::mask(const Vec2D &center, double diameter, double hardness, QPoint *origin)
+{
+	Vec2D scaled = center * double(SubpixelSteps);
+	int64_t sx = std::llround(scaled.x());
+	int64_t sy = std::llround(scaled.y());
+	
+	// floor division keeps the offset in [0, SubpixelSteps)
+	int64_t ix = sx >= 0 ? sx / SubpixelSteps : (sx - SubpixelSteps + 1) / SubpixelSteps;
+	int64_t iy = sy >= 0 ? sy / SubpixelSteps : (sy - SubpixelSteps + 1) / SubpixelSteps;
+	
+	Key key;
+	key.diameter = std::lround(diameter * DiameterSteps);
+	key.hardness = std::lround(qBound(0.0, hardness, 1.0) * HardnessSteps);
+	key.offsetX = sx - ix * SubpixelSteps;
+	key.offsetY = sy - iy * SubpixelSteps;
+	
+	*origin = QPoint(ix, iy);
+	
+	QMutexLocker locker(&_mutex);
+	
+	QSharedPointer<const DabMask> *cached = _cache.object(key);
+	if (cached)
+		return *cached;
+	
+	QSharedPointer<const DabMask> mask(createMask(key));
+	_cache.insert(key, new QSharedPointer<const DabMask>(mask), mask->coverage.size() * sizeof(float));
+	return mask;
+}
+
+DabMask *DabMaskCache::createMask(const Key &key)
+{
+	double radius = 0.5 * key.diameter / DiameterSteps;
+	double hardness = double(key.hardness) / HardnessSteps;
+	Vec2D center(double(key.offsetX) / SubpixelSteps, double(key.offsetY) / SubpixelSteps);
+	
+	int extent = std::ceil(radius) + 1;
+	
+	DabMask *mask = new DabMask;
+	mask->offset = QPoint(-extent, -extent);
+	mask->size = QSize(2 * extent + 1, 2 * extent + 1);
+	mask->coverage.resize(mask->size.width() * mask->size.height());
+	
+	double innerRadius = radius * hardness;
+	double falloff = radius - innerRadius;
+	
+	// dabs smaller than a pixel fade out instead of staying at full coverage
+	double scale = qMin(1.0, 2.0 * radius);
+	
+	float *coverage = mask->coverage.data();
+	
+	for (int y = 0; y < mask->size.height(); ++y)
+	{
+		for (int x = 0; x < mask->size.width(); ++x)
+		{
+			Vec2D d = Vec2D(mask->offset.x() + x + 0.5, mask->offset.y() + y + 0.5) - center;
+			double distance = d.length();
+			
+			// one pixel wide antialiasing on the edge
+			double value = qBound(0.0, radius + 0.5 - distance, 1.0);
+			
+			if (falloff > 0)
+				value = qMin(value, qBound(0.0, (radius - distance) / falloff, 1.0));
+			
+			*coverage++ = value * scale;
+		}
+	}
+	
+	return mask;
+}
+
+static DabMaskCache _dabMaskCache;
+
+DabMaskCache *dabMaskCache()
+{
+	return &_dabMaskCache;
+}
+
+void stampDab(Bitmap<Pixel> &bitmap, const QPoint &origin, const DabMask &mask, const Pixel &color, BlendOp *op, const ClipMask *clip)
+{
+	QRect maskRect(origin + mask.offset, mask.size);
+	QRect rect = maskRect & bitmap.rect();
+	
+	if (rect.isEmpty())
+		return;
+	
+	auto clipCoverage = clip ? clip->rectCoverage(rect) : ClipMask::CoverageFull;
+	
+	if (clipCoverage == ClipMask::CoverageNone)
+		return;
+	
+	int maskWidth = mask.size.width();
+	
+	Array<float> clippedCoverage(clipCoverage == ClipMask::CoveragePartial ? rect.width() : 0);
+	
+	for (int y = rect.top(); y <= rect.bottom(); ++y)
+	{
+		const float *coverage = mask.coverage.constData() + (y - maskRect.top()) * maskWidth + (rect.left() - maskRect.left());
+		
+		if (clipCoverage == ClipMask::CoveragePartial)
+		{
+			clippedCoverage.data().pasteArray(wrapPointer(coverage, rect.width()), rect.width());
+			clip->multiplyCovers(QPoint(rect.left(), y), rect.width(), clippedCoverage.data());
+			blendClippedColorSpan(rect.width(), bitmap.pixelPointer(rect.left(), y), color, clippedCoverage.data(), op);
+		}
+		else
+		{
+			blendColorSpan(rect.width(), bitmap.pixelPointer(rect.left(), y), color, wrapPointer(coverage, rect.width()), op);
+		}
+	}
+}
+
+}
@@ -0,0 +1,95 @@
+#ifndef MLDABMASKCACHE_H
+#define MLDABMASKCACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QSharedPointer>
+#include "../bitmap.h"
+#include "../blendop.h"
+#include "../clipmask.h"
+#include "../vec2d.h"
+
+namespace Malachite
+{
+
+/**
+ * A pre-rasterized coverage mask of a round dab.
+ */
+struct DabMask
+{
+	QPoint offset;	// the top-left of the mask relative to the integer part of the dab center
+	QSize size;
+	QVector<float> coverage;
+};
+
+/**
+ * The DabMaskCache keeps recently used dab masks, up to a total size in bytes
+ * (the masks of large dabs are much bigger than those of small ones).
+ * Masks are keyed by the diameter, the hardness and the subpixel offset of the center, all quantized.
+ */
+class DabMaskCache
+{
+public:
+	
+	enum
+	{
+		SubpixelSteps = 4,
+		DiameterSteps = 8,
+		HardnessSteps = 64,
+		DefaultMaxBytes = 32 * 1024 * 1024
+	};
+	
+	/**
+	 * @param maxBytes The maximum total size of the cached coverages
+	 */
+	DabMaskCache(int maxBytes = DefaultMaxBytes) : _cache(maxBytes) {}
+	
+	/**
+	 * Returns the mask for a dab and the device position its mask offset is relative to.
+	 * @param center The dab center in device coordinates
+	 * @param diameter
+	 * @param hardness The ratio of the fully opaque radius to the radius (0 ... 1)
+	 * @param origin The integer position the mask offset is relative to
+	 * @return The mask
+	 */
+	QSharedPointer<const DabMask> mask(const Vec2D &center, double diameter, double hardness, QPoint *origin);
+	
+private:
+	
+	struct Key
+	{
+		int diameter, hardness, offsetX, offsetY;
+		
+		bool operator==(const Key &other) const
+		{
+			return diameter == other.diameter && hardness == other.hardness && offsetX == other.offsetX && offsetY == other.offsetY;
+		}
+	};
+	
+	friend uint qHash(const Key &key)
+	{
+		return qHash(key.diameter) ^ qHash(key.hardness << 8) ^ qHash((key.offsetX << 4) | key.offsetY);
+	}
+	
+	static DabMask *createMask(const Key &key);
+	
+	QMutex _mutex;
+	QCache<Key, QSharedPointer<const DabMask> > _cache;
+};
+
+DabMaskCache *dabMaskCache();
+
+/**
+ * Blends a solid color through a dab mask.
+ * @param bitmap The destination
+ * @param origin The position of the mask's top-left in the destination
+ * @param mask
+ * @param color The premultiplied color, multiplied by the opacity
+ * @param op
+ * @param clip The clip mask in the coordinates of the bitmap, or null
+ */
+void stampDab(Bitmap<Pixel> &bitmap, const QPoint &origin, const DabMask &mask, const Pixel &color, BlendOp *op, const ClipMask *clip = 0);
+
+}
+
+#endif // MLDABMASKCACHE_H
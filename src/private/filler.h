@@ -5,6 +5,7 @@
 #include "../blendop.h"
 #include "../division.h"
 #include "../interval.h"
+#include "spanrun.h"
 
 namespace Malachite
 {
@@ -19,25 +20,66 @@ public:
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, Pointer<float> covers, BlendOp *blendOp)
 	{
 		Q_UNUSED(pos);
-		blendOp->blend(count, dst, _argb, covers);
+		blendColorSpan(count, dst, _argb, covers, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, float cover, BlendOp *blendOp)
 	{
 		Q_UNUSED(pos);
-		blendOp->blend(count, dst, _argb * cover);
+		blendColorSpan(count, dst, _argb * cover, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, BlendOp *blendOp)
 	{
 		Q_UNUSED(pos);
-		blendOp->blend(count, dst, _argb);
+		blendColorSpan(count, dst, _argb, blendOp);
 	}
 	
 private:
 	Pixel _argb;
 };
 
+/**
+ * Fills each row with one color picked from a line of pixels by the y coordinate.
+ */
+class ColumnFiller
+{
+public:
+	ColumnFiller(const Bitmap<Pixel> &line, int origin, bool repeat) :
+		_line(line),
+		_origin(origin),
+		_repeat(repeat)
+	{}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, Pointer<float> covers, BlendOp *blendOp)
+	{
+		blendColorSpan(count, dst, color(pos.y()), covers, blendOp);
+	}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, float cover, BlendOp *blendOp)
+	{
+		blendColorSpan(count, dst, color(pos.y()) * cover, blendOp);
+	}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, BlendOp *blendOp)
+	{
+		blendColorSpan(count, dst, color(pos.y()), blendOp);
+	}
+	
+private:
+	
+	Pixel color(int y) const
+	{
+		int i = y - _origin;
+		i = _repeat ? IntDivision(i, _line.width()).rem() : qBound(0, i, _line.width() - 1);
+		return _line.pixel(i, 0);
+	}
+	
+	const Bitmap<Pixel> _line;
+	int _origin;
+	bool _repeat;
+};
+
 template <Malachite::SpreadType T_SpreadType>
 class ImageFiller;
 
@@ -69,12 +111,13 @@ public:
 		
 		if (intervalLeft.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalLeft.length(),
 				dst,
 				_srcBitmap.pixel(0, srcY),
-				covers
+				covers,
+				blendOp
 			);
 			
 			i += intervalLeft.length();
@@ -82,12 +125,13 @@ public:
 		
 		if (interval.isValid())
 		{
-			blendOp->blend
+			blendSourceSpan
 			(
 				interval.length(),
 				dst + i,
 				_srcBitmap.constPixelPointer(srcX + i, srcY),
-				covers + i
+				covers + i,
+				blendOp
 			);
 			
 			i += interval.length();
@@ -95,12 +139,13 @@ public:
 		
 		if (intervalRight.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalRight.length(),
 				dst + i,
 				_srcBitmap.pixel(_srcBitmap.width() - 1, srcY),
-				covers + i
+				covers + i,
+				blendOp
 			);
 		}
 	}
@@ -125,11 +170,12 @@ public:
 		
 		if (intervalLeft.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalLeft.length(),
 				dst,
-				_srcBitmap.pixel(0, srcY) * cover
+				_srcBitmap.pixel(0, srcY) * cover,
+				blendOp
 			);
 			
 			i += intervalLeft.length();
@@ -137,12 +183,13 @@ public:
 		
 		if (interval.isValid())
 		{
-			blendOp->blend
+			blendSourceSpan
 			(
 				interval.length(),
 				dst + i,
 				_srcBitmap.constPixelPointer(srcX + i, srcY),
-				cover
+				cover,
+				blendOp
 			);
 			
 			i += interval.length();
@@ -150,11 +197,12 @@ public:
 		
 		if (intervalRight.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalRight.length(),
 				dst + i,
-				_srcBitmap.pixel(_srcBitmap.width() - 1, srcY) * cover
+				_srcBitmap.pixel(_srcBitmap.width() - 1, srcY) * cover,
+				blendOp
 			);
 		}
 	}
@@ -179,11 +227,12 @@ public:
 		
 		if (intervalLeft.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalLeft.length(),
 				dst,
-				_srcBitmap.pixel(0, srcY)
+				_srcBitmap.pixel(0, srcY),
+				blendOp
 			);
 			
 			i += intervalLeft.length();
@@ -191,11 +240,12 @@ public:
 		
 		if (interval.isValid())
 		{
-			blendOp->blend
+			blendSourceSpan
 			(
 				interval.length(),
 				dst + i,
-				_srcBitmap.constPixelPointer(srcX + i, srcY)
+				_srcBitmap.constPixelPointer(srcX + i, srcY),
+				blendOp
 			);
 			
 			i += interval.length();
@@ -203,11 +253,12 @@ public:
 		
 		if (intervalRight.isValid())
 		{
-			blendOp->blend
+			blendColorSpan
 			(
 				intervalRight.length(),
 				dst + i,
-				_srcBitmap.pixel(_srcBitmap.width() - 1, srcY)
+				_srcBitmap.pixel(_srcBitmap.width() - 1, srcY),
+				blendOp
 			);
 		}
 	}
@@ -239,22 +290,22 @@ public:
 		
 		if (i >= count)
 		{
-			blendOp->blend(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), covers);
+			blendSourceSpan(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), covers, blendOp);
 			return;
 		}
 		
-		blendOp->blend(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), covers);
+		blendSourceSpan(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), covers, blendOp);
 		
 		forever
 		{
 			if (count - i < _srcBitmap.width()) break;
 			
-			blendOp->blend(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY), covers + i);
+			blendSourceSpan(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY), covers + i, blendOp);
 			
 			i += _srcBitmap.width();
 		}
 		
-		blendOp->blend(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY), covers + i);
+		blendSourceSpan(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY), covers + i, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, float cover, BlendOp *blendOp)
@@ -269,22 +320,22 @@ public:
 		
 		if (i >= count)
 		{
-			blendOp->blend(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), cover);
+			blendSourceSpan(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), cover, blendOp);
 			return;
 		}
 		
-		blendOp->blend(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), cover);
+		blendSourceSpan(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), cover, blendOp);
 		
 		forever
 		{
 			if (count - i < _srcBitmap.width()) break;
 			
-			blendOp->blend(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY), cover);
+			blendSourceSpan(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY), cover, blendOp);
 			
 			i += _srcBitmap.width();
 		}
 		
-		blendOp->blend(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY), cover);
+		blendSourceSpan(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY), cover, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, BlendOp *blendOp)
@@ -299,22 +350,22 @@ public:
 		
 		if (i >= count)
 		{
-			blendOp->blend(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY));
+			blendSourceSpan(count, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), blendOp);
 			return;
 		}
 		
-		blendOp->blend(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY));
+		blendSourceSpan(i, dst, _srcBitmap.constPixelPointer(divX.rem(), imageY), blendOp);
 		
 		forever
 		{
 			if (count - i < _srcBitmap.width()) break;
 			
-			blendOp->blend(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY));
+			blendSourceSpan(_srcBitmap.width(), dst + i, _srcBitmap.constPixelPointer(0, imageY), blendOp);
 			
 			i += _srcBitmap.width();
 		}
 		
-		blendOp->blend(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY));
+		blendSourceSpan(count - i, dst + i, _srcBitmap.constPixelPointer(0, imageY), blendOp);
 	}
 	
 private:
@@ -503,7 +554,7 @@ public:
 			centerPos += Vec2D(1, 0);
 		}
 		
-		blendOp->blend(count, dst, fill.data(), covers);
+		blendSourceSpan(count, dst, fill.data(), covers, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, float cover, BlendOp *blendOp)
@@ -519,7 +570,7 @@ public:
 			centerPos += Vec2D(1, 0);
 		}
 		
-		blendOp->blend(count, dst, fill.data(), cover);
+		blendSourceSpan(count, dst, fill.data(), cover, blendOp);
 	}
 	
 	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, BlendOp *blendOp)
@@ -535,7 +586,7 @@ public:
 			centerPos += Vec2D(1, 0);
 		}
 		
-		blendOp->blend(count, dst, fill.data());
+		blendSourceSpan(count, dst, fill.data(), blendOp);
 	}
 	
 private:
@@ -543,6 +594,50 @@ private:
 	QTransform _transform;
 };
 
+/**
+ * Fills with a generator which produces whole spans at once.
+ * The generator has generate(const QPoint &pos, int count, Pointer<Pixel> dst).
+ * The spans are generated into a buffer which is reused by the following spans.
+ */
+template <class T_Generator>
+class SpanFiller
+{
+public:
+	SpanFiller(const T_Generator *generator) :
+		_generator(generator)
+	{}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, Pointer<float> covers, BlendOp *blendOp)
+	{
+		blendSourceSpan(count, dst, generate(pos, count), covers, blendOp);
+	}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, float cover, BlendOp *blendOp)
+	{
+		blendSourceSpan(count, dst, generate(pos, count), cover, blendOp);
+	}
+	
+	void fill(const QPoint &pos, int count, Pointer<Pixel> dst, BlendOp *blendOp)
+	{
+		blendSourceSpan(count, dst, generate(pos, count), blendOp);
+	}
+	
+private:
+	
+	Pointer<Pixel> generate(const QPoint &pos, int count)
+	{
+		if (_buffer.size() < count)
+			_buffer.resize(count);
+		
+		Pointer<Pixel> span = wrapPointer(_buffer.data(), count);
+		_generator->generate(pos, count, span);
+		return span;
+	}
+	
+	const T_Generator *_generator;
+	QVector<Pixel> _buffer;
+};
+
 }
 
 #endif // MLFILLER_H
@@ -1,48 +1,53 @@
 #ifndef MLGRADIENTGENERATOR_H
 #define MLGRADIENTGENERATOR_H
 
+#include <emmintrin.h>
 #include "../vec2d.h"
 #include "../pixel.h"
+#include "../memory.h"
+#include "../colorgradient.h"
+#include "../image.h"
+#include <QSharedPointer>
 
 namespace Malachite
 {
 
+inline float spreadGradientPosition(Malachite::SpreadType spreadType, float x)
+{
+	switch (spreadType)
+	{
+	default:
+	case Malachite::SpreadTypePad:
+		return qBound(0.f, x, 1.f);
+	case Malachite::SpreadTypeRepeat:
+		return x - floorf(x);
+	case Malachite::SpreadTypeReflective:
+	{
+		float f = floorf(x);
+		float r = x - f;
+		return (int)f % 2 ? 1.f - r : r;
+	}
+	}
+}
+
 template <class T_Gradient, class T_Method, Malachite::SpreadType T_SpreadType>
 class GradientGenerator
 {
 public:
-	GradientGenerator(const T_Gradient *gradient, T_Method *method) :
+	GradientGenerator(const T_Gradient *gradient, const T_Method *method) :
 		_gradient(gradient),
 		_method(method)
 	{}
 	
 	Pixel at(const Vec2D &p)
 	{
-		return _gradient->at(actualPosition(_method->position(p)));
+		return _gradient->at(spreadGradientPosition(T_SpreadType, _method->position(p)));
 	}
 	
 private:
 	
-	float actualPosition(float x) const
-	{
-		switch (T_SpreadType)
-		{
-		default:
-		case Malachite::SpreadTypePad:
-			return qBound(0.f, x, 1.f);
-		case Malachite::SpreadTypeRepeat:
-			return x - floorf(x);
-		case Malachite::SpreadTypeReflective:
-		{
-			float f = floorf(x);
-			float r = x - f;
-			return (int)f % 2 ? 1.f - r : r;
-		}
-		}
-	}
-	
 	const T_Gradient *_gradient;
-	T_Method *_method;
+	const T_Method *_method;
 };
 
 class LinearGradientMethod
@@ -53,13 +58,26 @@ public:
 		a(start),
 		ab(end - start)
 	{
-		Q_ASSERT(start != end);
+		Q_ASSERT(!(start == end));
 		ab2inv = 1.0 / ab.lengthSquare();
 	}
 	
 	float position(const Vec2D &p) const
 	{
-		return Vec2D::dot(p - 1, ab) * ab2inv;
+		return Vec2D::dot(p - a, ab) * ab2inv;
+	}
+	
+	/**
+	 * Computes the positions of 4 points at once.
+	 * The coordinates are relative to origin, which keeps them small enough for single precision.
+	 */
+	__m128 positions(const Vec2D &origin, __m128 x, __m128 y) const
+	{
+		Vec2D k = ab * ab2inv;
+		__m128 t = _mm_set1_ps(Vec2D::dot(origin - a, k));
+		t = _mm_add_ps(t, _mm_mul_ps(x, _mm_set1_ps(k.x())));
+		t = _mm_add_ps(t, _mm_mul_ps(y, _mm_set1_ps(k.y())));
+		return t;
 	}
 	
 private:
@@ -108,6 +126,14 @@ public:
 		return (d * rinv).length();
 	}
 	
+	__m128 positions(const Vec2D &origin, __m128 x, __m128 y) const
+	{
+		Vec2D oc = (origin - c) * rinv;
+		__m128 dx = _mm_add_ps(_mm_set1_ps(oc.x()), _mm_mul_ps(x, _mm_set1_ps(rinv.x())));
+		__m128 dy = _mm_add_ps(_mm_set1_ps(oc.y()), _mm_mul_ps(y, _mm_set1_ps(rinv.y())));
+		return _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+	}
+	
 private:
 	Vec2D c, rinv;
 };
@@ -167,11 +193,217 @@ public:
 		return fp2 / (sqrt(dot * dot - fp2 * c) - dot); 
 	}
 	
+	__m128 positions(const Vec2D &origin, __m128 x, __m128 y) const
+	{
+		Vec2D ofp = (origin - o) * rinv - of;
+		__m128 fpx = _mm_add_ps(_mm_set1_ps(ofp.x()), _mm_mul_ps(x, _mm_set1_ps(rinv.x())));
+		__m128 fpy = _mm_add_ps(_mm_set1_ps(ofp.y()), _mm_mul_ps(y, _mm_set1_ps(rinv.y())));
+		
+		__m128 dot = _mm_add_ps(_mm_mul_ps(fpx, _mm_set1_ps(of.x())), _mm_mul_ps(fpy, _mm_set1_ps(of.y())));
+		__m128 fp2 = _mm_add_ps(_mm_mul_ps(fpx, fpx), _mm_mul_ps(fpy, fpy));
+		
+		__m128 denom = _mm_sub_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_mul_ps(dot, dot), _mm_mul_ps(fp2, _mm_set1_ps(c)))), dot);
+		
+		// the denominator is 0 only at the focal point, where the position is 0
+		return _mm_and_ps(_mm_div_ps(fp2, denom), _mm_cmpgt_ps(fp2, _mm_setzero_ps()));
+	}
+	
 private:
 	Vec2D o, of, rinv;
 	double c;
 };
 
+/**
+ * Generates gradient spans 4 pixels at a time from a lookup table.
+ * The transform must be affine.
+ */
+template <class T_Method, Malachite::SpreadType T_SpreadType>
+class GradientSpanGenerator
+{
+public:
+	
+	GradientSpanGenerator(const ColorGradientCache *cache, const T_Method *method, const QTransform &worldTransform = QTransform()) :
+		_cache(cache),
+		_method(method),
+		_transform(worldTransform),
+		_step(worldTransform.m11(), worldTransform.m12())
+	{
+		Q_ASSERT(worldTransform.isAffine());
+	}
+	
+	void generate(const QPoint &pos, int count, Pointer<Pixel> dst) const
+	{
+		const Pixel *samples = _cache->samples();
+		const __m128 sampleCount = _mm_set1_ps(_cache->sampleCount());
+		
+		const Vec2D origin = Vec2D(pos.x() + 0.5, pos.y() + 0.5) * _transform;
+		
+		const __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+		const __m128 stepX = _mm_set1_ps(_step.x());
+		const __m128 stepY = _mm_set1_ps(_step.y());
+		
+		for (int i = 0; i < count; i += 4)
+		{
+			__m128 n = _mm_add_ps(_mm_set1_ps(i), lanes);
+			__m128 t = _method->positions(origin, _mm_mul_ps(n, stepX), _mm_mul_ps(n, stepY));
+			
+			t = _mm_min_ps(_mm_max_ps(spread(t), _mm_setzero_ps()), _mm_set1_ps(1));
+			
+			union
+			{
+				__m128i v;
+				int32_t a[4];
+			} indexes;
+			
+			indexes.v = _mm_cvtps_epi32(_mm_mul_ps(t, sampleCount));
+			
+			int n4 = qMin(4, count - i);
+			for (int j = 0; j < n4; ++j)
+				dst[i + j] = samples[indexes.a[j]];
+		}
+	}
+	
+private:
+	
+	static __m128 floorVector(__m128 x)
+	{
+		__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1)));
+	}
+	
+	static __m128 spread(__m128 t)
+	{
+		switch (T_SpreadType)
+		{
+		default:
+		case Malachite::SpreadTypePad:
+			return t;
+		case Malachite::SpreadTypeRepeat:
+		{
+			// keep the value in the range of int32 for the conversion in floorVector()
+			t = _mm_min_ps(_mm_max_ps(t, _mm_set1_ps(-0x400000)), _mm_set1_ps(0x400000));
+			return _mm_sub_ps(t, floorVector(t));
+		}
+		case Malachite::SpreadTypeReflective:
+		{
+			// 1 - |1 - (t mod 2)|
+			t = _mm_min_ps(_mm_max_ps(t, _mm_set1_ps(-0x400000)), _mm_set1_ps(0x400000));
+			__m128 half = _mm_mul_ps(t, _mm_set1_ps(0.5f));
+			__m128 r = _mm_mul_ps(_mm_sub_ps(half, floorVector(half)), _mm_set1_ps(2));
+			__m128 d = _mm_sub_ps(_mm_set1_ps(1), r);
+			__m128 absD = _mm_andnot_ps(_mm_set1_ps(-0.f), d);
+			return _mm_sub_ps(_mm_set1_ps(1), absD);
+		}
+		}
+	}
+	
+	const ColorGradientCache *_cache;
+	const T_Method *_method;
+	QTransform _transform;
+	Vec2D _step;
+};
+
+/**
+ * A line of colors along an axis-aligned linear gradient.
+ * Every row (or column) of such a gradient is the same, so the line is generated once and copied.
+ * It does not change under integer translations and is shared by the tiles of a surface.
+ */
+class GradientLine
+{
+public:
+	
+	enum
+	{
+		MinimumLength = 64,
+		MaximumLength = 0x10000
+	};
+	
+	/**
+	 * @param gradient
+	 * @param spreadType
+	 * @param start The start coordinate of the gradient along the axis
+	 * @param end The end coordinate of the gradient along the axis
+	 * @return The line, or null if it is too long or the period does not fit the pixel grid
+	 */
+	static QSharedPointer<const GradientLine> create(const ColorGradient *gradient, Malachite::SpreadType spreadType, double start, double end)
+	{
+		double delta = end - start;
+		if (!gradient || delta == 0)
+			return QSharedPointer<const GradientLine>();
+		
+		double phase = start - std::floor(start);
+		
+		int offset, length;
+		
+		if (spreadType == Malachite::SpreadTypePad)
+		{
+			// one more pixel on each side, which the pad filler extends
+			offset = std::floor(qMin(0.0, delta) + phase) - 1;
+			int last = std::ceil(qMax(0.0, delta) + phase) + 1;
+			
+			if (last - offset > MaximumLength)
+				return QSharedPointer<const GradientLine>();
+			
+			length = last - offset;
+		}
+		else
+		{
+			double period = std::fabs(delta);
+			if (spreadType == Malachite::SpreadTypeReflective)
+				period *= 2;
+			
+			if (period > MaximumLength || std::fabs(period - std::round(period)) > 1e-9)
+				return QSharedPointer<const GradientLine>();
+			
+			int intPeriod = std::round(period);
+			offset = 0;
+			
+			// repeat the period up to the minimum length so that the filler copies long runs
+			length = intPeriod * ((MinimumLength + intPeriod - 1) / intPeriod);
+		}
+		
+		auto line = new GradientLine;
+		line->_spreadType = spreadType;
+		line->_phase = phase;
+		line->_delta = delta;
+		line->_offset = offset;
+		line->_image = Image(length, 1);
+		
+		Pointer<Pixel> p = line->_image.pixelPointer(0, 0);
+		
+		for (int i = 0; i < length; ++i)
+		{
+			double t = (offset + i + 0.5 - phase) / delta;
+			p[i] = gradient->at(spreadGradientPosition(spreadType, t));
+		}
+		
+		return QSharedPointer<const GradientLine>(line);
+	}
+	
+	bool matches(Malachite::SpreadType spreadType, double start, double end) const
+	{
+		return spreadType == _spreadType && std::fabs((end - start) - _delta) < 1e-9 && std::fabs((start - std::floor(start)) - _phase) < 1e-9;
+	}
+	
+	/**
+	 * @return The device coordinate of the first pixel of the line
+	 */
+	int origin(double start) const { return int(std::floor(start)) + _offset; }
+	
+	bool isPeriodic() const { return _spreadType != Malachite::SpreadTypePad; }
+	
+	const Image &image() const { return _image; }
+	
+private:
+	
+	GradientLine() {}
+	
+	Malachite::SpreadType _spreadType;
+	double _phase, _delta;
+	int _offset;
+	Image _image;
+};
+
 }
 
 #endif // GRADIENTGENERATOR_H
@@ -2,23 +2,24 @@
 #include "filler.h"
 #include "gradientgenerator.h"
 #include "scalinggenerator.h"
+#include "dabmaskcache.h"
 #include "../painter.h"
 
 namespace Malachite
 {
 
 template <class Rasterizer, class Filler>
-void fill(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blendOp, Filler *filler, float opacity)
+void fill(Rasterizer *ras, Bitmap<Pixel> *bitmap, const ClipMask *clip, BlendOp *blendOp, Filler *filler, float opacity)
 {
 	agg::scanline_pf sl;
-	ImageBaseRenderer<Filler> baseRen(*bitmap, blendOp, opacity, filler);
+	ImageBaseRenderer<Filler> baseRen(*bitmap, blendOp, opacity, filler, clip);
 	Renderer<ImageBaseRenderer<Filler> > ren(baseRen);
 	
 	renderScanlines(*ras, sl, ren);
 }
 
 template <class Rasterizer, Malachite::SpreadType SpreadType, class Source>
-void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blendOp, const Source &source, float opacity, const QTransform &worldTransform, Malachite::ImageTransformType transformType)
+void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, const ClipMask *clip, BlendOp *blendOp, const Source &source, float opacity, const QTransform &worldTransform, Malachite::ImageTransformType transformType)
 {
 	switch (transformType)
 	{
@@ -27,7 +28,7 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 		typedef ScalingGeneratorNearestNeighbor<Source, SpreadType> Generator;
 		Generator gen(&source);
 		Filler<Generator, true> filler(&gen, worldTransform);
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	case Malachite::ImageTransformTypeBilinear:
@@ -35,7 +36,7 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 		typedef ScalingGeneratorBilinear<Source, SpreadType> Generator;
 		Generator gen(&source);
 		Filler<Generator, true> filler(&gen, worldTransform);
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	case Malachite::ImageTransformTypeBicubic:
@@ -43,7 +44,7 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 		typedef ScalingGenerator2<Source, SpreadType, ScalingWeightMethodBicubic> Generator;
 		Generator gen(&source);
 		Filler<Generator, true> filler(&gen, worldTransform);
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	case Malachite::ImageTransformTypeLanczos2:
@@ -51,7 +52,7 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 		typedef ScalingGenerator2<Source, SpreadType, ScalingWeightMethodLanczos2> Generator;
 		Generator gen(&source);
 		Filler<Generator, true> filler(&gen, worldTransform);
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	case Malachite::ImageTransformTypeLanczos2Hypot:
@@ -59,7 +60,7 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 		typedef ScalingGenerator2<Source, SpreadType, ScalingWeightMethodLanczos2Hypot> Generator;
 		Generator gen(&source);
 		Filler<Generator, true> filler(&gen, worldTransform);
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	default:
@@ -67,8 +68,60 @@ void drawTransformedImageBrush(Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *
 	}
 }
 
+// the number of lookup table intervals for a gradient which spans length pixels on the device
+inline int gradientSampleCount(double length)
+{
+	return qBound(2, int(std::ceil(length)), 4096);
+}
+
+inline double transformScale(const QTransform &transform)
+{
+	return std::sqrt(std::fabs(transform.determinant()));
+}
+
+template <class T_Rasterizer, Malachite::SpreadType T_SpreadType, class T_Method>
+void drawGradient(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, const ClipMask *clip, BlendOp *blendOp, const ColorGradientCache *cache, const T_Method &method, float opacity, const QTransform &fillShapeTransform)
+{
+	if (fillShapeTransform.isAffine())
+	{
+		typedef GradientSpanGenerator<T_Method, T_SpreadType> Generator;
+		Generator gen(cache, &method, fillShapeTransform.inverted());
+		SpanFiller<Generator> filler(&gen);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
+	}
+	else
+	{
+		typedef GradientGenerator<ColorGradientCache, T_Method, T_SpreadType> Generator;
+		Generator gen(cache, &method);
+		Filler<Generator, true> filler(&gen, fillShapeTransform.inverted());
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
+	}
+}
+
+template <class T_Rasterizer>
+void drawGradientLine(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, const ClipMask *clip, BlendOp *blendOp, const GradientLine &line, double start, bool horizontal, float opacity)
+{
+	int origin = line.origin(start);
+	
+	if (!horizontal)
+	{
+		ColumnFiller filler(line.image().constBitmap(), origin, line.isPeriodic());
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
+	}
+	else if (line.isPeriodic())
+	{
+		ImageFiller<Malachite::SpreadTypeRepeat> filler(line.image().constBitmap(), QPoint(origin, 0));
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
+	}
+	else
+	{
+		ImageFiller<Malachite::SpreadTypePad> filler(line.image().constBitmap(), QPoint(origin, 0));
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
+	}
+}
+
 template <class T_Rasterizer, Malachite::SpreadType T_SpreadType>
-void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blendOp, const PaintEngineState &state)
+void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, const ClipMask *clip, BlendOp *blendOp, const PaintEngineState &state)
 {
 	const Brush brush = state.brush;
 	const float opacity = state.opacity;
@@ -76,7 +129,7 @@ void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blend
 	if (brush.type() == Malachite::BrushTypeColor)
 	{
 		ColorFiller filler(brush.pixel());
-		fill(ras, bitmap, blendOp, &filler, opacity);
+		fill(ras, bitmap, clip, blendOp, &filler, opacity);
 		return;
 	}
 	
@@ -89,18 +142,18 @@ void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blend
 			QPoint offset(fillShapeTransform.dx(), fillShapeTransform.dy());
 			
 			ImageFiller<T_SpreadType> filler(brush.image().constBitmap(), offset);
-			fill(ras, bitmap, blendOp, &filler, opacity);
+			fill(ras, bitmap, clip, blendOp, &filler, opacity);
 			return;
 		}
 		else
 		{
-			drawTransformedImageBrush<T_Rasterizer, T_SpreadType, Bitmap<Pixel> >(ras, bitmap, blendOp, brush.image().constBitmap(), opacity, fillShapeTransform.inverted(), state.imageTransformType);
+			drawTransformedImageBrush<T_Rasterizer, T_SpreadType, Bitmap<Pixel> >(ras, bitmap, clip, blendOp, brush.image().constBitmap(), opacity, fillShapeTransform.inverted(), state.imageTransformType);
 			return;
 		}
 	}
 	if (brush.type() == Malachite::BrushTypeSurface)
 	{
-		drawTransformedImageBrush<T_Rasterizer, T_SpreadType, Surface>(ras, bitmap, blendOp, brush.surface(), opacity, fillShapeTransform.inverted(), state.imageTransformType);
+		drawTransformedImageBrush<T_Rasterizer, T_SpreadType, Surface>(ras, bitmap, clip, blendOp, brush.surface(), opacity, fillShapeTransform.inverted(), state.imageTransformType);
 		return;
 	}
 	if (brush.type() == Malachite::BrushTypeLinearGradient)
@@ -113,22 +166,30 @@ void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blend
 			fillShapeTransform = QTransform();
 		}
 		
-		if (fillShapeTransform.isIdentity())
+		if (fillShapeTransform.isIdentity() && (info.start.x() == info.end.x()) != (info.start.y() == info.end.y()))
 		{
-			LinearGradientMethod method(info.start, info.end);
-			GradientGenerator<ColorGradient, LinearGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-			Filler<GradientGenerator<ColorGradient, LinearGradientMethod, T_SpreadType>, false> filler(&gen);
-			fill(ras, bitmap, blendOp, &filler, opacity);
-			return;
+			bool horizontal = info.start.y() == info.end.y();
+			double start = horizontal ? info.start.x() : info.start.y();
+			double end = horizontal ? info.end.x() : info.end.y();
+			
+			auto line = brush.gradientLine(T_SpreadType, start, end);
+			
+			if (line)
+			{
+				drawGradientLine(ras, bitmap, clip, blendOp, *line, start, horizontal, opacity);
+				return;
+			}
 		}
-		else
-		{
-			LinearGradientMethod method(info.start, info.end);
-			GradientGenerator<ColorGradient, LinearGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-			Filler<GradientGenerator<ColorGradient, LinearGradientMethod, T_SpreadType>, true> filler(&gen, fillShapeTransform.inverted());
-			fill(ras, bitmap, blendOp, &filler, opacity);
+		
+		double length = (info.end - info.start).length() * transformScale(fillShapeTransform);
+		
+		auto cache = brush.gradientCache(gradientSampleCount(length));
+		if (!cache)
 			return;
-		}
+		
+		LinearGradientMethod method(info.start, info.end);
+		drawGradient<T_Rasterizer, T_SpreadType>(ras, bitmap, clip, blendOp, cache.data(), method, opacity, fillShapeTransform);
+		return;
 	}
 	if (brush.type() == Malachite::BrushTypeRadialGradient)
 	{
@@ -140,43 +201,23 @@ void drawWithSpreadType(T_Rasterizer *ras, Bitmap<Pixel> *bitmap, BlendOp *blend
 			fillShapeTransform = QTransform();
 		}
 		
+		double length = (qMax(info.radius.x(), info.radius.y()) + (info.focal - info.center).length()) * transformScale(fillShapeTransform);
+		
+		auto cache = brush.gradientCache(gradientSampleCount(length));
+		if (!cache)
+			return;
+		
 		if (info.center == info.focal)
 		{
-			if (fillShapeTransform.isIdentity())
-			{
-				RadialGradientMethod method(info.center, info.radius);
-				GradientGenerator<ColorGradient, RadialGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-				Filler<GradientGenerator<ColorGradient, RadialGradientMethod, T_SpreadType>, false> filler(&gen);
-				fill(ras, bitmap, blendOp, &filler, opacity);
-				return;
-			}
-			else
-			{
-				RadialGradientMethod method(info.center, info.radius);
-				GradientGenerator<ColorGradient, RadialGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-				Filler<GradientGenerator<ColorGradient, RadialGradientMethod, T_SpreadType>, true> filler(&gen, fillShapeTransform.inverted());
-				fill(ras, bitmap, blendOp, &filler, opacity);
-				return;
-			}
+			RadialGradientMethod method(info.center, info.radius);
+			drawGradient<T_Rasterizer, T_SpreadType>(ras, bitmap, clip, blendOp, cache.data(), method, opacity, fillShapeTransform);
+			return;
 		}
 		else
 		{
-			if (fillShapeTransform.isIdentity())
-			{
-				FocalGradientMethod method(info.center, info.radius, info.focal);
-				GradientGenerator<ColorGradient, FocalGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-				Filler<GradientGenerator<ColorGradient, FocalGradientMethod, T_SpreadType>, false> filler(&gen);
-				fill(ras, bitmap, blendOp, &filler, opacity);
-				return;
-			}
-			else
-			{
-				FocalGradientMethod method(info.center, info.radius, info.focal);
-				GradientGenerator<ColorGradient, FocalGradientMethod, T_SpreadType> gen(brush.gradient(), &method);
-				Filler<GradientGenerator<ColorGradient, FocalGradientMethod, T_SpreadType>, true> filler(&gen, fillShapeTransform.inverted());
-				fill(ras, bitmap, blendOp, &filler, opacity);
-				return;
-			}
+			FocalGradientMethod method(info.center, info.radius, info.focal);
+			drawGradient<T_Rasterizer, T_SpreadType>(ras, bitmap, clip, blendOp, cache.data(), method, opacity, fillShapeTransform);
+			return;
 		}
 	}
 }
@@ -207,6 +248,9 @@ bool ImagePaintEngine::flush()
 
 void ImagePaintEngine::drawPreTransformedPolygons(const FixedMultiPolygon &polygons)
 {
+	if (state()->clipMask.rectCoverage(polygons.boundingRect().toAlignedRect()) == ClipMask::CoverageNone)
+		return;
+	
 	agg::rasterizer_scanline_aa<> ras;
 	
 	for (const FixedPolygon &polygon : polygons)
@@ -227,13 +271,13 @@ void ImagePaintEngine::drawPreTransformedPolygons(const FixedMultiPolygon &polyg
 	switch (state()->brush.spreadType())
 	{
 		case Malachite::SpreadTypePad:
-			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypePad>(&ras, &_bitmap, op, *state());
+			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypePad>(&ras, &_bitmap, &state()->clipMask, op, *state());
 			return;
 		case Malachite::SpreadTypeRepeat:
-			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypeRepeat>(&ras, &_bitmap, op, *state());
+			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypeRepeat>(&ras, &_bitmap, &state()->clipMask, op, *state());
 			return;
 		case Malachite::SpreadTypeReflective:
-			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypeReflective>(&ras, &_bitmap, op, *state());
+			drawWithSpreadType<agg::rasterizer_scanline_aa<>, Malachite::SpreadTypeReflective>(&ras, &_bitmap, &state()->clipMask, op, *state());
 			return;
 		default:
 			return;
@@ -250,20 +294,61 @@ void ImagePaintEngine::drawPreTransformedImage(const QPoint &point, const Image
 	if (targetRect.isEmpty())
 		return;
 	
+	const ClipMask &clip = state()->clipMask;
+	auto clipCoverage = clip.rectCoverage(targetRect);
+	
+	if (clipCoverage == ClipMask::CoverageNone)
+		return;
+	
 	BlendOp *op = BlendMode(state()->blendMode).op();
 	if (!op)
 		return;
 	
+	if (clipCoverage == ClipMask::CoveragePartial)
+	{
+		Array<float> covers(targetRect.width());
+		
+		for (int y = targetRect.top(); y <= targetRect.bottom(); ++y)
+		{
+			QPoint p(targetRect.left(), y);
+			
+			covers.data().fill(float(state()->opacity), targetRect.width());
+			clip.multiplyCovers(p, targetRect.width(), covers.data());
+			blendClippedSourceSpan(targetRect.width(), _bitmap.pixelPointer(p), image.constPixelPointer(p - point), covers.data(), op);
+		}
+		return;
+	}
+	
 	for (int y = targetRect.top(); y <= targetRect.bottom(); ++y)
 	{
 		QPoint p(targetRect.left(), y);
 		
 		if (state()->opacity == 1.0)
-			op->blend(targetRect.width(), _bitmap.pixelPointer(p), image.constPixelPointer(p - point));
+			blendSourceSpan(targetRect.width(), _bitmap.pixelPointer(p), image.constPixelPointer(p - point), op);
 		else
-			op->blend(targetRect.width(), _bitmap.pixelPointer(p), image.constPixelPointer(p - point), state()->opacity);
+			blendSourceSpan(targetRect.width(), _bitmap.pixelPointer(p), image.constPixelPointer(p - point), float(state()->opacity), op);
 	}
 }
 
+void ImagePaintEngine::drawDab(const Vec2D &center, double diameter, double hardness)
+{
+	Vec2D deviceCenter;
+	double deviceDiameter;
+	
+	if (!mapDab(center, diameter, &deviceCenter, &deviceDiameter))
+	{
+		PaintEngine::drawDab(center, diameter, hardness);
+		return;
+	}
+	
+	BlendOp *op = BlendMode(state()->blendMode).op();
+	if (!op)
+		return;
+	
+	QPoint origin;
+	auto mask = dabMaskCache()->mask(deviceCenter, deviceDiameter, hardness, &origin);
+	
+	stampDab(_bitmap, origin, *mask, state()->brush.pixel() * float(state()->opacity), op, &state()->clipMask);
 }
 
+}
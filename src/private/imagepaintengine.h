@@ -18,6 +18,7 @@ public:
 	
 	void drawPreTransformedPolygons(const FixedMultiPolygon &polygons);
 	void drawPreTransformedImage(const QPoint &point, const Image &image, const QRect &imageMaskRect);
+	void drawDab(const Vec2D &center, double diameter, double hardness);
 	
 private:
 	
@@ -0,0 +1,245 @@
+#include <cstdlib>
+#include <limits>
+#include <QtEndian>
+#include <zlib.h>
+#include "pngwriter.h"
+
+namespace Malachite
+{
+
+namespace
+{
+
+enum FilterType
+{
+	FilterNone,
+	FilterSub,
+	FilterUp,
+	FilterAverage,
+	FilterPaeth,
+	FilterTypeCount
+};
+
+constexpr int outputBufferSize = 1 << 16;
+
+inline uint8_t paethPredictor(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+}
+
+PngWriter::PngWriter(QIODevice *device, const QSize &size, ColorType colorType) :
+	_device(device),
+	_size(size),
+	_colorType(colorType),
+	_bytesPerPixel(colorType == ColorTypeRgba ? 8 : 6)
+{
+	int rowBytes = _size.width() * _bytesPerPixel;
+	
+	_row.fill(0, rowBytes);
+	_previousRow.fill(0, rowBytes);
+	_filtered.resize(rowBytes + 1);
+	_output.resize(outputBufferSize);
+}
+
+PngWriter::~PngWriter()
+{
+	if (_stream)
+	{
+		deflateEnd(_stream);
+		delete _stream;
+	}
+}
+
+bool PngWriter::begin()
+{
+	if (_size.isEmpty() || _stream)
+		return false;
+	
+	static const char signature[] = { char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	
+	if (_device->write(signature, sizeof(signature)) != sizeof(signature))
+		return false;
+	
+	uchar header[13];
+	qToBigEndian<quint32>(_size.width(), header);
+	qToBigEndian<quint32>(_size.height(), header + 4);
+	header[8] = 16;	// bit depth
+	header[9] = _colorType;
+	header[10] = 0;	// deflate
+	header[11] = 0;	// adaptive filtering
+	header[12] = 0;	// no interlace
+	
+	if (!writeChunk("IHDR", reinterpret_cast<const char *>(header), sizeof(header)))
+		return false;
+	
+	_stream = new z_stream;
+	_stream->zalloc = Z_NULL;
+	_stream->zfree = Z_NULL;
+	_stream->opaque = Z_NULL;
+	
+	if (deflateInit(_stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+	{
+		delete _stream;
+		_stream = 0;
+		return false;
+	}
+	
+	_stream->next_out = reinterpret_cast<Bytef *>(_output.data());
+	_stream->avail_out = _output.size();
+	
+	return true;
+}
+
+bool PngWriter::writeRow(const quint16 *samples)
+{
+	if (!_stream || _rowCount >= _size.height())
+		return false;
+	
+	// PNG samples are big-endian
+	auto rowBytes = reinterpret_cast<uchar *>(_row.data());
+	int sampleCount = _row.size() / 2;
+	
+	for (int i = 0; i < sampleCount; ++i)
+		qToBigEndian<quint16>(samples[i], rowBytes + i * 2);
+	
+	filterRow();
+	
+	if (!deflateRow(_filtered.constData(), _filtered.size(), Z_NO_FLUSH))
+		return false;
+	
+	qSwap(_row, _previousRow);
+	_rowCount++;
+	return true;
+}
+
+bool PngWriter::finish()
+{
+	if (!_stream || _rowCount != _size.height())
+		return false;
+	
+	if (!deflateRow(0, 0, Z_FINISH))
+		return false;
+	
+	int rest = _output.size() - _stream->avail_out;
+	
+	if (rest && !writeChunk("IDAT", _output.constData(), rest))
+		return false;
+	
+	deflateEnd(_stream);
+	delete _stream;
+	_stream = 0;
+	
+	return writeChunk("IEND", 0, 0);
+}
+
+bool PngWriter::writeChunk(const char *type, const char *data, int size)
+{
+	uchar length[4];
+	qToBigEndian<quint32>(size, length);
+	
+	uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+	if (size)
+		crc = crc32(crc, reinterpret_cast<const Bytef *>(data), size);
+	
+	uchar crcBytes[4];
+	qToBigEndian<quint32>(crc, crcBytes);
+	
+	return _device->write(reinterpret_cast<const char *>(length), 4) == 4
+		&& _device->write(type, 4) == 4
+		&& (size == 0 || _device->write(data, size) == size)
+		&& _device->write(reinterpret_cast<const char *>(crcBytes), 4) == 4;
+}
+
+bool PngWriter::deflateRow(const char *data, int size, int flush)
+{
+	_stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	_stream->avail_in = size;
+	
+	forever
+	{
+		int result = deflate(_stream, flush);
+		
+		if (result == Z_STREAM_ERROR)
+			return false;
+		
+		// a full output buffer becomes an IDAT chunk
+		if (_stream->avail_out == 0)
+		{
+			if (!writeChunk("IDAT", _output.constData(), _output.size()))
+				return false;
+			
+			_stream->next_out = reinterpret_cast<Bytef *>(_output.data());
+			_stream->avail_out = _output.size();
+			continue;
+		}
+		
+		if (flush == Z_FINISH ? result == Z_STREAM_END : _stream->avail_in == 0)
+			return true;
+	}
+}
+
+// chooses the filter with the smallest sum of absolute differences, as libpng does
+void PngWriter::filterRow()
+{
+	const int count = _row.size();
+	const int bpp = _bytesPerPixel;
+	
+	auto row = reinterpret_cast<const uint8_t *>(_row.constData());
+	auto prev = reinterpret_cast<const uint8_t *>(_previousRow.constData());
+	
+	auto filtered = [&](int type, int i) -> uint8_t
+	{
+		int a = i >= bpp ? row[i - bpp] : 0;
+		int b = _rowCount ? prev[i] : 0;
+		int c = (i >= bpp && _rowCount) ? prev[i - bpp] : 0;
+		
+		switch (type)
+		{
+			default:
+			case FilterNone:
+				return row[i];
+			case FilterSub:
+				return row[i] - a;
+			case FilterUp:
+				return row[i] - b;
+			case FilterAverage:
+				return row[i] - ((a + b) >> 1);
+			case FilterPaeth:
+				return row[i] - paethPredictor(a, b, c);
+		}
+	};
+	
+	int bestType = FilterNone;
+	quint64 bestSum = std::numeric_limits<quint64>::max();
+	
+	for (int type = FilterNone; type < FilterTypeCount; ++type)
+	{
+		quint64 sum = 0;
+		
+		for (int i = 0; i < count && sum < bestSum; ++i)
+			sum += std::abs(int8_t(filtered(type, i)));
+		
+		if (sum < bestSum)
+		{
+			bestSum = sum;
+			bestType = type;
+		}
+	}
+	
+	auto dst = reinterpret_cast<uint8_t *>(_filtered.data());
+	dst[0] = bestType;
+	
+	for (int i = 0; i < count; ++i)
+		dst[i + 1] = filtered(bestType, i);
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef MLPNGWRITER_H
+#define MLPNGWRITER_H
+
+#include <QIODevice>
+#include <QSize>
+#include <QByteArray>
+
+typedef struct z_stream_s z_stream;
+
+namespace Malachite
+{
+
+/**
+ * Writes a 16bit PNG row by row, so that the whole image never has to be in memory.
+ * Rows are filtered adaptively and compressed with zlib as they arrive.
+ */
+class PngWriter
+{
+public:
+	
+	enum ColorType
+	{
+		ColorTypeRgb = 2,
+		ColorTypeRgba = 6
+	};
+	
+	PngWriter(QIODevice *device, const QSize &size, ColorType colorType);
+	~PngWriter();
+	
+	/**
+	 * Writes the signature and the header.
+	 * @return false if failed
+	 */
+	bool begin();
+	
+	/**
+	 * Writes a row of native-endian 16bit samples in RGB(A) order.
+	 * @param samples
+	 * @return false if failed
+	 */
+	bool writeRow(const quint16 *samples);
+	
+	/**
+	 * Flushes the compressed data and writes the end of the image.
+	 * All rows must have been written.
+	 * @return false if failed
+	 */
+	bool finish();
+	
+	int rowCount() const { return _rowCount; }
+	
+private:
+	
+	bool writeChunk(const char *type, const char *data, int size);
+	bool deflateRow(const char *data, int size, int flush);
+	void filterRow();
+	
+	QIODevice *_device;
+	QSize _size;
+	ColorType _colorType;
+	int _bytesPerPixel;
+	int _rowCount = 0;
+	
+	z_stream *_stream = 0;
+	QByteArray _row, _previousRow;
+	QByteArray _filtered;	// a filter type byte followed by the filtered row
+	QByteArray _output;
+};
+
+}
+
+#endif // MLPNGWRITER_H
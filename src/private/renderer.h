@@ -7,6 +7,8 @@
 #include "../curvesubdivision.h"
 #include "../bitmap.h"
 #include "../blendop.h"
+#include "../clipmask.h"
+#include "spanrun.h"
 
 namespace Malachite
 {
@@ -144,11 +146,15 @@ template <class T_Filler>
 class ImageBaseRenderer
 {
 public:
-	ImageBaseRenderer(const Bitmap<Pixel> &bitmap, BlendOp *blendOp, float opacity, T_Filler *filler) :
+	/**
+	 * @param clip The clip mask in the coordinates of the bitmap, or null
+	 */
+	ImageBaseRenderer(const Bitmap<Pixel> &bitmap, BlendOp *blendOp, float opacity, T_Filler *filler, const ClipMask *clip = 0) :
 		_bitmap(bitmap),
 		_blendOp(blendOp),
 		_opacity(opacity),
-		_filler(filler)
+		_filler(filler),
+		_clip(clip && !clip->isNull() ? clip : 0)
 	{}
 	
 	void blendRasterizerSpan(int x, int y, int count, Pointer<float> covers)
@@ -169,8 +175,43 @@ public:
 				covers[i] *= _opacity;
 		}
 		
-		QPoint pos(start, y);
-		_filler->fill(pos, newCount, _bitmap.pixelPointer(pos), covers + (start - x), _blendOp);
+		Pointer<float> spanCovers = covers + (start - x);
+		
+		if (_clip)
+			_clip->multiplyCovers(QPoint(start, y), newCount, spanCovers);
+		
+		// runs without coverage are skipped and runs with full coverage are filled without coverage
+		// (the pixels clipped out are always left unchanged)
+		
+		bool skip = _clip || _blendOp->ignoresTransparentSource();
+		
+		auto typeAt = [&](int i)
+		{
+			float cover = spanCovers[i];
+			if (skip && cover == 0.f)
+				return SpanRunSkip;
+			if (cover == 1.f)
+				return SpanRunFull;
+			return SpanRunBlend;
+		};
+		
+		forEachSpanRun(newCount, typeAt, [&](SpanRunType type, int runStart, int length)
+		{
+			QPoint pos(start + runStart, y);
+			
+			switch (type)
+			{
+			case SpanRunSkip:
+				countSkippedPixels(length);
+				break;
+			case SpanRunFull:
+				_filler->fill(pos, length, _bitmap.pixelPointer(pos), _blendOp);
+				break;
+			default:
+				_filler->fill(pos, length, _bitmap.pixelPointer(pos), spanCovers + runStart, _blendOp);
+				break;
+			}
+		}, _clip != 0);
 	}
 	
 	void blendRasterizerLine(int x, int y, int count, float cover)
@@ -185,8 +226,33 @@ public:
 		if (newCount <= 0)
 			return;
 		
+		if (_clip)
+		{
+			switch (_clip->rectCoverage(QRect(start, y, newCount, 1)))
+			{
+			case ClipMask::CoverageNone:
+				countSkippedPixels(newCount);
+				return;
+			case ClipMask::CoveragePartial:
+			{
+				Array<float> covers(newCount);
+				covers.data().fill(cover, newCount);
+				blendRasterizerSpan(start, y, newCount, covers.data());
+				return;
+			}
+			default:
+				break;
+			}
+		}
+		
 		cover *= _opacity;
 		
+		if (cover == 0.f && (_clip || _blendOp->ignoresTransparentSource()))
+		{
+			countSkippedPixels(newCount);
+			return;
+		}
+		
 		QPoint pos(start, y);
 		
 		if (cover == 1.f)
@@ -200,6 +266,7 @@ private:
 	BlendOp *_blendOp;
 	float _opacity;
 	T_Filler *_filler;
+	const ClipMask *_clip;
 };
 
 
@@ -54,26 +54,64 @@ struct PosWrapperMethod<T_Image, Malachite::SpreadTypeReflective>
 template <class T_SourceType, Malachite::SpreadType T_SpreadType>
 class SourceWrapper;
 
+/**
+ * Samples a surface through a cursor which remembers the 3x3 tiles around the last sample.
+ * Samples are usually close to each other, so the tiles are looked up again only when a sample leaves them.
+ */
 template <Malachite::SpreadType T_SpreadType>
 class SourceWrapper<Surface, T_SpreadType>
 {
 public:
 	
-	SourceWrapper(const Surface *src) : _src(src) {}
+	SourceWrapper(const Surface *src) :
+		_src(src),
+		_defaultPixel(Surface::defaultPixel())
+	{
+		moveTo(QPoint());
+	}
 	
 	Pixel pixel(const QPoint &p) const
 	{
-		return _src->pixel(p);
+		constexpr int width = Surface::tileWidth();
+		
+		int x = p.x() - _origin.x();
+		int y = p.y() - _origin.y();
+		
+		if (uint(x) >= uint(width * 3) || uint(y) >= uint(width * 3))
+		{
+			moveTo(p);
+			x = p.x() - _origin.x();
+			y = p.y() - _origin.y();
+		}
+		
+		const Image *tile = _tiles[y / width][x / width];
+		return tile ? tile->pixel(x % width, y % width) : _defaultPixel;
 	}
 	
 	Pixel pixelDirect(const QPoint &p) const
 	{
-		return _src->pixel(p);
+		return pixel(p);
 	}
 	
 private:
 	
+	void moveTo(const QPoint &p) const
+	{
+		QPoint center = Surface::keyForPixel(p);
+		_origin = (center - QPoint(1, 1)) * Surface::tileWidth();
+		
+		for (int y = 0; y < 3; ++y)
+		{
+			for (int x = 0; x < 3; ++x)
+				_tiles[y][x] = _src->tilePointer(center + QPoint(x - 1, y - 1));
+		}
+	}
+	
 	const Surface *_src;
+	Pixel _defaultPixel;
+	
+	mutable QPoint _origin;
+	mutable const Image *_tiles[3][3];
 };
 
 template <Malachite::SpreadType T_SpreadType>
@@ -230,6 +268,19 @@ private:
 	SourceWrapper<T_Source, T_SpreadType> _srcWrapper;
 };
 
+/**
+ * Samples the points start, start + step, ... of a scaling generator into a span.
+ * The sample positions are accumulated instead of mapping each pixel through the transform.
+ */
+template <class T_Generator>
+void generateScalingSpan(T_Generator &generator, const Vec2D &start, const Vec2D &step, int count, Pointer<Pixel> dst)
+{
+	Vec2D p = start;
+	
+	for (int i = 0; i < count; ++i, p += step)
+		dst[i] = generator.at(p);
+}
+
 class ScalingWeightMethodBicubic
 {
 public:
@@ -0,0 +1,264 @@
+#ifndef MLSPANRUN_H
+#define MLSPANRUN_H
+
+#include "../blendop.h"
+
+// the span statistics of BlendOp are counted only in debug builds of the library
+#ifdef QT_DEBUG
+#define ML_SPAN_STATISTICS
+#endif
+
+namespace Malachite
+{
+
+/*
+ * Count into BlendOp::spanStatistics(), compiled out of the renderers unless ML_SPAN_STATISTICS is defined.
+ */
+inline void countSkippedPixels(int count)
+{
+#ifdef ML_SPAN_STATISTICS
+	BlendOp::addSkippedPixels(count);
+#else
+	Q_UNUSED(count);
+#endif
+}
+
+inline void countCollapsedPixels(int count)
+{
+#ifdef ML_SPAN_STATISTICS
+	BlendOp::addCollapsedPixels(count);
+#else
+	Q_UNUSED(count);
+#endif
+}
+
+enum SpanRunType
+{
+	SpanRunBlend,	// blended normally
+	SpanRunSkip,	// contributes nothing
+	SpanRunFull		// full coverage or opaque source
+};
+
+/**
+ * Splits a span into runs and calls func(type, start, length) for each run.
+ * Skip and full runs shorter than SpanRunMinLength are merged into the surrounding blended runs
+ * so that noisy spans are not broken into tiny blend calls.
+ * Merging a skip run is only valid if blending its pixels is a no-op;
+ * pass exactSkipRuns when it is not (clipped-out pixels, which blend ops would still write with cover 0).
+ * @param count The number of pixels
+ * @param typeAt Returns the SpanRunType of the pixel at the index
+ * @param func
+ * @param exactSkipRuns Never merge skip runs
+ */
+template <class TTypeFunc, class TRunFunc>
+void forEachSpanRun(int count, TTypeFunc typeAt, TRunFunc func, bool exactSkipRuns = false)
+{
+	constexpr int SpanRunMinLength = 4;
+	
+	int blendStart = 0;
+	int i = 0;
+	
+	while (i < count)
+	{
+		SpanRunType type = typeAt(i);
+		int end = i + 1;
+		
+		while (end < count && typeAt(end) == type)
+			++end;
+		
+		if (type != SpanRunBlend && (end - i >= SpanRunMinLength || end - i == count || (exactSkipRuns && type == SpanRunSkip)))
+		{
+			if (blendStart < i)
+				func(SpanRunBlend, blendStart, i - blendStart);
+			
+			func(type, i, end - i);
+			blendStart = end;
+		}
+		
+		i = end;
+	}
+	
+	if (blendStart < count)
+		func(SpanRunBlend, blendStart, count - blendStart);
+}
+
+/**
+ * Blends a source span with full coverage.
+ * Transparent runs are skipped and opaque runs are copied if the blend op allows it.
+ */
+inline void blendSourceSpan(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, BlendOp *blendOp)
+{
+	bool skip = blendOp->ignoresTransparentSource();
+	bool copy = blendOp->copiesOpaqueSource();
+	
+	if (!skip && !copy)
+	{
+		blendOp->blend(count, dst, src);
+		return;
+	}
+	
+	auto typeAt = [&](int i)
+	{
+		float a = src[i].a();
+		if (skip && a == 0.f)
+			return SpanRunSkip;
+		if (copy && a == 1.f)
+			return SpanRunFull;
+		return SpanRunBlend;
+	};
+	
+	forEachSpanRun(count, typeAt, [&](SpanRunType type, int start, int length)
+	{
+		switch (type)
+		{
+		case SpanRunSkip:
+			countSkippedPixels(length);
+			break;
+		case SpanRunFull:
+			(dst + start).pasteArray(src + start, length);
+			countCollapsedPixels(length);
+			break;
+		default:
+			blendOp->blend(length, dst + start, src + start);
+			break;
+		}
+	});
+}
+
+inline float spanCoverOffset(float cover, int offset) { Q_UNUSED(offset); return cover; }
+
+template <class T>
+Pointer<T> spanCoverOffset(Pointer<T> covers, int offset) { return covers + offset; }
+
+/**
+ * Blends a source span with partial coverage, skipping transparent runs if the blend op allows it.
+ * TCover is either float or a pointer to the coverages.
+ */
+template <class TCover>
+void blendSourceSpan(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, TCover covers, BlendOp *blendOp)
+{
+	if (!blendOp->ignoresTransparentSource())
+	{
+		blendOp->blend(count, dst, src, covers);
+		return;
+	}
+	
+	auto typeAt = [&](int i)
+	{
+		return src[i].a() == 0.f ? SpanRunSkip : SpanRunBlend;
+	};
+	
+	forEachSpanRun(count, typeAt, [&](SpanRunType type, int start, int length)
+	{
+		if (type == SpanRunSkip)
+			countSkippedPixels(length);
+		else
+			blendOp->blend(length, dst + start, src + start, spanCoverOffset(covers, start));
+	});
+}
+
+/**
+ * Blends a color with full coverage.
+ * The span is skipped for a transparent color and filled for an opaque color if the blend op allows it.
+ */
+inline void blendColorSpan(int count, Pointer<Pixel> dst, const Pixel &color, BlendOp *blendOp)
+{
+	if (color.a() == 0.f && blendOp->ignoresTransparentSource())
+	{
+		countSkippedPixels(count);
+		return;
+	}
+	
+	if (color.a() == 1.f && blendOp->copiesOpaqueSource())
+	{
+		dst.fill(color, count);
+		countCollapsedPixels(count);
+		return;
+	}
+	
+	blendOp->blend(count, dst, color);
+}
+
+/**
+ * Blends a color with coverages, splitting the span into runs of zero and full coverage.
+ */
+inline void blendColorSpan(int count, Pointer<Pixel> dst, const Pixel &color, Pointer<const float> covers, BlendOp *blendOp)
+{
+	bool skip = blendOp->ignoresTransparentSource();
+	
+	if (color.a() == 0.f && skip)
+	{
+		countSkippedPixels(count);
+		return;
+	}
+	
+	auto typeAt = [&](int i)
+	{
+		float cover = covers[i];
+		if (skip && cover == 0.f)
+			return SpanRunSkip;
+		if (cover == 1.f)
+			return SpanRunFull;
+		return SpanRunBlend;
+	};
+	
+	forEachSpanRun(count, typeAt, [&](SpanRunType type, int start, int length)
+	{
+		switch (type)
+		{
+		case SpanRunSkip:
+			countSkippedPixels(length);
+			break;
+		case SpanRunFull:
+			blendColorSpan(length, dst + start, color, blendOp);
+			break;
+		default:
+			blendOp->blend(length, dst + start, color, covers + start);
+			break;
+		}
+	});
+}
+
+/**
+ * Blends a source span with coverages from a clip mask.
+ * The pixels without coverage are left unchanged whatever the blend op is.
+ */
+inline void blendClippedSourceSpan(int count, Pointer<Pixel> dst, Pointer<const Pixel> src, Pointer<const float> covers, BlendOp *blendOp)
+{
+	auto typeAt = [&](int i)
+	{
+		return covers[i] == 0.f ? SpanRunSkip : SpanRunBlend;
+	};
+	
+	forEachSpanRun(count, typeAt, [&](SpanRunType type, int start, int length)
+	{
+		if (type == SpanRunSkip)
+			countSkippedPixels(length);
+		else
+			blendSourceSpan(length, dst + start, src + start, covers + start, blendOp);
+	}, true);
+}
+
+/**
+ * Blends a color with coverages from a clip mask.
+ * The pixels without coverage are left unchanged whatever the blend op is.
+ */
+inline void blendClippedColorSpan(int count, Pointer<Pixel> dst, const Pixel &color, Pointer<const float> covers, BlendOp *blendOp)
+{
+	auto typeAt = [&](int i)
+	{
+		return covers[i] == 0.f ? SpanRunSkip : SpanRunBlend;
+	};
+	
+	forEachSpanRun(count, typeAt, [&](SpanRunType type, int start, int length)
+	{
+		if (type == SpanRunSkip)
+			countSkippedPixels(length);
+		else
+			blendColorSpan(length, dst + start, color, covers + start, blendOp);
+	}, true);
+}
+
+}
+
+#endif // MLSPANRUN_H
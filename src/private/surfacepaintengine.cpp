@@ -1,14 +1,175 @@
 
 #include <float.h>
+#include <QtConcurrentMap>
 
 #include "./misc.h"
 #include "./painter.h"
 #include "./surfacepainter.h"
+#include "dabmaskcache.h"
+#include "scalinggenerator.h"
+#include "spanrun.h"
 #include "surfacepaintengine.h"
 
 namespace Malachite
 {
 
+namespace
+{
+
+struct SurfaceResampleJob
+{
+	QPoint key;
+	QRect rect;	// the region to draw in the tile
+	Bitmap<Pixel> bitmap;
+	ClipMask clip;	// in the tile coordinates, null if the tile is not clipped
+	QRect footprint;	// the bounding rect of the tile in the source
+	Image coverage;	// the coverage of the source tiles in the alpha, null if they cover the whole tile
+};
+
+typedef void (*SurfaceResampleFunction)(const Surface &source, SurfaceResampleJob &job, const QTransform &inverse, BlendOp *op, float opacity);
+
+/*
+ * Resamples the source into a destination tile.
+ * The pixels are weighted by the coverage of the existing source tiles, so the edges of the source are antialiased.
+ */
+template <class T_Generator>
+void resampleSurfaceTile(const Surface &source, SurfaceResampleJob &job, const QTransform &inverse, BlendOp *op, float opacity)
+{
+	constexpr int width = Surface::tileWidth();
+	
+	T_Generator generator(&source);
+	
+	const Vec2D step(inverse.m11(), inverse.m12());
+	
+	Pixel span[width];
+	float covers[width];
+	
+	for (int y = job.rect.top(); y <= job.rect.bottom(); ++y)
+	{
+		int left = job.rect.left();
+		int right = job.rect.right();
+		
+		if (job.coverage.isValid())
+		{
+			auto coverageRow = job.coverage.constScanline(y);
+			
+			while (left <= right && coverageRow[left].a() == 0.f)
+				++left;
+			while (right >= left && coverageRow[right].a() == 0.f)
+				--right;
+			
+			if (left > right)
+				continue;
+		}
+		
+		int count = right + 1 - left;
+		
+		QPoint dstPos = job.key * width + QPoint(left, y);
+		generateScalingSpan(generator, Vec2D(dstPos.x() + 0.5, dstPos.y() + 0.5) * inverse, step, count, wrapPointer(span + left, count));
+		
+		if (job.coverage.isValid() || !job.clip.isNull())
+		{
+			if (job.coverage.isValid())
+			{
+				auto coverageRow = job.coverage.constScanline(y);
+				
+				for (int x = left; x <= right; ++x)
+					covers[x] = coverageRow[x].a() * opacity;
+			}
+			else
+			{
+				wrapPointer(covers + left, count).fill(opacity, count);
+			}
+			
+			job.clip.multiplyCovers(QPoint(left, y), count, wrapPointer(covers + left, count));
+			blendClippedSourceSpan(count, job.bitmap.pixelPointer(left, y), wrapPointer(span + left, count), wrapPointer(covers + left, count), op);
+		}
+		else if (opacity == 1.f)
+			op->blend(count, job.bitmap.pixelPointer(left, y), wrapPointer(span + left, count));
+		else
+			op->blend(count, job.bitmap.pixelPointer(left, y), wrapPointer(span + left, count), opacity);
+	}
+}
+
+SurfaceResampleFunction surfaceResampleFunction(Malachite::ImageTransformType type)
+{
+	switch (type)
+	{
+		case Malachite::ImageTransformTypeNearestNeighbor:
+			return &resampleSurfaceTile<ScalingGeneratorNearestNeighbor<Surface, Malachite::SpreadTypePad> >;
+		case Malachite::ImageTransformTypeBilinear:
+			return &resampleSurfaceTile<ScalingGeneratorBilinear<Surface, Malachite::SpreadTypePad> >;
+		case Malachite::ImageTransformTypeBicubic:
+			return &resampleSurfaceTile<ScalingGenerator2<Surface, Malachite::SpreadTypePad, ScalingWeightMethodBicubic> >;
+		case Malachite::ImageTransformTypeLanczos2:
+			return &resampleSurfaceTile<ScalingGenerator2<Surface, Malachite::SpreadTypePad, ScalingWeightMethodLanczos2> >;
+		case Malachite::ImageTransformTypeLanczos2Hypot:
+			return &resampleSurfaceTile<ScalingGenerator2<Surface, Malachite::SpreadTypePad, ScalingWeightMethodLanczos2Hypot> >;
+		default:
+			return 0;
+	}
+}
+
+bool footprintHasTiles(const Surface &source, const QRect &footprint)
+{
+	QPoint topLeft = Surface::keyForPixel(footprint.topLeft());
+	QPoint bottomRight = Surface::keyForPixel(footprint.bottomRight());
+	
+	for (int y = topLeft.y(); y <= bottomRight.y(); ++y)
+	{
+		for (int x = topLeft.x(); x <= bottomRight.x(); ++x)
+		{
+			if (source.tilePointer(QPoint(x, y)))
+				return true;
+		}
+	}
+	
+	return false;
+}
+
+/*
+ * Rasterizes the source tiles within the footprint of a destination tile into the alpha of the coverage,
+ * the same way as the generic path draws the source tiles as polygons.
+ * The coverage is left null if the source tiles cover the whole footprint.
+ */
+void footprintCoverage(const Surface &source, const QTransform &transform, const QPoint &key, const QRect &footprint, Image *coverage)
+{
+	QPoint topLeft = Surface::keyForPixel(footprint.topLeft());
+	QPoint bottomRight = Surface::keyForPixel(footprint.bottomRight());
+	
+	MultiPolygon polygons;
+	bool full = true;
+	
+	for (int y = topLeft.y(); y <= bottomRight.y(); ++y)
+	{
+		for (int x = topLeft.x(); x <= bottomRight.x(); ++x)
+		{
+			QPoint sourceKey(x, y);
+			
+			if (source.tilePointer(sourceKey))
+				polygons << Polygon::fromRect(Surface::keyToRect(sourceKey));
+			else
+				full = false;
+		}
+	}
+	
+	if (full)
+		return;
+	
+	QPoint delta = -key * Surface::tileWidth();
+	
+	*coverage = Image(Surface::tileSize());
+	coverage->fill(Pixel(0));
+	
+	// the polygons are rasterized at once so that the shared edges of adjacent tiles cancel out
+	Painter painter(coverage);
+	painter.setPixel(Pixel(1));
+	painter.setShapeTransform(transform * QTransform::fromTranslate(delta.x(), delta.y()));
+	painter.drawPolygons(polygons);
+}
+
+}
+
 SurfacePaintEngine::SurfacePaintEngine() :
 	PaintEngine()
 {}
@@ -31,6 +192,23 @@ bool SurfacePaintEngine::flush()
 	return true;
 }
 
+bool SurfacePaintEngine::tileClip(const QPoint &key, ClipMask *tileMask) const
+{
+	const ClipMask &clip = state()->clipMask;
+	
+	switch (clip.rectCoverage(Surface::keyToRect(key)))
+	{
+		case ClipMask::CoverageNone:
+			return false;
+		case ClipMask::CoverageFull:
+			*tileMask = ClipMask();
+			return true;
+		default:
+			*tileMask = clip.translated(key * Surface::tileWidth());
+			return true;
+	}
+}
+
 void SurfacePaintEngine::drawPreTransformedPolygons(const FixedMultiPolygon &polygons)
 {
 	QRect boundingRect = polygons.boundingRect().toAlignedRect();
@@ -41,8 +219,12 @@ void SurfacePaintEngine::drawPreTransformedPolygons(const FixedMultiPolygon &pol
 	
 	for (const QPoint &key : keys)
 	{
-		FixedMultiPolygon rectShape = FixedPolygon::fromRect(Surface::keyToRect(key));
-		FixedMultiPolygon clippedShape = rectShape & polygons;
+		ClipMask tileMask;
+		if (!tileClip(key, &tileMask))
+			continue;
+		
+		// clip without the boolean operators, which would resolve overlapping polygons with the even-odd rule
+		FixedMultiPolygon clippedShape = polygons.clipped(Surface::keyToRect(key));
 		
 		QPoint delta = -key * Surface::tileWidth();
 		
@@ -50,6 +232,7 @@ void SurfacePaintEngine::drawPreTransformedPolygons(const FixedMultiPolygon &pol
 		
 		Painter painter(&_surface->tileRef(key));
 		*painter.state() = *state();
+		painter.state()->clipMask = tileMask;
 		painter.setShapeTransform(state()->shapeTransform * QTransform::fromTranslate(delta.x(), delta.y()));
 		
 		painter.drawPreTransformedPolygons(clippedShape);
@@ -64,8 +247,13 @@ void SurfacePaintEngine::drawPreTransformedImage(const QPoint &point, const Imag
 	
 	for (const QPoint &key : keys)
 	{
+		ClipMask tileMask;
+		if (!tileClip(key, &tileMask))
+			continue;
+		
 		Painter painter(&_surface->tileRef(key));
 		*painter.state() = *state();
+		painter.state()->clipMask = tileMask;
 		painter.drawPreTransformedImage(point - key * Surface::tileWidth(), image);
 	}
 }
@@ -78,8 +266,13 @@ void SurfacePaintEngine::drawPreTransformedImage(const QPoint &point, const Imag
 	
 	for (const QPoint &key : keys)
 	{
+		ClipMask tileMask;
+		if (!tileClip(key, &tileMask))
+			continue;
+		
 		Painter painter(&_surface->tileRef(key));
 		*painter.state() = *state();
+		painter.state()->clipMask = tileMask;
 		
 		QPoint delta = key * Surface::tileWidth();
 		
@@ -91,19 +284,69 @@ void SurfacePaintEngine::drawPreTransformedSurface(const QPoint &point, const Su
 {
 	if (point == QPoint())
 	{
-		auto drawTile = [=](const QPoint &key, const QRect &rect)
+		BlendOp *op = state()->blendMode.op();
+		if (!op)
+			return;
+		
+		const BlendMode blendMode = state()->blendMode;
+		const float opacity = state()->opacity;
+		
+		// keep the source unchanged even if it is the destination itself
+		const Surface source = surface;
+		const Image defaultTile = Surface::defaultTile();
+		const QRect tileRect(QPoint(), Surface::tileSize());
+		
+		struct CompositeJob
 		{
+			QPoint key;
+			QRect rect;
+			const Image *source;
+			bool opacityOnly;	// the tile is already the source and only the opacity is applied
+			Image *tile;
+			ClipMask clip;	// in the tile coordinates, null if the tile is not clipped
+		};
+		
+		QVector<CompositeJob> jobs;
+		
+		// decide what to do with each tile and change the tile set serially
+		
+		auto decide = [&](const QPoint &key, const QRect &rect)
+		{
+			ClipMask tileMask;
+			if (!tileClip(key, &tileMask))
+				return;
+			
+			const Image *sourceTile = source.tilePointer(key);
+			
 			BlendOp::TileCombination combination = BlendOp::NoTile;
 			
 			if (_surface->contains(key))
 				combination |= BlendOp::TileDestination;
-			if (surface.contains(key))
+			if (sourceTile)
 				combination |= BlendOp::TileSource;
 			
-			switch (state()->blendMode.op()->tileRequirement(combination))
+			if (!sourceTile)
+				sourceTile = &defaultTile;
+			
+			auto requirement = op->tileRequirement(combination);
+			
+			// the tile cannot be replaced or removed as a whole since the clipped-out pixels must be kept
+			if (!tileMask.isNull())
+			{
+				if (requirement != BlendOp::TileDestination)
+				{
+					_surface->tileRef(key);
+					jobs << CompositeJob { key, rect, sourceTile, false, 0, tileMask };
+				}
+				return;
+			}
+			
+			switch (requirement)
 			{
 				case BlendOp::TileSource:
-					_surface->setTile(key, surface.tile(key) * state()->opacity);
+					_surface->setTile(key, *sourceTile);
+					if (opacity != 1.f)
+						jobs << CompositeJob { key, rect, sourceTile, true, 0, ClipMask() };
 					break;
 					
 				case BlendOp::NoTile:
@@ -115,8 +358,8 @@ void SurfacePaintEngine::drawPreTransformedSurface(const QPoint &point, const Su
 					break;
 					
 				case BlendOp::TileBoth:
-					
-					_surface->tileRef(key).pasteWithBlendMode(state()->blendMode, state()->opacity, surface.tile(key), QPoint(), rect);
+					_surface->tileRef(key);
+					jobs << CompositeJob { key, rect, sourceTile, false, 0, ClipMask() };
 					break;
 			}
 		};
@@ -124,18 +367,54 @@ void SurfacePaintEngine::drawPreTransformedSurface(const QPoint &point, const Su
 		if (!_keyRectClip.isEmpty())
 		{
 			for (auto iter = _keyRectClip.begin(); iter != _keyRectClip.end(); ++iter)
-				drawTile(iter.key(), iter.value());
+				decide(iter.key(), iter.value());
 		}
 		else if (!_keyClip.isEmpty())
 		{
 			for (auto &key : _keyClip)
-				drawTile(key, QRect(QPoint(), Surface::tileSize()));
+				decide(key, tileRect);
 		}
 		else
 		{
-			for (auto &key : surface.keys() | _surface->keys())
-				drawTile(key, QRect(QPoint(), Surface::tileSize()));
+			for (auto iter = source.begin(); iter != source.end(); ++iter)
+				decide(iter.key(), tileRect);
+			
+			// _surface->keyList() is taken before the loop since decide() may remove tiles
+			for (const QPoint &key : _surface->keyList())
+			{
+				if (!source.contains(key))
+					decide(key, tileRect);
+			}
 		}
+		
+		// the tile set no longer changes, so the pointers to the tiles stay valid
+		
+		for (CompositeJob &job : jobs)
+			job.tile = &_surface->tileRef(job.key);
+		
+		// each job touches only its own tile, so the result does not depend on the scheduling
+		
+		QtConcurrent::blockingMap(jobs, [&](CompositeJob &job)
+		{
+			if (!job.clip.isNull())
+			{
+				QRect rect = job.rect & tileRect;
+				Array<float> covers(rect.width());
+				
+				for (int y = rect.top(); y <= rect.bottom(); ++y)
+				{
+					QPoint p(rect.left(), y);
+					
+					covers.data().fill(opacity, rect.width());
+					job.clip.multiplyCovers(p, rect.width(), covers.data());
+					blendClippedSourceSpan(rect.width(), job.tile->pixelPointer(p), job.source->constPixelPointer(p), covers.data(), op);
+				}
+			}
+			else if (job.opacityOnly)
+				*job.tile *= opacity;
+			else
+				job.tile->pasteWithBlendMode(blendMode, opacity, *job.source, QPoint(), job.rect);
+		});
 	}
 	else
 	{
@@ -144,5 +423,103 @@ void SurfacePaintEngine::drawPreTransformedSurface(const QPoint &point, const Su
 	}
 }
 
+void SurfacePaintEngine::drawSurface(const Vec2D &point, const Surface &surface)
+{
+	QTransform transform = QTransform::fromTranslate(point.x(), point.y()) * state()->shapeTransform;
+	
+	if (transformIsIntegerTranslating(transform) || !transform.isAffine() || !transform.isInvertible())
+	{
+		PaintEngine::drawSurface(point, surface);
+		return;
+	}
+	
+	BlendOp *op = BlendMode(state()->blendMode).op();
+	auto resample = surfaceResampleFunction(state()->imageTransformType);
+	if (!op || !resample)
+		return;
+	
+	// keep the source unchanged even if it is the destination itself
+	const Surface source = surface;
+	const QTransform inverse = transform.inverted();
+	
+	QPointSet keys;
+	
+	for (auto iter = source.begin(); iter != source.end(); ++iter)
+		keys |= Surface::rectToKeys(transform.mapRect(QRectF(Surface::keyToRect(iter.key()))).toAlignedRect());
+	
+	if (!_keyClip.isEmpty())
+		keys &= _keyClip;
+	
+	// the tiles are detached here so that the jobs write only to their own tiles
+	
+	QVector<SurfaceResampleJob> jobs;
+	jobs.reserve(keys.size());
+	
+	for (const QPoint &key : keys)
+	{
+		QRect footprint = inverse.mapRect(QRectF(Surface::keyToRect(key))).toAlignedRect();
+		if (!footprintHasTiles(source, footprint))
+			continue;
+		
+		SurfaceResampleJob job;
+		if (!tileClip(key, &job.clip))
+			continue;
+		
+		job.footprint = footprint;
+		job.key = key;
+		job.rect = _keyRectClip.value(key, QRect(QPoint(), Surface::tileSize()));
+		job.bitmap = _surface->tileRef(key).bitmap();
+		jobs << job;
+	}
+	
+	float opacity = state()->opacity;
+	
+	QtConcurrent::blockingMap(jobs, [&](SurfaceResampleJob &job)
+	{
+		footprintCoverage(source, transform, job.key, job.footprint, &job.coverage);
+		resample(source, job, inverse, op, opacity);
+	});
+}
+
+void SurfacePaintEngine::drawDab(const Vec2D &center, double diameter, double hardness)
+{
+	Vec2D deviceCenter;
+	double deviceDiameter;
+	
+	if (!mapDab(center, diameter, &deviceCenter, &deviceDiameter))
+	{
+		PaintEngine::drawDab(center, diameter, hardness);
+		return;
+	}
+	
+	BlendOp *op = BlendMode(state()->blendMode).op();
+	if (!op)
+		return;
+	
+	QPoint origin;
+	auto mask = dabMaskCache()->mask(deviceCenter, deviceDiameter, hardness, &origin);
+	
+	QPointSet keys = Surface::rectToKeys(QRect(origin + mask->offset, mask->size));
+	if (!_keyClip.isEmpty())
+		keys &= _keyClip;
+	
+	Pixel color = state()->brush.pixel() * float(state()->opacity);
+	
+	// ops which do not need the source where there is no destination leave missing tiles missing
+	bool createsTiles = op->tileRequirement(BlendOp::TileSource) & BlendOp::TileSource;
+	
+	for (const QPoint &key : keys)
+	{
+		if (!createsTiles && !_surface->contains(key))
+			continue;
+		
+		ClipMask tileMask;
+		if (!tileClip(key, &tileMask))
+			continue;
+		
+		Bitmap<Pixel> bitmap = _surface->tileRef(key).bitmap();
+		stampDab(bitmap, origin - key * Surface::tileWidth(), *mask, color, op, &tileMask);
+	}
 }
 
+}
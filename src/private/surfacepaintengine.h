@@ -23,6 +23,8 @@ public:
 	void drawPreTransformedImage(const QPoint &point, const Image &image, const QRect &imageMaskRect);
 	
 	void drawPreTransformedSurface(const QPoint &point, const Surface &surface);
+	void drawSurface(const Vec2D &point, const Surface &surface);
+	void drawDab(const Vec2D &center, double diameter, double hardness);
 	
 	void setKeyClip(const QPointSet &keys) { _keyClip = keys; }
 	QPointSet keyClip() const { return _keyClip; }
@@ -32,6 +34,14 @@ public:
 	
 private:
 	
+	/**
+	 * Computes the clip mask of a tile in the tile coordinates.
+	 * @param key
+	 * @param tileMask The clip mask of the tile, which is null if the tile is fully inside the clip
+	 * @return false if the tile is entirely clipped out
+	 */
+	bool tileClip(const QPoint &key, ClipMask *tileMask) const;
+	
 	Surface *_surface = 0;
 	QPointSet _keyClip;
 	QHash<QPoint, QRect> _keyRectClip;
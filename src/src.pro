@@ -14,6 +14,7 @@ HEADERS += bitmap.h \
            blendmode.h \
            blendop.h \
            brush.h \
+           clipmask.h \
            color.h \
            colorgradient.h \
            container.h \
@@ -25,6 +26,7 @@ HEADERS += bitmap.h \
            global.h \
            image.h \
            imageio.h \
+           maskimage.h \
            memory.h \
            misc.h \
            paintable.h \
@@ -32,7 +34,11 @@ HEADERS += bitmap.h \
            painter.h \
            pixelconversion.h \
            polygon.h \
+           polygonstroker.h \
            surface.h \
+           surfacefile.h \
+           surfacejournal.h \
+           tilecodec.h \
            surfacepainter.h \
            surfaceselection.h \
            private/agg_array.h \
@@ -46,11 +52,14 @@ HEADERS += bitmap.h \
            private/agg_rasterizer_sl_clip.h \
            private/agg_scanline_p.h \
            private/clipper.hpp \
+    private/dabmaskcache.h \
     private/filler.h \
     private/gradientgenerator.h \
     private/imagepaintengine.h \
+    private/pngwriter.h \
     private/renderer.h \
     private/scalinggenerator.h \
+    private/spanrun.h \
     private/surfacepaintengine.h \
     vector_generic.h \
     vector_sse.h \
@@ -65,6 +74,7 @@ HEADERS += bitmap.h \
 SOURCES += blendmode.cpp \
            blendop.cpp \
            brush.cpp \
+           clipmask.cpp \
            color.cpp \
            colorgradient.cpp \
            curves.cpp \
@@ -75,12 +85,19 @@ SOURCES += blendmode.cpp \
            misc.cpp \
            paintengine.cpp \
            painter.cpp \
+           pixelconversion.cpp \
            polygon.cpp \
+           polygonstroker.cpp \
            surface.cpp \
+           surfacefile.cpp \
+           surfacejournal.cpp \
+           tilecodec.cpp \
            surfacepainter.cpp \
            surfaceselection.cpp \
            private/clipper.cpp \
+    private/dabmaskcache.cpp \
     private/imagepaintengine.cpp \
+    private/pngwriter.cpp \
     private/renderer.cpp \
     private/surfacepaintengine.cpp
 RESOURCES += resources.qrc
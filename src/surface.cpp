@@ -4,6 +4,7 @@
 #include "private/surfacepaintengine.h"
 #include "surface.h"
 #include "division.h"
+#include "tilecodec.h"
 
 namespace Malachite
 {
@@ -13,18 +14,28 @@ PaintEngine *Surface::createPaintEngine()
 	return new SurfacePaintEngine();
 }
 
+namespace
+{
+
+// written where the tile width was written in the uncompressed format
+constexpr quint64 surfaceStreamMarker = 0;
+constexpr quint32 surfaceStreamVersion = 2;
+
+}
+
 QDataStream &operator<<(QDataStream &out, const Surface &surface)
 {
-	out << quint64(surface.tileWidth());
-	out << quint64(surface.tileCount());
+	auto tiles = TileCodec::encodeSurface(surface);
+	
+	out << surfaceStreamMarker;
+	out << surfaceStreamVersion;
+	out << quint32(surface.tileWidth());
+	out << quint32(tiles.size());
 	
-	for (auto iter = surface.begin(); iter != surface.end(); ++iter)
+	for (auto iter = tiles.begin(); iter != tiles.end(); ++iter)
 	{
-		quint64 x, y;
-		x = iter.key().x();
-		y = iter.key().y();
-		out << x;
-		out << y;
+		out << qint32(iter.key().x());
+		out << qint32(iter.key().y());
 		out << iter.value();
 	}
 	
@@ -35,6 +46,38 @@ QDataStream &operator>>(QDataStream &in, Surface &surfaceOut)
 {
 	quint64 tileWidth2x, tileCount2x;
 	in >> tileWidth2x;
+	
+	if (tileWidth2x == surfaceStreamMarker)
+	{
+		quint32 version, tileWidth, tileCount;
+		in >> version >> tileWidth >> tileCount;
+		
+		if (version != surfaceStreamVersion || tileWidth != quint32(Surface::tileWidth()))
+		{
+			in.setStatus(QDataStream::ReadCorruptData);
+			surfaceOut = Surface();
+			return in;
+		}
+		
+		QHash<QPoint, QByteArray> tiles;
+		
+		for (quint32 i = 0; i < tileCount && in.status() == QDataStream::Ok; ++i)
+		{
+			qint32 x, y;
+			QByteArray data;
+			in >> x >> y >> data;
+			tiles.insert(QPoint(x, y), data);
+		}
+		
+		bool ok;
+		surfaceOut = TileCodec::decodeSurface(tiles, &ok);
+		
+		if (!ok)
+			in.setStatus(QDataStream::ReadCorruptData);
+		
+		return in;
+	}
+	
 	in >> tileCount2x;
 	
 	int tileWidth = tileWidth2x;
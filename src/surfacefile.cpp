@@ -0,0 +1,325 @@
+#include <cstring>
+#include <QCache>
+#include <QFile>
+#include <QMutex>
+#include <QSaveFile>
+#include "tilecodec.h"
+#include "surfacefile.h"
+
+namespace Malachite
+{
+
+namespace
+{
+
+const char surfaceFileMagic[8] = { 'M', 'L', 'S', 'U', 'R', 'F', 0, 0 };
+constexpr quint32 surfaceFileVersion = 1;
+constexpr quint32 surfaceFileByteOrderMark = 0x01020304;
+constexpr qint64 surfaceFileAlignment = 64;
+
+struct SurfaceFileHeader
+{
+	char magic[8];
+	quint32 version;
+	quint32 byteOrderMark;
+	quint32 tileWidth;
+	quint32 pixelSize;
+	quint64 tileCount;
+	quint64 indexOffset;
+	char reserved[24];
+};
+
+struct SurfaceFileIndexEntry
+{
+	qint32 x, y;
+	quint32 codec;
+	quint32 reserved;
+	quint64 offset;
+	quint64 length;
+};
+
+static_assert(sizeof(SurfaceFileHeader) == surfaceFileAlignment, "the header must fill one alignment unit");
+static_assert(sizeof(SurfaceFileIndexEntry) == 32, "index entries must be packed");
+
+inline qint64 alignedOffset(qint64 offset)
+{
+	return (offset + surfaceFileAlignment - 1) / surfaceFileAlignment * surfaceFileAlignment;
+}
+
+inline qint64 rawTileLength()
+{
+	return qint64(Surface::tileWidth()) * Surface::tileWidth() * sizeof(Pixel);
+}
+
+}
+
+struct SurfaceFile::Data
+{
+	QFile file;
+	const uchar *map = 0;
+	qint64 mapSize = 0;
+	
+	QHash<QPoint, SurfaceFileIndexEntry> index;
+	
+	// the cost of a tile is its size in bytes
+	mutable QMutex cacheMutex;
+	mutable QCache<QPoint, Image> cache;
+};
+
+SurfaceFile::SurfaceFile() :
+	d(new Data)
+{
+	d->cache.setMaxCost(DefaultCacheSize);
+}
+
+SurfaceFile::~SurfaceFile()
+{
+	close();
+	delete d;
+}
+
+bool SurfaceFile::write(const Surface &surface, const QString &filePath, Codec codec)
+{
+	// written into a temporary file which replaces the old one only when complete,
+	// so that a failed write neither destroys the old file nor truncates it under a mapping of it
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	
+	// the header is rewritten with the index offset at the end
+	
+	SurfaceFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, surfaceFileMagic, sizeof(header.magic));
+	header.version = surfaceFileVersion;
+	header.byteOrderMark = surfaceFileByteOrderMark;
+	header.tileWidth = Surface::tileWidth();
+	header.pixelSize = sizeof(Pixel);
+	header.tileCount = surface.tileCount();
+	
+	if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header))
+		return false;
+	
+	QVector<SurfaceFileIndexEntry> index;
+	index.reserve(surface.tileCount());
+	
+	QHash<QPoint, QByteArray> encodedTiles;
+	if (codec == CodecCompressed)
+		encodedTiles = TileCodec::encodeSurface(surface);
+	
+	static const char padding[surfaceFileAlignment] = {};
+	const int rowBytes = Surface::tileWidth() * sizeof(Pixel);
+	
+	for (auto iter = surface.begin(); iter != surface.end(); ++iter)
+	{
+		qint64 offset = alignedOffset(file.pos());
+		
+		if (offset != file.pos() && file.write(padding, offset - file.pos()) < 0)
+			return false;
+		
+		SurfaceFileIndexEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.x = iter.key().x();
+		entry.y = iter.key().y();
+		entry.codec = codec;
+		entry.offset = offset;
+		
+		if (codec == CodecCompressed)
+		{
+			QByteArray data = encodedTiles.value(iter.key());
+			if (file.write(data) != data.size())
+				return false;
+			
+			entry.length = data.size();
+		}
+		else
+		{
+			const Image &tile = iter.value();
+			
+			for (int y = 0; y < tile.height(); ++y)
+			{
+				const Pixel *row = tile.constScanline(y);
+				if (file.write(reinterpret_cast<const char *>(row), rowBytes) != rowBytes)
+					return false;
+			}
+			
+			entry.length = rawTileLength();
+		}
+		
+		index << entry;
+	}
+	
+	header.indexOffset = alignedOffset(file.pos());
+	
+	if (qint64(header.indexOffset) != file.pos() && file.write(padding, header.indexOffset - file.pos()) < 0)
+		return false;
+	
+	qint64 indexSize = index.size() * sizeof(SurfaceFileIndexEntry);
+	
+	if (file.write(reinterpret_cast<const char *>(index.constData()), indexSize) != indexSize)
+		return false;
+	
+	if (!file.seek(0) || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header))
+		return false;
+	
+	return file.commit();
+}
+
+bool SurfaceFile::open(const QString &filePath)
+{
+	close();
+	
+	d->file.setFileName(filePath);
+	if (!d->file.open(QIODevice::ReadOnly))
+		return false;
+	
+	d->mapSize = d->file.size();
+	
+	if (d->mapSize < qint64(sizeof(SurfaceFileHeader)) || !(d->map = d->file.map(0, d->mapSize)))
+	{
+		close();
+		return false;
+	}
+	
+	SurfaceFileHeader header;
+	memcpy(&header, d->map, sizeof(header));
+	
+	if (memcmp(header.magic, surfaceFileMagic, sizeof(header.magic))
+		|| header.version != surfaceFileVersion
+		|| header.byteOrderMark != surfaceFileByteOrderMark
+		|| header.tileWidth != quint32(Surface::tileWidth())
+		|| header.pixelSize != sizeof(Pixel)
+		|| header.tileCount > quint64(d->mapSize) / sizeof(SurfaceFileIndexEntry)
+		|| header.indexOffset > quint64(d->mapSize) - header.tileCount * sizeof(SurfaceFileIndexEntry))
+	{
+		close();
+		return false;
+	}
+	
+	d->index.reserve(header.tileCount);
+	
+	for (quint64 i = 0; i < header.tileCount; ++i)
+	{
+		SurfaceFileIndexEntry entry;
+		memcpy(&entry, d->map + header.indexOffset + i * sizeof(entry), sizeof(entry));
+		
+		if (entry.offset > quint64(d->mapSize) || entry.length > quint64(d->mapSize) - entry.offset)
+		{
+			close();
+			return false;
+		}
+		
+		d->index.insert(QPoint(entry.x, entry.y), entry);
+	}
+	
+	return true;
+}
+
+void SurfaceFile::close()
+{
+	{
+		QMutexLocker locker(&d->cacheMutex);
+		d->cache.clear();
+	}
+	
+	d->index.clear();
+	
+	if (d->map)
+	{
+		d->file.unmap(const_cast<uchar *>(d->map));
+		d->map = 0;
+	}
+	
+	d->mapSize = 0;
+	d->file.close();
+}
+
+bool SurfaceFile::isOpen() const
+{
+	return d->map;
+}
+
+int SurfaceFile::tileCount() const
+{
+	return d->index.size();
+}
+
+QPointSet SurfaceFile::keys() const
+{
+	return d->index.keys().toSet();
+}
+
+bool SurfaceFile::contains(const QPoint &key) const
+{
+	return d->index.contains(key);
+}
+
+Image SurfaceFile::tile(const QPoint &key) const
+{
+	auto entry = d->index.constFind(key);
+	if (entry == d->index.constEnd())
+		return Surface::defaultTile();
+	
+	{
+		QMutexLocker locker(&d->cacheMutex);
+		Image *cached = d->cache.object(key);
+		if (cached)
+			return *cached;
+	}
+	
+	// the pages of the payload are faulted in here for the first time
+	
+	Image tile;
+	
+	switch (entry->codec)
+	{
+		case CodecRaw:
+		{
+			if (qint64(entry->length) != rawTileLength())
+				return Surface::defaultTile();
+			
+			tile = Image(Surface::tileSize());
+			memcpy(tile.bits(), d->map + entry->offset, entry->length);
+			break;
+		}
+		case CodecCompressed:
+		{
+			// fromRawData does not copy the payload out of the map
+			tile = TileCodec::decode(QByteArray::fromRawData(reinterpret_cast<const char *>(d->map + entry->offset), entry->length));
+			if (!tile.isValid())
+				return Surface::defaultTile();
+			break;
+		}
+		default:
+			qWarning() << Q_FUNC_INFO << ": unknown codec" << entry->codec;
+			return Surface::defaultTile();
+	}
+	
+	QMutexLocker locker(&d->cacheMutex);
+	d->cache.insert(key, new Image(tile), tile.area() * int(sizeof(Pixel)));
+	return tile;
+}
+
+void SurfaceFile::setCacheSize(int bytes)
+{
+	QMutexLocker locker(&d->cacheMutex);
+	d->cache.setMaxCost(bytes);
+}
+
+int SurfaceFile::cacheSize() const
+{
+	QMutexLocker locker(&d->cacheMutex);
+	return d->cache.maxCost();
+}
+
+Surface SurfaceFile::toSurface() const
+{
+	Surface surface;
+	
+	for (auto iter = d->index.begin(); iter != d->index.end(); ++iter)
+		surface.setTile(iter.key(), tile(iter.key()));
+	
+	return surface;
+}
+
+}
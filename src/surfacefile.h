@@ -0,0 +1,93 @@
+#ifndef MLSURFACEFILE_H
+#define MLSURFACEFILE_H
+
+//ExportName: SurfaceFile
+
+#include "surface.h"
+
+namespace Malachite
+{
+
+/**
+ * Native tiled container of a Surface, laid out to be memory-mapped.
+ *
+ * The file consists of a header, the tile payloads aligned to 64 bytes and a tile index
+ * (key, codec, offset and length of each tile).
+ * Opening a file only maps it and reads the index;
+ * the pixels of a tile are read when the tile is first requested,
+ * so a viewport can be shown before the rest of a huge document is touched.
+ * Payloads are stored in the native byte order, which is recorded in the header.
+ */
+class MALACHITESHARED_EXPORT SurfaceFile
+{
+public:
+	
+	enum Codec
+	{
+		CodecRaw = 0,	///< the pixels as they are in memory
+		CodecCompressed = 1	///< the pixels encoded by TileCodec
+	};
+	
+	enum
+	{
+		DefaultCacheSize = 128 * 1024 * 1024
+	};
+	
+	SurfaceFile();
+	~SurfaceFile();
+	
+	/**
+	 * Writes a surface into a file.
+	 * The file is replaced only after the whole surface has been written.
+	 * @param surface
+	 * @param filePath
+	 * @param codec The codec of the tile payloads
+	 * @return false if failed
+	 */
+	static bool write(const Surface &surface, const QString &filePath, Codec codec = CodecRaw);
+	
+	/**
+	 * Maps a file and reads its index.
+	 * @param filePath
+	 * @return false if the file is not a valid surface file
+	 */
+	bool open(const QString &filePath);
+	
+	void close();
+	
+	bool isOpen() const;
+	
+	int tileCount() const;
+	QPointSet keys() const;
+	bool contains(const QPoint &key) const;
+	
+	/**
+	 * Reads a tile, which is cached until the cache exceeds its size.
+	 * This function is thread-safe.
+	 * @param key
+	 * @return The tile, or the default tile if the file does not contain it
+	 */
+	Image tile(const QPoint &key) const;
+	
+	/**
+	 * Sets the maximum size of the cached tiles in bytes; 0 disables the cache.
+	 * The default is DefaultCacheSize.
+	 */
+	void setCacheSize(int bytes);
+	int cacheSize() const;
+	
+	/**
+	 * Reads all tiles.
+	 * @return The surface
+	 */
+	Surface toSurface() const;
+	
+private:
+	
+	struct Data;
+	Data *d;
+};
+
+}
+
+#endif // MLSURFACEFILE_H
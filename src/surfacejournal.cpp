@@ -0,0 +1,621 @@
+#include <cstring>
+#include <zlib.h>
+#include <QFile>
+#include <QFuture>
+#include <QMutex>
+#include <QSaveFile>
+#include <QtConcurrentRun>
+#include "tilecodec.h"
+#include "surfacejournal.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Malachite
+{
+
+namespace
+{
+
+const char journalMagic[8] = { 'M', 'L', 'J', 'R', 'N', 'L', 0, 0 };
+constexpr quint32 journalVersion = 2;
+constexpr quint32 journalByteOrderMark = 0x01020304;
+
+constexpr qint64 minimumCompactionGarbage = 1 << 20;
+constexpr qint64 compactionCopyChunkSize = 1 << 20;
+
+// well above the largest tile TileCodec produces (stored planes plus their headers);
+// only a damaged record header claims more
+constexpr quint32 maximumTilePayloadSize = 2 * Surface::tileWidth() * Surface::tileWidth() * sizeof(Pixel);
+
+enum RecordType
+{
+	RecordTile = 1,
+	RecordTombstone = 2,
+	RecordCommit = 3
+};
+
+struct JournalFileHeader
+{
+	char magic[8];
+	quint32 version;
+	quint32 byteOrderMark;
+	quint32 tileWidth;
+	quint32 reserved[3];
+};
+
+struct JournalRecordHeader
+{
+	quint32 type;
+	qint32 x, y;
+	quint32 length;
+};
+
+static_assert(sizeof(JournalFileHeader) == 32, "the header must be packed");
+static_assert(sizeof(JournalRecordHeader) == 16, "record headers must be packed");
+
+struct JournalEntry
+{
+	qint64 offset = -1;	// of the record header
+	quint32 length = 0;	// of the payload
+	
+	qint64 recordSize() const { return sizeof(JournalRecordHeader) + qint64(length); }
+};
+
+JournalFileHeader makeHeader()
+{
+	JournalFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, journalMagic, sizeof(header.magic));
+	header.version = journalVersion;
+	header.byteOrderMark = journalByteOrderMark;
+	header.tileWidth = Surface::tileWidth();
+	return header;
+}
+
+/*
+ * Whether a record header can have been written by a save.
+ */
+bool isValidRecordHeader(const JournalRecordHeader &record)
+{
+	switch (record.type)
+	{
+		case RecordTile:
+			return record.length <= maximumTilePayloadSize;
+		case RecordTombstone:
+			return record.length == 0;
+		case RecordCommit:
+			return record.length == sizeof(quint32);
+		default:
+			return false;
+	}
+}
+
+quint32 updateChecksum(quint32 checksum, const char *data, qint64 size)
+{
+	return crc32(checksum, reinterpret_cast<const Bytef *>(data), size);
+}
+
+/*
+ * Writes a record and adds it to the checksum of the save it belongs to, if any.
+ */
+bool writeRecord(QIODevice *device, RecordType type, const QPoint &key, const QByteArray &payload, quint32 *checksum = 0)
+{
+	JournalRecordHeader header;
+	header.type = type;
+	header.x = key.x();
+	header.y = key.y();
+	header.length = payload.size();
+	
+	if (checksum)
+	{
+		*checksum = updateChecksum(*checksum, reinterpret_cast<const char *>(&header), sizeof(header));
+		*checksum = updateChecksum(*checksum, payload.constData(), payload.size());
+	}
+	
+	return device->write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header)
+		&& device->write(payload) == payload.size();
+}
+
+/*
+ * The commit record carries the checksum of the records of its save.
+ */
+bool writeCommitRecord(QIODevice *device, quint32 checksum)
+{
+	return writeRecord(device, RecordCommit, QPoint(), QByteArray(reinterpret_cast<const char *>(&checksum), sizeof(checksum)));
+}
+
+/*
+ * Flushes a file and waits until the data is on the disk.
+ */
+bool syncFile(QFile *file)
+{
+	if (!file->flush())
+		return false;
+	
+#ifdef Q_OS_WIN
+	return _commit(file->handle()) == 0;
+#else
+	return fsync(file->handle()) == 0;
+#endif
+}
+
+}
+
+struct SurfaceJournal::Data
+{
+	// the file and the index are shared with the compaction
+	QFile file;
+	mutable QMutex mutex;
+	QHash<QPoint, JournalEntry> index;
+	qint64 committedEnd = 0;
+	qint64 liveSize = 0;
+	
+	// the tiles as they were last saved or loaded, to find the changed ones
+	QHash<QPoint, Image> savedTiles;
+	
+	double compactionThreshold = 0.5;
+	QFuture<bool> compaction;
+	
+	void insertEntry(const QPoint &key, const JournalEntry &entry)
+	{
+		removeEntry(key);
+		index.insert(key, entry);
+		liveSize += entry.recordSize();
+	}
+	
+	void removeEntry(const QPoint &key)
+	{
+		auto iter = index.find(key);
+		if (iter != index.end())
+		{
+			liveSize -= iter->recordSize();
+			index.erase(iter);
+		}
+	}
+	
+	qint64 garbageSize() const
+	{
+		return file.isOpen() ? committedEnd - qint64(sizeof(JournalFileHeader)) - liveSize : 0;
+	}
+	
+	bool compact();
+};
+
+bool SurfaceJournal::Data::compact()
+{
+	QHash<QPoint, JournalEntry> snapshot;
+	qint64 snapshotEnd;
+	QString filePath;
+	
+	{
+		QMutexLocker locker(&mutex);
+		if (!file.isOpen())
+			return false;
+		
+		snapshot = index;
+		snapshotEnd = committedEnd;
+		filePath = file.fileName();
+	}
+	
+	// saves only append to the journal while the live records are copied
+	
+	QFile source(filePath);
+	if (!source.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+		return false;
+	
+	QSaveFile target(filePath);
+	if (!target.open(QIODevice::WriteOnly))
+		return false;
+	
+	JournalFileHeader header = makeHeader();
+	if (target.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header))
+		return false;
+	
+	QHash<QPoint, qint64> offsets;
+	offsets.reserve(snapshot.size());
+	
+	quint32 checksum = 0;
+	
+	for (auto iter = snapshot.begin(); iter != snapshot.end(); ++iter)
+	{
+		QByteArray record;
+		if (source.seek(iter->offset))
+			record = source.read(iter->recordSize());
+		
+		if (record.size() != iter->recordSize())
+			return false;
+		
+		offsets.insert(iter.key(), target.pos());
+		checksum = updateChecksum(checksum, record.constData(), record.size());
+		
+		if (target.write(record) != record.size())
+			return false;
+	}
+	
+	if (!writeCommitRecord(&target, checksum))
+		return false;
+	
+	QMutexLocker locker(&mutex);
+	
+	// the saves made in the meantime are copied as they are
+	
+	qint64 tailStart = target.pos();
+	
+	if (!source.seek(snapshotEnd))
+		return false;
+	
+	for (qint64 remaining = committedEnd - snapshotEnd; remaining > 0;)
+	{
+		QByteArray chunk = source.read(qMin(remaining, compactionCopyChunkSize));
+		if (chunk.isEmpty() || target.write(chunk) != chunk.size())
+			return false;
+		
+		remaining -= chunk.size();
+	}
+	
+	if (!target.commit())
+		return false;
+	
+	file.close();
+	
+	if (!file.open(QIODevice::ReadWrite))
+	{
+		index.clear();
+		liveSize = 0;
+		committedEnd = 0;
+		return false;
+	}
+	
+	qint64 delta = tailStart - snapshotEnd;
+	
+	for (auto iter = index.begin(); iter != index.end(); ++iter)
+		iter->offset = iter->offset >= snapshotEnd ? iter->offset + delta : offsets.value(iter.key());
+	
+	committedEnd += delta;
+	return true;
+}
+
+SurfaceJournal::SurfaceJournal() :
+	d(new Data)
+{}
+
+SurfaceJournal::~SurfaceJournal()
+{
+	close();
+	delete d;
+}
+
+bool SurfaceJournal::open(const QString &filePath)
+{
+	close();
+	
+	QMutexLocker locker(&d->mutex);
+	
+	d->file.setFileName(filePath);
+	if (!d->file.open(QIODevice::ReadWrite))
+		return false;
+	
+	qint64 fileSize = d->file.size();
+	
+	if (fileSize == 0)
+	{
+		JournalFileHeader header = makeHeader();
+		
+		if (d->file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header) || !syncFile(&d->file))
+		{
+			d->file.close();
+			return false;
+		}
+		
+		d->committedEnd = sizeof(header);
+		return true;
+	}
+	
+	JournalFileHeader header;
+	
+	if (d->file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+		|| memcmp(header.magic, journalMagic, sizeof(header.magic))
+		|| header.version != journalVersion
+		|| header.byteOrderMark != journalByteOrderMark
+		|| header.tileWidth != quint32(Surface::tileWidth()))
+	{
+		d->file.close();
+		return false;
+	}
+	
+	// the changes of a save are applied at its commit if the checksum of its records matches
+	
+	qint64 pos = sizeof(header);
+	d->committedEnd = pos;
+	
+	QHash<QPoint, JournalEntry> pending;
+	quint32 checksum = 0;
+	bool corrupted = false;
+	
+	auto fail = [&]()
+	{
+		d->file.close();
+		d->index.clear();
+		d->liveSize = 0;
+		d->committedEnd = 0;
+		return false;
+	};
+	
+	forever
+	{
+		// a short header or a valid record cut off by the end of the file is a torn save
+		
+		JournalRecordHeader record;
+		if (d->file.read(reinterpret_cast<char *>(&record), sizeof(record)) != sizeof(record))
+			break;
+		
+		if (!isValidRecordHeader(record))
+		{
+			corrupted = true;
+			break;
+		}
+		
+		JournalEntry entry;
+		entry.offset = pos;
+		entry.length = record.length;
+		
+		if (entry.recordSize() > fileSize - pos)
+			break;
+		
+		QByteArray payload = d->file.read(record.length);
+		if (payload.size() != int(record.length))
+			break;
+		
+		QPoint key(record.x, record.y);
+		
+		if (record.type == RecordCommit)
+		{
+			quint32 expected;
+			memcpy(&expected, payload.constData(), sizeof(expected));
+			
+			if (expected != checksum)
+			{
+				corrupted = true;
+				break;
+			}
+			
+			for (auto iter = pending.begin(); iter != pending.end(); ++iter)
+			{
+				if (iter->offset >= 0)
+					d->insertEntry(iter.key(), iter.value());
+				else
+					d->removeEntry(iter.key());
+			}
+			
+			pending.clear();
+			checksum = 0;
+			d->committedEnd = pos + entry.recordSize();
+		}
+		else
+		{
+			checksum = updateChecksum(checksum, reinterpret_cast<const char *>(&record), sizeof(record));
+			checksum = updateChecksum(checksum, payload.constData(), payload.size());
+			pending.insert(key, record.type == RecordTile ? entry : JournalEntry());
+		}
+		
+		pos += entry.recordSize();
+	}
+	
+	// the records of a save are on the disk before its commit record is written,
+	// so a damaged record or commit followed by more than a commit record is damage, not a torn save
+	if (corrupted && fileSize - pos > qint64(sizeof(JournalRecordHeader) + sizeof(quint32)))
+		return fail();
+	
+	// discard a torn save
+	if (d->committedEnd < fileSize && !d->file.resize(d->committedEnd))
+		return fail();
+	
+	return true;
+}
+
+void SurfaceJournal::close()
+{
+	d->compaction.waitForFinished();
+	
+	QMutexLocker locker(&d->mutex);
+	
+	d->file.close();
+	d->index.clear();
+	d->savedTiles.clear();
+	d->committedEnd = 0;
+	d->liveSize = 0;
+}
+
+bool SurfaceJournal::isOpen() const
+{
+	QMutexLocker locker(&d->mutex);
+	return d->file.isOpen();
+}
+
+bool SurfaceJournal::save(const Surface &surface)
+{
+	if (!isOpen())
+		return false;
+	
+	// tiles are implicitly shared, so an unmodified tile still shares its data with the saved one
+	
+	Surface changedTiles;
+	
+	for (auto iter = surface.begin(); iter != surface.end(); ++iter)
+	{
+		auto saved = d->savedTiles.constFind(iter.key());
+		if (saved == d->savedTiles.constEnd() || !saved->referenceIsEqualTo(iter.value()))
+			changedTiles.setTile(iter.key(), iter.value());
+	}
+	
+	QList<QPoint> removedKeys;
+	
+	{
+		QMutexLocker locker(&d->mutex);
+		
+		for (auto iter = d->index.begin(); iter != d->index.end(); ++iter)
+		{
+			if (!surface.contains(iter.key()))
+				removedKeys << iter.key();
+		}
+	}
+	
+	if (changedTiles.isEmpty() && removedKeys.isEmpty())
+		return true;
+	
+	auto encodedTiles = TileCodec::encodeSurface(changedTiles);
+	
+	{
+		QMutexLocker locker(&d->mutex);
+		
+		if (!d->file.isOpen() || !d->file.seek(d->committedEnd))
+			return false;
+		
+		QHash<QPoint, JournalEntry> entries;
+		quint32 checksum = 0;
+		bool ok = true;
+		
+		for (auto iter = encodedTiles.begin(); ok && iter != encodedTiles.end(); ++iter)
+		{
+			JournalEntry entry;
+			entry.offset = d->file.pos();
+			entry.length = iter.value().size();
+			entries.insert(iter.key(), entry);
+			
+			ok = writeRecord(&d->file, RecordTile, iter.key(), iter.value(), &checksum);
+		}
+		
+		for (int i = 0; ok && i < removedKeys.size(); ++i)
+			ok = writeRecord(&d->file, RecordTombstone, removedKeys.at(i), QByteArray(), &checksum);
+		
+		// the records must reach the disk before the commit which validates them
+		ok = ok && syncFile(&d->file) && writeCommitRecord(&d->file, checksum) && syncFile(&d->file);
+		
+		if (!ok)
+		{
+			d->file.resize(d->committedEnd);
+			return false;
+		}
+		
+		d->committedEnd = d->file.pos();
+		
+		for (const QPoint &key : removedKeys)
+			d->removeEntry(key);
+		
+		for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+			d->insertEntry(iter.key(), iter.value());
+	}
+	
+	for (const QPoint &key : removedKeys)
+		d->savedTiles.remove(key);
+	
+	for (auto iter = changedTiles.begin(); iter != changedTiles.end(); ++iter)
+		d->savedTiles.insert(iter.key(), iter.value());
+	
+	if (!d->compaction.isRunning())
+	{
+		bool needsCompaction;
+		
+		{
+			QMutexLocker locker(&d->mutex);
+			qint64 garbage = d->garbageSize();
+			needsCompaction = garbage >= minimumCompactionGarbage && garbage > d->compactionThreshold * d->committedEnd;
+		}
+		
+		if (needsCompaction)
+		{
+			Data *data = d;
+			d->compaction = QtConcurrent::run([data]() -> bool { return data->compact(); });
+		}
+	}
+	
+	return true;
+}
+
+Surface SurfaceJournal::load(bool *ok)
+{
+	QHash<QPoint, QByteArray> encodedTiles;
+	bool succeeded = true;
+	
+	{
+		QMutexLocker locker(&d->mutex);
+		
+		succeeded = d->file.isOpen();
+		encodedTiles.reserve(d->index.size());
+		
+		for (auto iter = d->index.begin(); iter != d->index.end(); ++iter)
+		{
+			QByteArray data;
+			if (d->file.seek(iter->offset + qint64(sizeof(JournalRecordHeader))))
+				data = d->file.read(iter->length);
+			
+			if (data.size() == int(iter->length))
+				encodedTiles.insert(iter.key(), data);
+			else
+				succeeded = false;
+		}
+	}
+	
+	bool decoded;
+	Surface surface = TileCodec::decodeSurface(encodedTiles, &decoded);
+	
+	d->savedTiles.clear();
+	
+	for (auto iter = surface.begin(); iter != surface.end(); ++iter)
+		d->savedTiles.insert(iter.key(), iter.value());
+	
+	if (ok)
+		*ok = succeeded && decoded;
+	
+	return surface;
+}
+
+int SurfaceJournal::tileCount() const
+{
+	QMutexLocker locker(&d->mutex);
+	return d->index.size();
+}
+
+qint64 SurfaceJournal::fileSize() const
+{
+	QMutexLocker locker(&d->mutex);
+	return d->committedEnd;
+}
+
+qint64 SurfaceJournal::garbageSize() const
+{
+	QMutexLocker locker(&d->mutex);
+	return d->garbageSize();
+}
+
+void SurfaceJournal::setCompactionThreshold(double threshold)
+{
+	d->compactionThreshold = threshold;
+}
+
+double SurfaceJournal::compactionThreshold() const
+{
+	return d->compactionThreshold;
+}
+
+bool SurfaceJournal::compact()
+{
+	waitForCompaction();
+	return d->compact();
+}
+
+bool SurfaceJournal::isCompacting() const
+{
+	return d->compaction.isRunning();
+}
+
+void SurfaceJournal::waitForCompaction()
+{
+	d->compaction.waitForFinished();
+}
+
+}
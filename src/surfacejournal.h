@@ -0,0 +1,99 @@
+#ifndef MLSURFACEJOURNAL_H
+#define MLSURFACEJOURNAL_H
+
+//ExportName: SurfaceJournal
+
+#include "surface.h"
+
+namespace Malachite
+{
+
+/**
+ * Append-only journal of a Surface for incremental saves.
+ *
+ * Each save appends the tiles that changed since the previous save (compressed with TileCodec),
+ * tombstones for the removed tiles and a commit record, so the cost of a save scales with the edit volume.
+ * A tile is regarded as changed when it no longer shares its data with the tile that was last saved or loaded.
+ * The journal keeps a reference to each of those tiles, so editing a tile after a save detaches it
+ * and the previous version of each edited tile stays in memory until the next save.
+ *
+ * A save is synced to the disk before and after its commit record, which carries a CRC-32 of the save's records.
+ * Records after the last commit (a torn save) are discarded when the journal is opened;
+ * a checksum mismatch or a damaged record header anywhere else makes open() fail without changing the file.
+ *
+ * When the superseded records exceed a fraction of the file,
+ * the journal is compacted in the background into a temporary file which then replaces it.
+ */
+class MALACHITESHARED_EXPORT SurfaceJournal
+{
+public:
+	
+	SurfaceJournal();
+	~SurfaceJournal();
+	
+	/**
+	 * Opens a journal, creating it if it does not exist, and reads its index.
+	 * The whole file is read once to verify the checksums.
+	 * @param filePath
+	 * @return false if the file is not a valid journal or is damaged
+	 */
+	bool open(const QString &filePath);
+	
+	/**
+	 * Waits for the compaction and closes the journal.
+	 */
+	void close();
+	
+	bool isOpen() const;
+	
+	/**
+	 * Appends the changes of a surface since the last save or load.
+	 * @param surface
+	 * @return false if failed
+	 */
+	bool save(const Surface &surface);
+	
+	/**
+	 * Reads the latest version of all tiles.
+	 * @param ok Set to false if any tile could not be read
+	 * @return The surface
+	 */
+	Surface load(bool *ok = 0);
+	
+	int tileCount() const;
+	
+	/**
+	 * @return The size of the committed part of the file
+	 */
+	qint64 fileSize() const;
+	
+	/**
+	 * @return The size of the records which have been superseded
+	 */
+	qint64 garbageSize() const;
+	
+	/**
+	 * Sets the fraction of garbage in the file above which the journal is compacted after a save.
+	 * The default is 0.5.
+	 */
+	void setCompactionThreshold(double threshold);
+	double compactionThreshold() const;
+	
+	/**
+	 * Compacts the journal now.
+	 * @return false if failed
+	 */
+	bool compact();
+	
+	bool isCompacting() const;
+	void waitForCompaction();
+	
+private:
+	
+	struct Data;
+	Data *d;
+};
+
+}
+
+#endif // MLSURFACEJOURNAL_H
@@ -9,6 +9,7 @@ void SurfaceSelection::setPath(const QPainterPath &path)
 	_type = TypePath;
 	_path = path;
 	_surface = Surface();
+	_mask = MaskSurface();
 }
 
 void SurfaceSelection::setSurface(const Surface &surface)
@@ -16,6 +17,15 @@ void SurfaceSelection::setSurface(const Surface &surface)
 	_type = TypeSurface;
 	_path = QPainterPath();
 	_surface = surface;
+	_mask = MaskSurface();
+}
+
+void SurfaceSelection::setMask(const MaskSurface &mask)
+{
+	_type = TypeMask;
+	_path = QPainterPath();
+	_surface = Surface();
+	_mask = mask;
 }
 
 Surface SurfaceSelection::clip(const Surface &surface) const
@@ -23,6 +33,9 @@ Surface SurfaceSelection::clip(const Surface &surface) const
 	if (_type == TypeWhole)
 		return surface;
 	
+	if (_type == TypeMask)
+		return clipWithMask(surface);
+	
 	Surface result = surface;
 	SurfacePainter painter(&result);
 	painter.setBlendMode(BlendMode::DestinationIn);
@@ -44,4 +57,28 @@ Surface SurfaceSelection::clip(const Surface &surface) const
 	return result;
 }
 
+Surface SurfaceSelection::clipWithMask(const Surface &surface) const
+{
+	Surface result = surface;
+	BlendOp *op = BlendMode(BlendMode::DestinationIn).op();
+	
+	for (const QPoint &key : surface.keyList())
+	{
+		const MaskImage *maskTile = _mask.tilePointer(key);
+		
+		if (!maskTile)
+		{
+			result.remove(key);
+			continue;
+		}
+		
+		Image &tile = result.tileRef(key);
+		
+		for (int y = 0; y < Surface::tileWidth(); ++y)
+			op->blend(Surface::tileWidth(), tile.scanline(y), Pixel(1.f), maskTile->constScanline(y));
+	}
+	
+	return result;
+}
+
 }
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cstring>
+#include <QtConcurrentMap>
+#include <QtEndian>
+#include "tilecodec.h"
+
+namespace Malachite
+{
+
+namespace
+{
+
+constexpr int tileWidth = Surface::tileWidth();
+constexpr int tileArea = tileWidth * tileWidth;
+
+constexpr int probabilityBits = 12;
+constexpr uint32_t probabilityScale = 1 << probabilityBits;
+constexpr uint32_t ransLowerBound = 1 << 23;
+
+// the symbol counts of a byte plane are used as the frequencies without normalization
+static_assert(tileArea == probabilityScale, "a byte plane must have as many symbols as the probability scale");
+
+enum TileType
+{
+	TileUniform,
+	TilePredicted
+};
+
+enum Predictor
+{
+	PredictorLeft,
+	PredictorUp,
+	PredictorMedian,	// the median edge detector of LOCO-I
+	PredictorCount
+};
+
+enum PlaneMode
+{
+	PlaneRaw,
+	PlaneConstant,
+	PlaneRans
+};
+
+class ByteReader
+{
+public:
+	
+	ByteReader(const QByteArray &data) :
+		_p(reinterpret_cast<const uint8_t *>(data.constData())),
+		_end(_p + data.size())
+	{}
+	
+	bool isOk() const { return _ok; }
+	bool atEnd() const { return _p == _end; }
+	
+	const uint8_t *read(uint32_t count)
+	{
+		// compared unsigned so that a corrupted length never reads past the end
+		if (!_ok || size_t(_end - _p) < count)
+		{
+			_ok = false;
+			return 0;
+		}
+		
+		auto p = _p;
+		_p += count;
+		return p;
+	}
+	
+	uint8_t readByte()
+	{
+		auto p = read(1);
+		return p ? *p : 0;
+	}
+	
+	uint32_t readDword()
+	{
+		auto p = read(4);
+		return p ? qFromLittleEndian<quint32>(p) : 0;
+	}
+	
+	uint32_t readVarint()
+	{
+		uint32_t x = 0;
+		
+		for (int shift = 0; shift < 32; shift += 7)
+		{
+			uint8_t byte = readByte();
+			x |= uint32_t(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return x;
+		}
+		
+		_ok = false;
+		return 0;
+	}
+	
+private:
+	
+	const uint8_t *_p, *_end;
+	bool _ok = true;
+};
+
+void appendDword(QByteArray &out, uint32_t x)
+{
+	uchar bytes[4];
+	qToLittleEndian<quint32>(x, bytes);
+	out.append(reinterpret_cast<const char *>(bytes), 4);
+}
+
+void appendVarint(QByteArray &out, uint32_t x)
+{
+	while (x >= 0x80)
+	{
+		out.append(char(x | 0x80));
+		x >>= 7;
+	}
+	out.append(char(x));
+}
+
+inline uint32_t zigzag(uint32_t d)
+{
+	return (d << 1) ^ uint32_t(int32_t(d) >> 31);
+}
+
+inline uint32_t unzigzag(uint32_t z)
+{
+	return (z >> 1) ^ (0u - (z & 1));
+}
+
+// predicts a value of a plane of float bit patterns from the values already coded
+inline uint32_t predict(int predictor, const uint32_t *plane, int x, int y)
+{
+	const uint32_t *p = plane + y * tileWidth + x;
+	
+	if (y == 0)
+		return x ? p[-1] : 0;
+	if (x == 0)
+		return p[-tileWidth];
+	
+	uint32_t a = p[-1], b = p[-tileWidth], c = p[-tileWidth - 1];
+	
+	switch (predictor)
+	{
+		case PredictorLeft:
+			return a;
+		case PredictorUp:
+			return b;
+		default:
+		{
+			uint32_t lo = qMin(a, b), hi = qMax(a, b);
+			if (c >= hi)
+				return lo;
+			if (c <= lo)
+				return hi;
+			return a + b - c;
+		}
+	}
+}
+
+// the bit length of a residual, used to choose the predictor
+inline int residualCost(uint32_t z)
+{
+	return 32 - __builtin_clz(z | 1);
+}
+
+/*
+ * Order-0 rANS with a 32bit state and byte-wise renormalization.
+ * The frequency table is written as a bitmap of the present symbols followed by their frequencies.
+ */
+bool ransEncode(QByteArray &out, const uint8_t *bytes, const uint32_t *counts)
+{
+	uint32_t starts[256];
+	uint8_t present[32] = {};
+	uint32_t start = 0;
+	
+	for (int s = 0; s < 256; ++s)
+	{
+		starts[s] = start;
+		start += counts[s];
+		if (counts[s])
+			present[s >> 3] |= 1 << (s & 7);
+	}
+	
+	// 12 bits per symbol at most, so the payload fits in twice the plane
+	uint8_t buffer[tileArea * 2 + 4];
+	uint8_t *p = buffer + sizeof(buffer);
+	
+	uint32_t x = ransLowerBound;
+	
+	for (int i = tileArea - 1; i >= 0; --i)
+	{
+		uint32_t freq = counts[bytes[i]];
+		uint32_t xMax = ((ransLowerBound >> probabilityBits) << 8) * freq;
+		
+		while (x >= xMax)
+		{
+			*--p = x & 0xFF;
+			x >>= 8;
+		}
+		
+		x = ((x / freq) << probabilityBits) + (x % freq) + starts[bytes[i]];
+		
+		if (buffer + sizeof(buffer) - p >= tileArea)
+			return false;	// no smaller than the raw plane
+	}
+	
+	p -= 4;
+	qToLittleEndian<quint32>(x, p);
+	
+	int payloadSize = buffer + sizeof(buffer) - p;
+	
+	out.append(char(PlaneRans));
+	out.append(reinterpret_cast<const char *>(present), sizeof(present));
+	
+	for (int s = 0; s < 256; ++s)
+	{
+		if (counts[s])
+			appendVarint(out, counts[s]);
+	}
+	
+	appendDword(out, payloadSize);
+	out.append(reinterpret_cast<const char *>(p), payloadSize);
+	return true;
+}
+
+bool ransDecode(ByteReader &reader, uint8_t *bytes)
+{
+	const uint8_t *present = reader.read(32);
+	if (!present)
+		return false;
+	
+	uint32_t freqs[256], starts[256];
+	uint8_t symbols[probabilityScale];
+	uint32_t start = 0;
+	
+	for (int s = 0; s < 256; ++s)
+	{
+		freqs[s] = (present[s >> 3] & (1 << (s & 7))) ? reader.readVarint() : 0;
+		starts[s] = start;
+		
+		if (freqs[s] > probabilityScale - start)
+			return false;
+		
+		memset(symbols + start, s, freqs[s]);
+		start += freqs[s];
+	}
+	
+	if (start != probabilityScale)
+		return false;
+	
+	uint32_t payloadSize = reader.readDword();
+	const uint8_t *p = reader.read(payloadSize);
+	if (!p || payloadSize < 4)
+		return false;
+	
+	const uint8_t *end = p + payloadSize;
+	uint32_t x = qFromLittleEndian<quint32>(p);
+	p += 4;
+	
+	for (int i = 0; i < tileArea; ++i)
+	{
+		uint32_t slot = x & (probabilityScale - 1);
+		uint8_t s = symbols[slot];
+		bytes[i] = s;
+		x = freqs[s] * (x >> probabilityBits) + slot - starts[s];
+		
+		while (x < ransLowerBound)
+		{
+			if (p == end)
+				return false;
+			x = (x << 8) | *p++;
+		}
+	}
+	
+	return p == end;
+}
+
+void encodeBytePlane(QByteArray &out, const uint8_t *bytes)
+{
+	uint32_t counts[256] = {};
+	
+	for (int i = 0; i < tileArea; ++i)
+		counts[bytes[i]]++;
+	
+	if (counts[bytes[0]] == uint32_t(tileArea))
+	{
+		out.append(char(PlaneConstant));
+		out.append(char(bytes[0]));
+		return;
+	}
+	
+	if (!ransEncode(out, bytes, counts))
+	{
+		out.append(char(PlaneRaw));
+		out.append(reinterpret_cast<const char *>(bytes), tileArea);
+	}
+}
+
+bool decodeBytePlane(ByteReader &reader, uint8_t *bytes)
+{
+	switch (reader.readByte())
+	{
+		case PlaneRaw:
+		{
+			const uint8_t *p = reader.read(tileArea);
+			if (!p)
+				return false;
+			memcpy(bytes, p, tileArea);
+			return true;
+		}
+		case PlaneConstant:
+		{
+			uint8_t value = reader.readByte();
+			memset(bytes, value, tileArea);
+			return reader.isOk();
+		}
+		case PlaneRans:
+			return ransDecode(reader, bytes);
+		default:
+			return false;
+	}
+}
+
+void encodeChannel(QByteArray &out, const uint32_t *plane)
+{
+	uint64_t costs[PredictorCount] = {};
+	
+	for (int y = 0; y < tileWidth; ++y)
+	{
+		for (int x = 0; x < tileWidth; ++x)
+		{
+			uint32_t value = plane[y * tileWidth + x];
+			
+			for (int predictor = 0; predictor < PredictorCount; ++predictor)
+				costs[predictor] += residualCost(zigzag(value - predict(predictor, plane, x, y)));
+		}
+	}
+	
+	int predictor = std::min_element(costs, costs + PredictorCount) - costs;
+	out.append(char(predictor));
+	
+	uint32_t residuals[tileArea];
+	
+	for (int y = 0; y < tileWidth; ++y)
+	{
+		for (int x = 0; x < tileWidth; ++x)
+		{
+			int i = y * tileWidth + x;
+			residuals[i] = zigzag(plane[i] - predict(predictor, plane, x, y));
+		}
+	}
+	
+	// the high bytes of small residuals are mostly zero and compress well on their own
+	uint8_t bytes[tileArea];
+	
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		for (int i = 0; i < tileArea; ++i)
+			bytes[i] = residuals[i] >> shift;
+		
+		encodeBytePlane(out, bytes);
+	}
+}
+
+bool decodeChannel(ByteReader &reader, uint32_t *plane)
+{
+	int predictor = reader.readByte();
+	if (!reader.isOk() || predictor >= PredictorCount)
+		return false;
+	
+	uint32_t residuals[tileArea] = {};
+	uint8_t bytes[tileArea];
+	
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		if (!decodeBytePlane(reader, bytes))
+			return false;
+		
+		for (int i = 0; i < tileArea; ++i)
+			residuals[i] |= uint32_t(bytes[i]) << shift;
+	}
+	
+	for (int y = 0; y < tileWidth; ++y)
+	{
+		for (int x = 0; x < tileWidth; ++x)
+		{
+			int i = y * tileWidth + x;
+			plane[i] = unzigzag(residuals[i]) + predict(predictor, plane, x, y);
+		}
+	}
+	
+	return true;
+}
+
+}
+
+QByteArray TileCodec::encode(const Image &tile)
+{
+	if (tile.size() != Surface::tileSize())
+		return QByteArray();
+	
+	// the channels of a pixel as 32bit patterns
+	uint32_t channels[tileArea * 4];
+	
+	for (int y = 0; y < tileWidth; ++y)
+	{
+		const Pixel *row = tile.constScanline(y);
+		memcpy(channels + y * tileWidth * 4, row, tileWidth * sizeof(Pixel));
+	}
+	
+	QByteArray out;
+	
+	bool uniform = true;
+	
+	for (int i = 1; i < tileArea && uniform; ++i)
+		uniform = !memcmp(channels + i * 4, channels, 16);
+	
+	if (uniform)
+	{
+		out.append(char(TileUniform));
+		for (int c = 0; c < 4; ++c)
+			appendDword(out, channels[c]);
+		return out;
+	}
+	
+	out.append(char(TilePredicted));
+	
+	uint32_t plane[tileArea];
+	
+	for (int c = 0; c < 4; ++c)
+	{
+		for (int i = 0; i < tileArea; ++i)
+			plane[i] = channels[i * 4 + c];
+		
+		encodeChannel(out, plane);
+	}
+	
+	return out;
+}
+
+Image TileCodec::decode(const QByteArray &data)
+{
+	ByteReader reader(data);
+	Image tile(Surface::tileSize());
+	
+	switch (reader.readByte())
+	{
+		case TileUniform:
+		{
+			uint32_t channels[4];
+			for (int c = 0; c < 4; ++c)
+				channels[c] = reader.readDword();
+			
+			Pixel pixel;
+			memcpy(&pixel, channels, sizeof(pixel));
+			tile.fill(pixel);
+			break;
+		}
+		case TilePredicted:
+		{
+			uint32_t plane[tileArea];
+			float *dst = reinterpret_cast<float *>(static_cast<Pixel *>(tile.bits()));
+			
+			for (int c = 0; c < 4; ++c)
+			{
+				if (!decodeChannel(reader, plane))
+					return Image();
+				
+				for (int i = 0; i < tileArea; ++i)
+					memcpy(dst + i * 4 + c, plane + i, 4);
+			}
+			break;
+		}
+		default:
+			return Image();
+	}
+	
+	if (!reader.isOk() || !reader.atEnd())
+		return Image();
+	
+	return tile;
+}
+
+QHash<QPoint, QByteArray> TileCodec::encodeSurface(const Surface &surface)
+{
+	typedef QPair<QPoint, QByteArray> Job;
+	
+	QVector<Job> jobs;
+	jobs.reserve(surface.tileCount());
+	
+	for (auto iter = surface.begin(); iter != surface.end(); ++iter)
+		jobs << Job(iter.key(), QByteArray());
+	
+	QtConcurrent::blockingMap(jobs, [&](Job &job)
+	{
+		job.second = encode(surface.tile(job.first));
+	});
+	
+	QHash<QPoint, QByteArray> result;
+	result.reserve(jobs.size());
+	
+	for (const Job &job : jobs)
+		result.insert(job.first, job.second);
+	
+	return result;
+}
+
+Surface TileCodec::decodeSurface(const QHash<QPoint, QByteArray> &tiles, bool *ok)
+{
+	typedef QPair<QPoint, Image> Job;
+	
+	QVector<Job> jobs;
+	jobs.reserve(tiles.size());
+	
+	for (auto iter = tiles.begin(); iter != tiles.end(); ++iter)
+		jobs << Job(iter.key(), Image());
+	
+	QtConcurrent::blockingMap(jobs, [&](Job &job)
+	{
+		job.second = decode(tiles.value(job.first));
+	});
+	
+	Surface surface;
+	bool succeeded = true;
+	
+	for (const Job &job : jobs)
+	{
+		if (job.second.isValid())
+			surface.setTile(job.first, job.second);
+		else
+			succeeded = false;
+	}
+	
+	if (ok)
+		*ok = succeeded;
+	
+	return surface;
+}
+
+}
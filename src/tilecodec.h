@@ -0,0 +1,55 @@
+#ifndef MLTILECODEC_H
+#define MLTILECODEC_H
+
+//ExportName: TileCodec
+
+#include <QByteArray>
+#include "surface.h"
+
+namespace Malachite
+{
+
+/**
+ * Lossless compression of surface tiles for persistence.
+ *
+ * A tile whose pixels are all the same is stored as a single pixel.
+ * Otherwise each channel is split into a plane of 32bit float bit patterns,
+ * predicted from its neighbours (the predictor is chosen per plane),
+ * and the zigzagged residuals are shuffled into byte planes,
+ * each of which is coded with an order-0 rANS coder or stored as it is.
+ * The encoded data is little-endian on every host.
+ */
+class MALACHITESHARED_EXPORT TileCodec
+{
+public:
+	
+	/**
+	 * Encodes a tile.
+	 * @param tile A tile of Surface::tileSize()
+	 * @return The encoded data, or an empty array if the tile has a wrong size
+	 */
+	static QByteArray encode(const Image &tile);
+	
+	/**
+	 * Decodes a tile.
+	 * @param data
+	 * @return The tile, or an invalid image if the data is corrupt
+	 */
+	static Image decode(const QByteArray &data);
+	
+	/**
+	 * Encodes all tiles of a surface in parallel.
+	 */
+	static QHash<QPoint, QByteArray> encodeSurface(const Surface &surface);
+	
+	/**
+	 * Decodes tiles into a surface in parallel.
+	 * @param tiles
+	 * @param ok Set to false if any tile is corrupt
+	 */
+	static Surface decodeSurface(const QHash<QPoint, QByteArray> &tiles, bool *ok = 0);
+};
+
+}
+
+#endif // MLTILECODEC_H
@@ -1,10 +1,28 @@
 #include <QTest>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
 #include <Malachite/BlendMode>
+#include <Malachite/BlendOp>
+#include <Malachite/CurveSubdivision>
+#include <Malachite/ImageIO>
+#include <Malachite/PixelConversion>
+#include <Malachite/PolygonStroker>
+#include <Malachite/SurfaceFile>
+#include <Malachite/SurfaceJournal>
+#include <Malachite/SurfacePainter>
+#include <Malachite/SurfaceSelection>
+#include <Malachite/TileCodec>
+#include <functional>
 #include <random>
 #include <boost/range.hpp>
 
 #include "test.h"
+#include "../src/private/gradientgenerator.h"
 
 using namespace Malachite;
 
@@ -364,4 +382,2274 @@ void Test::test_blend()
 	}
 }
 
+void Test::test_curveSubdivision()
+{
+	constexpr double tolerance = 0.25;
+	
+	auto curvePoint = [](const Curve4 &curve, double t) -> Vec2D
+	{
+		double s = 1.0 - t;
+		return s * s * s * curve.start + 3.0 * s * s * t * curve.control1 + 3.0 * s * t * t * curve.control2 + t * t * t * curve.end;
+	};
+	
+	auto distance = [](const Vec2D &a, const Vec2D &b)
+	{
+		Vec2D d = a - b;
+		return d.length();
+	};
+	
+	const Curve4 sCurve(Vec2D(0, 0), Vec2D(100, 300), Vec2D(300, -200), Vec2D(400, 100));
+	const Curve4 loop(Vec2D(10, 10), Vec2D(500, 400), Vec2D(-300, 400), Vec2D(200, 10));
+	const Curve4 point(Vec2D(10, 10), Vec2D(10, 10), Vec2D(10, 10), Vec2D(10, 10));
+	const Curve4 line(Vec2D(0, 0), Vec2D(100, 0), Vec2D(200, 0), Vec2D(300, 0));
+	
+	// needs more than the 1024 steps it is capped at
+	const Curve4 huge(Vec2D(0, 0), Vec2D(1e6, 1e6), Vec2D(-1e6, 1e6), Vec2D(0, 0));
+	
+	for (const Curve4 *curvePointer : { &sCurve, &loop, &point, &line, &huge })
+	{
+		const Curve4 &curve = *curvePointer;
+		Polygon polygon = CurveSubdivision::flatten(QVector<Curve4>() << curve, tolerance);
+		QVERIFY(polygon.size() >= 2);
+		QVERIFY(polygon.first() == curve.start);
+		QVERIFY(polygon.last() == curve.end);
+		
+		int stepCount = polygon.size() - 1;
+		bool capped = curvePointer == &huge;
+		
+		if (capped)
+			QCOMPARE(stepCount, 1024);
+		
+		// the points are at even parameter steps
+		for (int i = 0; i <= stepCount; ++i)
+			QVERIFY(distance(polygon[i], curvePoint(curve, double(i) / stepCount)) <= tolerance);
+		
+		// and the segments are within the tolerance of the curve between them, unless the step count is capped
+		if (!capped)
+		{
+			for (int i = 0; i < stepCount; ++i)
+				QVERIFY(distance(0.5 * (polygon[i] + polygon[i + 1]), curvePoint(curve, (i + 0.5) / stepCount)) <= tolerance);
+		}
+	}
+	
+	QCOMPARE(CurveSubdivision::flatten(QVector<Curve4>() << point, tolerance).size(), 2);
+	QCOMPARE(CurveSubdivision::flatten(QVector<Curve4>() << line, tolerance).size(), 2);
+}
+
+void Test::benchmark_curveSubdivision()
+{
+	constexpr int pointCount = 100000;
+	constexpr int iterationCount = 10;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<double> stepDist(-8.0, 8.0);
+	
+	Polygon points(pointCount);
+	Vec2D point(1000, 1000);
+	
+	for (int i = 0; i < pointCount; ++i)
+	{
+		point += Vec2D(stepDist(randomEngine), stepDist(randomEngine));
+		points[i] = point;
+	}
+	
+	QVector<Curve4> curves;
+	curves.reserve(pointCount - 3);
+	
+	for (int i = 1; i < pointCount - 2; ++i)
+		curves << Curve4::fromCatmullRom(points[i - 1], points[i], points[i + 1], points[i + 2]);
+	
+	Polygon result;
+	
+	QElapsedTimer timer;
+	timer.start();
+	
+	for (int i = 0; i < iterationCount; ++i)
+		result = CurveSubdivision::flatten(curves);
+	
+	double batchSeconds = timer.nsecsElapsed() * 1e-9;
+	
+	timer.restart();
+	
+	for (int i = 0; i < iterationCount; ++i)
+	{
+		for (const Curve4 &curve : curves)
+			CurveSubdivision(curve).polygon();
+	}
+	
+	double adaptiveSeconds = timer.nsecsElapsed() * 1e-9;
+	
+	qDebug() << "batch:" << (curves.size() * iterationCount / batchSeconds) << "curves/sec";
+	qDebug() << "adaptive:" << (curves.size() * iterationCount / adaptiveSeconds) << "curves/sec";
+	
+	QVERIFY(result.size() > curves.size());
+	QVERIFY(result.first() == curves.first().start);
+	QVERIFY(result.last() == curves.last().end);
+}
+
+void Test::benchmark_drawPreTransformedSurface()
+{
+	constexpr int tileColumnCount = 20;
+	constexpr int tileCount = 200;
+	constexpr int iterationCount = 5;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	auto makeLayer = [&]()
+	{
+		Surface surface;
+		
+		for (int i = 0; i < tileCount; ++i)
+		{
+			Image tile(Surface::tileSize());
+			
+			for (int y = 0; y < tile.height(); ++y)
+			{
+				for (int x = 0; x < tile.width(); ++x)
+				{
+					float a = unitDist(randomEngine);
+					*tile.pixelPointer(x, y) = Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine));
+				}
+			}
+			
+			surface.setTile(QPoint(i % tileColumnCount, i / tileColumnCount), tile);
+		}
+		
+		return surface;
+	};
+	
+	const Surface layer = makeLayer();
+	const Surface background = makeLayer();
+	
+	// the painter runs on the global pool, whose thread count is restored even if a check fails
+	struct MaxThreadCountRestorer
+	{
+		QThreadPool *pool;
+		int maxThreadCount;
+		
+		~MaxThreadCountRestorer() { pool->setMaxThreadCount(maxThreadCount); }
+	};
+	
+	QThreadPool *pool = QThreadPool::globalInstance();
+	MaxThreadCountRestorer restorer { pool, pool->maxThreadCount() };
+	
+	Surface reference;
+	double singleThreadSeconds = 0;
+	
+	for (int threadCount = 1; threadCount <= QThread::idealThreadCount(); threadCount *= 2)
+	{
+		pool->setMaxThreadCount(threadCount);
+		
+		Surface result;
+		
+		QElapsedTimer timer;
+		timer.start();
+		
+		for (int i = 0; i < iterationCount; ++i)
+		{
+			result = background;
+			SurfacePainter painter(&result);
+			painter.setOpacity(0.5);
+			painter.drawPreTransformedSurface(QPoint(), layer);
+		}
+		
+		double seconds = timer.nsecsElapsed() * 1e-9;
+		
+		if (threadCount == 1)
+		{
+			reference = result;
+			singleThreadSeconds = seconds;
+		}
+		
+		qDebug() << threadCount << "threads:" << (tileCount * iterationCount / seconds) << "tiles/sec" << "speedup:" << (singleThreadSeconds / seconds);
+		
+		QVERIFY(result == reference);
+	}
+}
+
+void Test::test_drawTransformedSurface()
+{
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	auto makeTile = [&]()
+	{
+		Image tile(Surface::tileSize());
+		
+		for (int y = 0; y < tile.height(); ++y)
+		{
+			for (int x = 0; x < tile.width(); ++x)
+			{
+				float a = unitDist(randomEngine);
+				tile.setPixel(x, y, Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine)));
+			}
+		}
+		
+		return tile;
+	};
+	
+	// tiles which do not touch, as the generic path draws each tile separately
+	Surface source;
+	source.setTile(QPoint(0, 0), makeTile());
+	source.setTile(QPoint(2, 1), makeTile());
+	
+	QTransform transform;
+	transform.translate(100.3, 20.7);
+	transform.rotate(30);
+	
+	QRect rect = transform.mapRect(QRectF(source.boundingRect())).toAlignedRect().adjusted(-2, -2, 2, 2);
+	
+	for (ImageTransformType type : { ImageTransformTypeNearestNeighbor, ImageTransformTypeBilinear, ImageTransformTypeBicubic })
+	{
+		Surface surface;
+		{
+			SurfacePainter painter(&surface);
+			painter.setShapeTransform(transform);
+			painter.setImageTransformType(type);
+			painter.drawSurface(Vec2D(), source);
+		}
+		
+		// the generic path rasterizes the tile rects with the surface as the brush
+		Image reference(rect.size());
+		reference.fill(Pixel(0));
+		{
+			Painter painter(&reference);
+			painter.setShapeTransform(transform * QTransform::fromTranslate(-rect.left(), -rect.top()));
+			painter.setImageTransformType(type);
+			painter.drawSurface(Vec2D(), source);
+		}
+		
+		Image result = surface.crop(rect);
+		
+		float maxDifference = 0;
+		
+		for (int y = 0; y < rect.height(); ++y)
+		{
+			for (int x = 0; x < rect.width(); ++x)
+			{
+				for (int c = 0; c < 4; ++c)
+					maxDifference = std::max(maxDifference, std::fabs(result.pixel(x, y).v()[c] - reference.pixel(x, y).v()[c]));
+			}
+		}
+		
+		QVERIFY(maxDifference < 1e-3f);
+	}
+}
+
+void Test::benchmark_blendLayers()
+{
+	constexpr int layerCount = 50;
+	constexpr int pixelCount = 4096;
+	constexpr int iterationCount = 20;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	auto makeRandomPixel = [&]()
+	{
+		float a = unitDist(randomEngine);
+		return Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine));
+	};
+	
+	const BlendMode::Index modes[] = { BlendMode::SourceOver, BlendMode::Multiply, BlendMode::Screen, BlendMode::Plus, BlendMode::Overlay };
+	
+	QVector<QVector<Pixel>> sources(layerCount);
+	QVector<BlendOp::Layer> layers(layerCount);
+	
+	for (int i = 0; i < layerCount; ++i)
+	{
+		sources[i].resize(pixelCount);
+		for (Pixel &pixel : sources[i])
+			pixel = makeRandomPixel();
+		
+		layers[i].src = wrapPointer(sources[i].constData(), pixelCount);
+		layers[i].op = BlendMode(modes[i % 5]).op();
+		layers[i].opacity = (i % 3) ? 1.f : unitDist(randomEngine);
+	}
+	
+	QVector<Pixel> background(pixelCount);
+	for (Pixel &pixel : background)
+		pixel = makeRandomPixel();
+	
+	QVector<Pixel> sequential, fused;
+	
+	QElapsedTimer timer;
+	timer.start();
+	
+	for (int i = 0; i < iterationCount; ++i)
+	{
+		sequential = background;
+		
+		for (const BlendOp::Layer &layer : layers)
+			layer.op->blend(pixelCount, wrapPointer(sequential.data(), pixelCount), layer.src, layer.opacity);
+	}
+	
+	double sequentialSeconds = timer.nsecsElapsed() * 1e-9;
+	
+	timer.restart();
+	
+	for (int i = 0; i < iterationCount; ++i)
+	{
+		fused = background;
+		BlendOp::blendLayers(pixelCount, wrapPointer(fused.data(), pixelCount), layers.constData(), layerCount);
+	}
+	
+	double fusedSeconds = timer.nsecsElapsed() * 1e-9;
+	
+	qDebug() << "sequential:" << (pixelCount * layerCount * iterationCount / sequentialSeconds) << "pixel-layers/sec";
+	qDebug() << "fused:" << (pixelCount * layerCount * iterationCount / fusedSeconds) << "pixel-layers/sec";
+	
+	for (int i = 0; i < pixelCount; ++i)
+	{
+		for (int c = 0; c < 4; ++c)
+			QVERIFY(std::fabs(sequential[i].v()[c] - fused[i].v()[c]) < 1e-5f);
+	}
+}
+
+void Test::test_nonSeparableBlend()
+{
+	constexpr int pixelCount = 1027;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	// includes transparent, gray and fully saturated colors to cover every branch of the scalar version
+	auto makeRandomPixel = [&](int i)
+	{
+		float a = (i % 7 == 0) ? 0.f : unitDist(randomEngine);
+		
+		if (i % 5 == 0)
+		{
+			float gray = a * unitDist(randomEngine);
+			return Pixel(a, gray, gray, gray);
+		}
+		if (i % 11 == 0)
+			return Pixel(a, a, 0.f, a * unitDist(randomEngine));
+		
+		return Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine));
+	};
+	
+	QVector<Pixel> src(pixelCount), dst(pixelCount);
+	
+	for (int i = 0; i < pixelCount; ++i)
+	{
+		src[i] = makeRandomPixel(i);
+		dst[i] = makeRandomPixel(i / 3);
+	}
+	
+	const BlendMode::Index modes[] = { BlendMode::Hue, BlendMode::Saturation, BlendMode::Color, BlendMode::Luminosity };
+	
+	for (auto mode : modes)
+	{
+		BlendOp *op = BlendMode(mode).op();
+		
+		QVector<Pixel> reference = dst;
+		QVector<Pixel> result = dst;
+		
+		// blending 1 pixel at a time goes through the scalar implementation
+		for (int i = 0; i < pixelCount; ++i)
+			op->blend(1, wrapPointer(reference.data() + i, 1), wrapPointer(src.constData() + i, 1));
+		
+		op->blend(pixelCount, wrapPointer(result.data(), pixelCount), wrapPointer(src.constData(), pixelCount));
+		
+		for (int i = 0; i < pixelCount; ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+				QVERIFY(std::fabs(reference[i].v()[c] - result[i].v()[c]) < 1e-5f);
+		}
+	}
+}
+
+void Test::benchmark_nonSeparableBlend()
+{
+	constexpr int pixelCount = 4096;
+	constexpr int iterationCount = 200;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	auto makeRandomPixel = [&]()
+	{
+		float a = unitDist(randomEngine);
+		return Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine));
+	};
+	
+	QVector<Pixel> src(pixelCount), background(pixelCount);
+	
+	for (int i = 0; i < pixelCount; ++i)
+	{
+		src[i] = makeRandomPixel();
+		background[i] = makeRandomPixel();
+	}
+	
+	const BlendMode::Index modes[] = { BlendMode::SourceOver, BlendMode::Hue, BlendMode::Saturation, BlendMode::Color, BlendMode::Luminosity };
+	
+	for (auto mode : modes)
+	{
+		BlendOp *op = BlendMode(mode).op();
+		QVector<Pixel> dst = background;
+		
+		QElapsedTimer timer;
+		timer.start();
+		
+		for (int i = 0; i < iterationCount; ++i)
+			op->blend(pixelCount, wrapPointer(dst.data(), pixelCount), wrapPointer(src.constData(), pixelCount));
+		
+		double seconds = timer.nsecsElapsed() * 1e-9;
+		
+		qDebug() << BlendMode(mode).toString() << ":" << (pixelCount * iterationCount / seconds) << "pixels/sec";
+	}
+}
+
+namespace
+{
+
+std::mt19937 conversionRandomEngine(0);
+
+template <class T_Pixel>
+QVector<T_Pixel> makeConversionSource(int count)
+{
+	QVector<T_Pixel> pixels(count);
+	auto bytes = reinterpret_cast<uint8_t *>(pixels.data());
+	
+	for (int i = 0; i < count * int(sizeof(T_Pixel)); ++i)
+		bytes[i] = conversionRandomEngine() & 0xFF;
+	
+	return pixels;
+}
+
+template <>
+QVector<Pixel> makeConversionSource<Pixel>(int count)
+{
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	QVector<Pixel> pixels(count);
+	
+	// includes transparent and opaque pixels to cover unpremultiplication by 0 and 1
+	for (int i = 0; i < count; ++i)
+	{
+		float a = (i % 7 == 0) ? 0.f : (i % 5 == 0) ? 1.f : unitDist(conversionRandomEngine);
+		pixels[i] = Pixel(a, a * unitDist(conversionRandomEngine), a * unitDist(conversionRandomEngine), a * unitDist(conversionRandomEngine));
+	}
+	
+	return pixels;
+}
+
+template <class T_Pixel>
+QVector<T_Pixel> makeFloatConversionSource(int count)
+{
+	std::uniform_real_distribution<float> colorDist(0.f, 4.f);	// includes values above 1 (HDR)
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	QVector<T_Pixel> pixels(count);
+	
+	for (int i = 0; i < count; ++i)
+	{
+		float a = (i % 7 == 0) ? 0.f : unitDist(conversionRandomEngine);
+		float k = T_Pixel::isPremultEnabled() ? a : 1.f;
+		pixels[i] = T_Pixel(k * colorDist(conversionRandomEngine), k * colorDist(conversionRandomEngine), k * colorDist(conversionRandomEngine), a);
+	}
+	
+	return pixels;
+}
+
+template <>
+QVector<RgbF> makeConversionSource<RgbF>(int count) { return makeFloatConversionSource<RgbF>(count); }
+template <>
+QVector<RgbaF> makeConversionSource<RgbaF>(int count) { return makeFloatConversionSource<RgbaF>(count); }
+template <>
+QVector<RgbaPremultF> makeConversionSource<RgbaPremultF>(int count) { return makeFloatConversionSource<RgbaPremultF>(count); }
+
+template <class T_Dst, class T_Src>
+bool pixelConversionMatches(int count)
+{
+	QVector<T_Src> src = makeConversionSource<T_Src>(count);
+	QVector<T_Dst> reference(count), result(count);
+	
+	convertPixelsGeneric(reference.data(), src.constData(), count);
+	PixelRowConverter<T_Dst, T_Src>::convert(result.data(), src.constData(), count);
+	
+	// integer channels may differ by 1 in rounding ties, float channels in the last bits
+	double tolerance = std::is_same<typename T_Dst::ValueType, float>::value ? 1e-6 : 1.0;
+	
+	for (int i = 0; i < count; ++i)
+	{
+		for (size_t c = 0; c < T_Dst::count(); ++c)
+		{
+			if (std::fabs(double(reference[i].v()[c]) - double(result[i].v()[c])) > tolerance)
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+template <class T_Dst, class T_Src>
+void benchmarkPixelConversion(const char *name)
+{
+	constexpr int pixelCount = 4096;
+	constexpr int iterationCount = 500;
+	
+	QVector<T_Src> src = makeConversionSource<T_Src>(pixelCount);
+	QVector<T_Dst> dst(pixelCount);
+	
+	auto measure = [&](void (*convert)(T_Dst *, const T_Src *, int))
+	{
+		QElapsedTimer timer;
+		timer.start();
+		
+		for (int i = 0; i < iterationCount; ++i)
+			convert(dst.data(), src.constData(), pixelCount);
+		
+		return pixelCount * iterationCount / (timer.nsecsElapsed() * 1e-9);
+	};
+	
+	double generic = measure(&convertPixelsGeneric<T_Dst, T_Src>);
+	double accelerated = measure(&PixelRowConverter<T_Dst, T_Src>::convert);
+	
+	qDebug() << name << ": generic" << generic << "pixels/sec, accelerated" << accelerated << "pixels/sec";
+}
+
+}
+
+void Test::test_pixelConversion()
+{
+	// odd counts cover the remainders of the kernels
+	for (int count : { 1, 2, 3, 5, 6, 7, 1027 })
+	{
+		QVERIFY((pixelConversionMatches<Pixel, BgrU8>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, BgraU8>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, BgraPremultU8>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, RgbU16>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, RgbaU16>(count)));
+		QVERIFY((pixelConversionMatches<BgrU8, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<BgraU8, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<BgraPremultU8, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<RgbU16, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<RgbaU16, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, RgbF>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, RgbaF>(count)));
+		QVERIFY((pixelConversionMatches<Pixel, RgbaPremultF>(count)));
+		QVERIFY((pixelConversionMatches<RgbF, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<RgbaF, Pixel>(count)));
+		QVERIFY((pixelConversionMatches<RgbaPremultF, Pixel>(count)));
+	}
+	
+	// inverted pastes go through the same kernels row by row
+	auto src = makeConversionSource<RgbaU16>(13 * 7);
+	auto wrapped = GenericImage<RgbaU16>::wrap(src.constData(), QSize(13, 7));
+	
+	Image image(13, 7);
+	image.paste<ImagePasteSourceInverted>(wrapped);
+	
+	for (int y = 0; y < 7; ++y)
+	{
+		for (int x = 0; x < 13; ++x)
+		{
+			Pixel expected = wrapped.pixel(x, 6 - y);
+			for (int c = 0; c < 4; ++c)
+				QVERIFY(std::fabs(image.pixel(x, y).v()[c] - expected.v()[c]) < 1e-6f);
+		}
+	}
+}
+
+void Test::benchmark_pixelConversion()
+{
+	benchmarkPixelConversion<Pixel, BgrU8>("BgrU8 -> Pixel");
+	benchmarkPixelConversion<Pixel, BgraU8>("BgraU8 -> Pixel");
+	benchmarkPixelConversion<Pixel, BgraPremultU8>("BgraPremultU8 -> Pixel");
+	benchmarkPixelConversion<Pixel, RgbU16>("RgbU16 -> Pixel");
+	benchmarkPixelConversion<Pixel, RgbaU16>("RgbaU16 -> Pixel");
+	benchmarkPixelConversion<BgrU8, Pixel>("Pixel -> BgrU8");
+	benchmarkPixelConversion<BgraU8, Pixel>("Pixel -> BgraU8");
+	benchmarkPixelConversion<BgraPremultU8, Pixel>("Pixel -> BgraPremultU8");
+	benchmarkPixelConversion<RgbU16, Pixel>("Pixel -> RgbU16");
+	benchmarkPixelConversion<RgbaU16, Pixel>("Pixel -> RgbaU16");
+	benchmarkPixelConversion<Pixel, RgbF>("RgbF -> Pixel");
+	benchmarkPixelConversion<Pixel, RgbaF>("RgbaF -> Pixel");
+	benchmarkPixelConversion<Pixel, RgbaPremultF>("RgbaPremultF -> Pixel");
+	benchmarkPixelConversion<RgbF, Pixel>("Pixel -> RgbF");
+	benchmarkPixelConversion<RgbaF, Pixel>("Pixel -> RgbaF");
+	benchmarkPixelConversion<RgbaPremultF, Pixel>("Pixel -> RgbaPremultF");
+}
+
+void Test::test_imageStream()
+{
+	Image image(37, 11);
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+			image.setPixel(x, y, Pixel(1.f, x / 37.f, y / 11.f, 0.5f));
+	}
+	
+	// the current format
+	{
+		QByteArray data;
+		QDataStream out(&data, QIODevice::WriteOnly);
+		out << image;
+		
+		Image result;
+		QDataStream in(data);
+		in >> result;
+		
+		QCOMPARE(in.status(), QDataStream::Ok);
+		QVERIFY(result == image);
+	}
+	
+	// the old per-float format must stay readable
+	{
+		QByteArray data;
+		QDataStream out(&data, QIODevice::WriteOnly);
+		out << int32_t(image.width()) << int32_t(image.height());
+		
+		for (int y = 0; y < image.height(); ++y)
+		{
+			for (int x = 0; x < image.width(); ++x)
+			{
+				Pixel p = image.pixel(x, y);
+				out << p.a() << p.r() << p.g() << p.b();
+			}
+		}
+		
+		Image result;
+		QDataStream in(data);
+		in >> result;
+		
+		QCOMPARE(in.status(), QDataStream::Ok);
+		QVERIFY(result == image);
+	}
+}
+
+namespace
+{
+
+Image makeTileCodecSource(int kind, std::mt19937 &randomEngine)
+{
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	Image tile(Surface::tileSize());
+	
+	for (int y = 0; y < tile.height(); ++y)
+	{
+		for (int x = 0; x < tile.width(); ++x)
+		{
+			Pixel p;
+			
+			switch (kind)
+			{
+				case 0:	// a soft brush stroke
+				{
+					float d = std::hypot(x - 32.f, y - 0.5f * x - 8.f) / 24.f;
+					float a = d < 1.f ? (1.f - d) * (1.f - d) : 0.f;
+					p = Pixel(a, 0.8f * a, 0.3f * a, 0.1f * a);
+					break;
+				}
+				case 1:	// a gradient
+				{
+					float t = (x + y) / 128.f;
+					p = Pixel(1.f, t, 0.5f * t, 1.f - t);
+					break;
+				}
+				default:	// noise
+					p = Pixel(unitDist(randomEngine), unitDist(randomEngine), unitDist(randomEngine), unitDist(randomEngine));
+					break;
+			}
+			
+			tile.setPixel(x, y, p);
+		}
+	}
+	
+	return tile;
+}
+
+}
+
+void Test::test_tileCodec()
+{
+	std::mt19937 randomEngine(0);
+	
+	QList<Image> tiles;
+	
+	for (int kind = 0; kind < 3; ++kind)
+		tiles << makeTileCodecSource(kind, randomEngine);
+	
+	Image uniform(Surface::tileSize());
+	uniform.fill(Pixel(0.5f, 0.25f, 0.125f, 0.0625f));
+	tiles << uniform;
+	
+	// any bit pattern must survive
+	Image special(Surface::tileSize());
+	special.fill(Pixel(-0.f, std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -1.5f));
+	special.setPixel(3, 5, Pixel(1e-40f, -std::numeric_limits<float>::infinity(), 2.f, -0.f));
+	tiles << special;
+	
+	for (const Image &tile : tiles)
+	{
+		QByteArray data = TileCodec::encode(tile);
+		QVERIFY(!data.isEmpty());
+		QVERIFY(TileCodec::decode(data) == tile);
+		
+		data.chop(1);
+		QVERIFY(!TileCodec::decode(data).isValid());
+	}
+	
+	QVERIFY(TileCodec::encode(uniform).size() <= 17);
+	
+	Surface surface;
+	for (int i = 0; i < tiles.size(); ++i)
+		surface.setTile(QPoint(i - 2, i % 2), tiles.at(i));
+	
+	QByteArray data;
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out << surface;
+	
+	Surface result;
+	QDataStream in(data);
+	in >> result;
+	
+	QCOMPARE(in.status(), QDataStream::Ok);
+	QVERIFY(result == surface);
+}
+
+void Test::test_tileCodecCorruption()
+{
+	std::mt19937 randomEngine(0);
+	std::uniform_int_distribution<int> byteDist(0, 255);
+	
+	QList<Image> tiles;
+	
+	for (int kind = 0; kind < 3; ++kind)
+		tiles << makeTileCodecSource(kind, randomEngine);
+	
+	// a decoded tile is either invalid or a whole tile; it must never read out of bounds
+	auto verifyDecode = [](const QByteArray &data)
+	{
+		Image tile = TileCodec::decode(data);
+		return !tile.isValid() || tile.size() == Surface::tileSize();
+	};
+	
+	const quint32 lengths[] = { 0xFFFFFFFF, 0x80000000, 0x7FFFFFFF, 0 };
+	
+	for (const Image &tile : tiles)
+	{
+		const QByteArray data = TileCodec::encode(tile);
+		
+		// overwrite every dword, which hits the tile type, plane modes, frequencies and payload lengths
+		for (int offset = 0; offset + 4 <= data.size(); ++offset)
+		{
+			for (quint32 length : lengths)
+			{
+				QByteArray corrupted = data;
+				qToLittleEndian<quint32>(length, reinterpret_cast<uchar *>(corrupted.data() + offset));
+				QVERIFY(verifyDecode(corrupted));
+			}
+		}
+		
+		for (int i = 0; i < 1000; ++i)
+		{
+			QByteArray corrupted = data;
+			
+			for (int j = 0; j < 3; ++j)
+				corrupted[byteDist(randomEngine) % corrupted.size()] = char(byteDist(randomEngine));
+			
+			QVERIFY(verifyDecode(corrupted));
+		}
+		
+		for (int size = 0; size < data.size(); size += 97)
+			QVERIFY(!TileCodec::decode(data.left(size)).isValid());
+	}
+}
+
+void Test::benchmark_tileCodec()
+{
+	std::mt19937 randomEngine(0);
+	
+	const char *names[] = { "strokes", "gradient", "noise", "sparse" };
+	
+	for (int kind = 0; kind < 4; ++kind)
+	{
+		// a 1024x1024 document; the sparse one is mostly empty with a few strokes
+		Surface surface;
+		
+		for (int y = 0; y < 16; ++y)
+		{
+			for (int x = 0; x < 16; ++x)
+			{
+				if (kind == 3)
+				{
+					Image tile(Surface::tileSize());
+					tile.fill(Pixel(0.f));
+					surface.setTile(QPoint(x, y), (x + y) % 7 ? tile : makeTileCodecSource(0, randomEngine));
+				}
+				else
+				{
+					surface.setTile(QPoint(x, y), makeTileCodecSource(kind, randomEngine));
+				}
+			}
+		}
+		
+		double rawBytes = double(surface.tileCount()) * Surface::tileWidth() * Surface::tileWidth() * sizeof(Pixel);
+		
+		QElapsedTimer timer;
+		timer.start();
+		auto tiles = TileCodec::encodeSurface(surface);
+		qint64 encodeTime = timer.nsecsElapsed();
+		
+		timer.restart();
+		bool ok;
+		Surface result = TileCodec::decodeSurface(tiles, &ok);
+		qint64 decodeTime = timer.nsecsElapsed();
+		
+		QVERIFY(ok && result == surface);
+		
+		double encodedBytes = 0;
+		for (const QByteArray &data : tiles)
+			encodedBytes += data.size();
+		
+		qDebug() << names[kind]
+				 << "ratio" << rawBytes / encodedBytes
+				 << "encode" << rawBytes / encodeTime * 1e3 << "MB/s"
+				 << "decode" << rawBytes / decodeTime * 1e3 << "MB/s";
+	}
+}
+
+void Test::test_surfaceFile()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString filePath = dir.path() + "/surface";
+	
+	std::mt19937 randomEngine(0);
+	
+	Surface surface;
+	for (int i = 0; i < 6; ++i)
+		surface.setTile(QPoint(i - 3, i % 2), makeTileCodecSource(i % 3, randomEngine));
+	
+	for (SurfaceFile::Codec codec : { SurfaceFile::CodecRaw, SurfaceFile::CodecCompressed })
+	{
+		QVERIFY(SurfaceFile::write(surface, filePath, codec));
+		
+		SurfaceFile file;
+		QVERIFY(file.open(filePath));
+		QCOMPARE(file.tileCount(), surface.tileCount());
+		QVERIFY(file.contains(QPoint(-3, 0)));
+		QVERIFY(!file.contains(QPoint(-3, 1)));
+		QVERIFY(file.tile(QPoint(-3, 0)) == surface.tile(QPoint(-3, 0)));
+		QVERIFY(file.tile(QPoint(100, 100)) == Surface::defaultTile());
+		QVERIFY(file.toSurface() == surface);
+		
+		// tiles are read again from the map without the cache
+		file.setCacheSize(0);
+		QVERIFY(file.toSurface() == surface);
+		
+		// rewriting the file while it is mapped does not change the open file
+		Surface other;
+		other.setTile(QPoint(), makeTileCodecSource(0, randomEngine));
+		QVERIFY(SurfaceFile::write(other, filePath, codec));
+		QVERIFY(file.toSurface() == surface);
+		
+		file.close();
+		QVERIFY(file.open(filePath));
+		QVERIFY(file.toSurface() == other);
+		file.close();
+		
+		QVERIFY(SurfaceFile::write(surface, filePath, codec));
+	}
+	
+	QFile file(filePath);
+	QVERIFY(file.open(QIODevice::ReadOnly));
+	const QByteArray data = file.readAll();
+	file.close();
+	
+	auto openCorrupted = [&](const QByteArray &corrupted)
+	{
+		QString corruptedPath = dir.path() + "/corrupted";
+		QFile corruptedFile(corruptedPath);
+		if (!corruptedFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || corruptedFile.write(corrupted) != corrupted.size())
+			return false;
+		corruptedFile.close();
+		
+		SurfaceFile surfaceFile;
+		return surfaceFile.open(corruptedPath);
+	};
+	
+	QVERIFY(openCorrupted(data));
+	
+	// truncated files
+	QVERIFY(!openCorrupted(data.left(data.size() - 1)));
+	QVERIFY(!openCorrupted(data.left(32)));
+	QVERIFY(!openCorrupted(QByteArray()));
+	
+	// the header fields and index entries pointing out of the file (in the native byte order)
+	auto setQword = [](QByteArray corrupted, quint64 offset, quint64 value)
+	{
+		memcpy(corrupted.data() + offset, &value, sizeof(value));
+		return corrupted;
+	};
+	
+	const int tileCountOffset = 24, indexOffsetOffset = 32;
+	const int entryOffsetOffset = 16, entryLengthOffset = 24;
+	quint64 indexOffset;
+	memcpy(&indexOffset, data.constData() + indexOffsetOffset, sizeof(indexOffset));
+	
+	QVERIFY(!openCorrupted(setQword(data, tileCountOffset, 0xFFFFFFFFFFFFFFFF)));
+	QVERIFY(!openCorrupted(setQword(data, tileCountOffset, surface.tileCount() + 1)));
+	QVERIFY(!openCorrupted(setQword(data, indexOffsetOffset, data.size())));
+	QVERIFY(!openCorrupted(setQword(data, indexOffsetOffset, 0xFFFFFFFFFFFFFFFF)));
+	QVERIFY(!openCorrupted(setQword(data, indexOffset + entryOffsetOffset, data.size() + 1)));
+	QVERIFY(!openCorrupted(setQword(data, indexOffset + entryLengthOffset, data.size())));
+	QVERIFY(!openCorrupted(setQword(data, indexOffset + entryLengthOffset, 0xFFFFFFFFFFFFFFFF)));
+}
+
+void Test::test_surfaceJournal()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString filePath = dir.path() + "/journal";
+	
+	std::mt19937 randomEngine(0);
+	
+	Surface surface;
+	for (int i = 0; i < 8; ++i)
+		surface.setTile(QPoint(i, -i), makeTileCodecSource(i % 3, randomEngine));
+	
+	SurfaceJournal journal;
+	QVERIFY(journal.open(filePath));
+	QVERIFY(journal.save(surface));
+	QCOMPARE(journal.tileCount(), 8);
+	
+	// unchanged tiles are not written again
+	qint64 size = journal.fileSize();
+	QVERIFY(journal.save(surface));
+	QCOMPARE(journal.fileSize(), size);
+	
+	surface.setTile(QPoint(0, 0), makeTileCodecSource(1, randomEngine));
+	surface.remove(QPoint(1, -1));
+	QVERIFY(journal.save(surface));
+	QCOMPARE(journal.tileCount(), 7);
+	QVERIFY(journal.fileSize() - size < TileCodec::encode(surface.tile(0, 0)).size() + 64);
+	
+	journal.close();
+	
+	// a torn save, a tile record cut off by the end of the file, is discarded
+	{
+		const quint32 header[4] = { 1, 0, 0, 1000 };	// type, x, y, payload length
+		
+		QFile file(filePath);
+		QVERIFY(file.open(QIODevice::Append));
+		file.write(reinterpret_cast<const char *>(header), sizeof(header));
+		file.write(QByteArray(24, 1));
+	}
+	
+	QVERIFY(journal.open(filePath));
+	bool ok;
+	Surface loaded = journal.load(&ok);
+	QVERIFY(ok);
+	QVERIFY(loaded == surface);
+	
+	// superseded records are dropped by compaction
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int x = 0; x < 8; ++x)
+			loaded.setTile(QPoint(x, 1), makeTileCodecSource(2, randomEngine));
+		QVERIFY(journal.save(loaded));
+	}
+	
+	journal.waitForCompaction();
+	QVERIFY(journal.compact());
+	QVERIFY(journal.garbageSize() < 64);
+	QCOMPARE(journal.tileCount(), loaded.tileCount());
+	
+	journal.close();
+	QVERIFY(journal.open(filePath));
+	QVERIFY(journal.load(&ok) == loaded);
+	QVERIFY(ok);
+	
+	Surface edited = loaded;
+	edited.setTile(QPoint(0, 0), makeTileCodecSource(0, randomEngine));
+	QVERIFY(journal.save(edited));
+	journal.close();
+	
+	// damaged records are detected by the checksum of their save
+	QFile file(filePath);
+	QVERIFY(file.open(QIODevice::ReadOnly));
+	const QByteArray data = file.readAll();
+	file.close();
+	
+	auto openDamaged = [&](int offset)
+	{
+		QByteArray damaged = data;
+		damaged[offset] = damaged[offset] ^ 0x10;
+		
+		QFile damagedFile(filePath);
+		if (!damagedFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || damagedFile.write(damaged) != damaged.size())
+			return false;
+		damagedFile.close();
+		
+		return journal.open(filePath);
+	};
+	
+	// the last save is discarded like a torn one
+	QVERIFY(openDamaged(data.size() - 40));
+	QVERIFY(journal.load(&ok) == loaded);
+	QVERIFY(ok);
+	journal.close();
+	
+	// an earlier save cannot be discarded without losing the later ones,
+	// whether the damage is in a payload or in the type or the length of a record header
+	for (int offset : { 32 + 16 + 8, 32, 35, 44, 45, 47 })
+	{
+		QVERIFY(!openDamaged(offset));
+		QCOMPARE(QFileInfo(filePath).size(), qint64(data.size()));
+	}
+}
+
+void Test::test_thumbnail()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString filePath = dir.path() + "/image.png";
+	
+	Image image(300, 200);
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+			image.setPixel(x, y, Pixel(1.f, x / 300.f, y / 200.f, (x / 10 + y / 10) % 2));
+	}
+	
+	ImageExporter exporter("png", true);
+	QVERIFY(exporter.setImage(image));
+	QVERIFY(exporter.save(filePath));
+	
+	// 300 / 64 rounds up to boxes of 5 x 5 pixels
+	ImageImporter importer;
+	QVERIFY(importer.loadThumbnail(filePath, 64));
+	Image thumbnail = importer.toThumbnail(64);
+	QCOMPARE(thumbnail.size(), QSize(60, 40));
+	
+	for (int c = 0; c < 4; ++c)
+	{
+		float sum = 0;
+		for (int y = 25; y < 30; ++y)
+		{
+			for (int x = 10; x < 15; ++x)
+				sum += image.pixel(x, y).v()[c];
+		}
+		
+		QVERIFY(std::fabs(thumbnail.pixel(2, 5).v()[c] - sum / 25.f) < 1e-3f);
+	}
+	
+	QVERIFY(importer.toThumbnail(1000).size() == image.size());
+	
+	auto thumbnails = ImageImporter::loadThumbnails({ filePath, dir.path() + "/missing.png", filePath }, 64, 2);
+	QCOMPARE(thumbnails.size(), 3);
+	QVERIFY(thumbnails.at(0) == thumbnail);
+	QVERIFY(!thumbnails.at(1).isValid());
+	QVERIFY(thumbnails.at(2) == thumbnail);
+}
+
+void Test::test_imageImportFromFile()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString filePath = dir.path() + "/image.png";
+	
+	Image image(97, 61);
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+			image.setPixel(x, y, Pixel(0.5f, x / 97.f * 0.5f, 0.25f, y / 61.f * 0.5f));
+	}
+	
+	ImageExporter exporter("png", true);
+	QVERIFY(exporter.setImage(image));
+	QVERIFY(exporter.save(filePath));
+	
+	// the mapped file and the QIODevice path decode the same pixels
+	ImageImporter mapped;
+	QVERIFY(mapped.load(filePath));
+	QCOMPARE(mapped.size(), image.size());
+	
+	QFile file(filePath);
+	QVERIFY(file.open(QIODevice::ReadOnly));
+	ImageImporter streamed;
+	QVERIFY(streamed.load(&file));
+	
+	QVERIFY(mapped.toImage() == streamed.toImage());
+	
+	QVERIFY(!mapped.load(dir.path() + "/missing.png"));
+	QVERIFY(!mapped.isValid());
+}
+
+void Test::test_imageImportToSurface()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString filePath = dir.path() + "/image.png";
+	
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> dist(0.1f, 1.f);
+	
+	// not aligned to tiles, with one inner and one edge tile left transparent
+	const QPoint p(-37, 23);
+	const QRect rect(p, QSize(170, 150));
+	const QPointSet blankKeys = { QPoint(0, 1), QPoint(2, 2) };
+	
+	Image image(rect.size());
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			if (blankKeys.contains(Surface::keyForPixel(p + QPoint(x, y))))
+			{
+				image.setPixel(x, y, Pixel(0.f));
+			}
+			else
+			{
+				float a = dist(rng);
+				image.setPixel(x, y, Pixel(a, dist(rng) * a, dist(rng) * a, dist(rng) * a));
+			}
+		}
+	}
+	
+	ImageExporter exporter("png", true);
+	QVERIFY(exporter.setImage(image));
+	QVERIFY(exporter.save(filePath));
+	
+	ImageImporter importer;
+	QVERIFY(importer.load(filePath));
+	
+	Surface surface = importer.toSurface(p);
+	
+	// the reference converts the whole image and pastes it at p
+	Surface reference;
+	reference.paste(importer.toImage(), p);
+	
+	QCOMPARE(surface.keys(), Surface::rectToKeys(rect) - blankKeys);
+	
+	for (const QPoint &key : Surface::rectToKeys(rect))
+		QVERIFY(surface.crop(Surface::keyToRect(key)) == reference.crop(Surface::keyToRect(key)));
+}
+
+void Test::test_pngSurfaceExport()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	
+	// tiles are missing at some keys, which are exported as transparent
+	Surface surface;
+	
+	for (const QPoint &key : { QPoint(-1, 0), QPoint(0, 0), QPoint(1, 1), QPoint(0, 2), QPoint(-1, 3), QPoint(1, 3) })
+	{
+		Image tile(Surface::tileWidth(), Surface::tileWidth());
+		
+		for (int y = 0; y < tile.height(); ++y)
+		{
+			for (int x = 0; x < tile.width(); ++x)
+			{
+				float a = dist(rng);
+				tile.setPixel(x, y, Pixel(a, dist(rng) * a, dist(rng) * a, dist(rng) * a));
+			}
+		}
+		
+		surface.setTile(key, tile);
+	}
+	
+	// not aligned to tiles and spanning 4 bands of tile rows
+	QRect rect(-37, 13, 150, 200);
+	Image cropped = surface.crop(rect);
+	
+	for (bool alpha : { true, false })
+	{
+		QString streamedPath = dir.path() + (alpha ? "/streamed-rgba.png" : "/streamed-rgb.png");
+		QString referencePath = dir.path() + (alpha ? "/reference-rgba.png" : "/reference-rgb.png");
+		
+		ImageExporter streamedExporter("png", alpha);
+		QVERIFY(streamedExporter.setSurface(surface, rect));
+		QVERIFY(streamedExporter.save(streamedPath));
+		
+		// the reference goes through a full-size bitmap
+		ImageExporter referenceExporter("png", alpha);
+		QVERIFY(referenceExporter.setImage(cropped));
+		QVERIFY(referenceExporter.save(referencePath));
+		
+		ImageImporter streamedImporter, referenceImporter;
+		QVERIFY(streamedImporter.load(streamedPath));
+		QVERIFY(referenceImporter.load(referencePath));
+		QCOMPARE(streamedImporter.size(), rect.size());
+		QCOMPARE(referenceImporter.size(), rect.size());
+		
+		Image streamed = streamedImporter.toImage();
+		Image reference = referenceImporter.toImage();
+		
+		for (int y = 0; y < rect.height(); ++y)
+		{
+			for (int x = 0; x < rect.width(); ++x)
+			{
+				Pixel p = streamed.pixel(x, y);
+				Pixel r = reference.pixel(x, y);
+				Pixel o = cropped.pixel(x, y);
+				
+				for (int c = 0; c < 4; ++c)
+				{
+					QVERIFY(std::fabs(p.v()[c] - r.v()[c]) < 1e-5f);
+					
+					// 16 bit quantization of the unpremultiplied channels
+					if (alpha)
+						QVERIFY(std::fabs(p.v()[c] - o.v()[c]) < 1e-3f);
+				}
+			}
+		}
+	}
+}
+
+void Test::test_floatImageExport()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> alphaDist(0.2f, 1.f);
+	std::uniform_real_distribution<float> colorDist(0.f, 4.f);
+	
+	// translucent pixels with colors above 1
+	Image image(37, 23);
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			float a = alphaDist(rng);
+			image.setPixel(x, y, Pixel(a, colorDist(rng) * a, colorDist(rng) * a, colorDist(rng) * a));
+		}
+	}
+	
+	for (QString format : { "exr", "tif", "pfm" })
+	{
+		for (bool alpha : { true, false })
+		{
+			QString filePath = dir.path() + "/image-" + (alpha ? "rgba." : "rgb.") + format;
+			
+			ImageExporter exporter(format, alpha);
+			QVERIFY(exporter.setImage(image));
+			QVERIFY(exporter.save(filePath));
+			
+			ImageImporter importer;
+			QVERIFY(importer.load(filePath));
+			QCOMPARE(importer.size(), image.size());
+			
+			Image loaded = importer.toImage();
+			
+			// PFM has no alpha channel, and pixels without alpha are composited on white
+			bool keepsAlpha = alpha && format != "pfm";
+			
+			// EXR is written in half floats
+			float tolerance = format == "exr" ? 1e-3f : 1e-5f;
+			
+			for (int y = 0; y < image.height(); ++y)
+			{
+				for (int x = 0; x < image.width(); ++x)
+				{
+					Pixel o = image.pixel(x, y);
+					Pixel e = keepsAlpha ? o : Pixel(1.f, o.r() + 1.f - o.a(), o.g() + 1.f - o.a(), o.b() + 1.f - o.a());
+					Pixel p = loaded.pixel(x, y);
+					
+					for (int c = 0; c < 4; ++c)
+						QVERIFY(std::fabs(p.v()[c] - e.v()[c]) <= tolerance * qMax(1.f, std::fabs(e.v()[c])));
+				}
+			}
+		}
+	}
+	
+	// a grayscale PFM is loaded as FIT_FLOAT, whose rows are stored from the bottom
+	QString grayPath = dir.path() + "/gray.pfm";
+	QFile grayFile(grayPath);
+	QVERIFY(grayFile.open(QIODevice::WriteOnly));
+	grayFile.write(QString("Pf\n%1 %2\n-1.0\n").arg(image.width()).arg(image.height()).toLatin1());	// negative scale for little endian
+	
+	for (int y = image.height() - 1; y >= 0; --y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			float gray = image.pixel(x, y).r();
+			grayFile.write(reinterpret_cast<const char *>(&gray), sizeof(gray));
+		}
+	}
+	
+	grayFile.close();
+	
+	ImageImporter grayImporter;
+	QVERIFY(grayImporter.load(grayPath));
+	QCOMPARE(grayImporter.size(), image.size());
+	
+	Image gray = grayImporter.toImage();
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			float g = image.pixel(x, y).r();
+			QVERIFY(gray.pixel(x, y) == Pixel(1.f, g, g, g));
+		}
+	}
+}
+
+void Test::test_maskBlend()
+{
+	constexpr int count = 256;
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	std::uniform_int_distribution<int> u8Dist(0, 0xFF);
+	std::uniform_int_distribution<int> u16Dist(0, 0xFFFF);
+	
+	QVector<Pixel> destination(count), source(count);
+	
+	for (int i = 0; i < count; ++i)
+	{
+		float da = unitDist(randomEngine), sa = unitDist(randomEngine);
+		destination[i] = Pixel(da, da * unitDist(randomEngine), da * unitDist(randomEngine), da * unitDist(randomEngine));
+		source[i] = Pixel(sa, sa * unitDist(randomEngine), sa * unitDist(randomEngine), sa * unitDist(randomEngine));
+	}
+	
+	// every mask value including 0 and the maximum
+	
+	QVector<AlphaU8> masksU8(count);
+	QVector<AlphaU16> masksU16(count);
+	QVector<float> opacitiesU8(count), opacitiesU16(count);
+	
+	for (int i = 0; i < count; ++i)
+	{
+		masksU8[i] = AlphaU8(i < 2 ? i * 0xFF : u8Dist(randomEngine));
+		masksU16[i] = AlphaU16(i < 2 ? i * 0xFFFF : u16Dist(randomEngine));
+		opacitiesU8[i] = masksU8[i].a() / 255.f;
+		opacitiesU16[i] = masksU16[i].a() / 65535.f;
+	}
+	
+	const Pixel color(0.75f, 0.5f, 0.25f, 0.125f);
+	
+	auto compare = [](const QVector<Pixel> &result, const QVector<Pixel> &reference)
+	{
+		for (int i = 0; i < result.size(); ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				if (std::fabs(result[i].v()[c] - reference[i].v()[c]) > 1e-5f)
+					return false;
+			}
+		}
+		
+		return true;
+	};
+	
+	const BlendMode::Index modes[] = { BlendMode::SourceOver, BlendMode::Source, BlendMode::DestinationIn, BlendMode::Multiply, BlendMode::Screen, BlendMode::Hue };
+	
+	for (BlendMode::Index mode : modes)
+	{
+		BlendOp *op = BlendMode(mode).op();
+		
+		// the single-channel masks blend the same as their values as float opacities
+		
+		auto verify = [&](const QVector<float> &opacities, std::function<void(Pointer<Pixel>, bool)> blendMasks)
+		{
+			for (bool useColor : { false, true })
+			{
+				QVector<Pixel> reference = destination;
+				QVector<Pixel> result = destination;
+				
+				if (useColor)
+					op->blend(count, wrapPointer(reference.data(), count), color, wrapPointer(opacities.constData(), count));
+				else
+					op->blend(count, wrapPointer(reference.data(), count), wrapPointer(source.constData(), count), wrapPointer(opacities.constData(), count));
+				
+				blendMasks(wrapPointer(result.data(), count), useColor);
+				
+				if (!compare(result, reference))
+					return false;
+			}
+			
+			return true;
+		};
+		
+		QVERIFY(verify(opacitiesU8, [&](Pointer<Pixel> dst, bool useColor)
+		{
+			if (useColor)
+				op->blend(count, dst, color, wrapPointer(masksU8.constData(), count));
+			else
+				op->blend(count, dst, wrapPointer(source.constData(), count), wrapPointer(masksU8.constData(), count));
+		}));
+		
+		QVERIFY(verify(opacitiesU16, [&](Pointer<Pixel> dst, bool useColor)
+		{
+			if (useColor)
+				op->blend(count, dst, color, wrapPointer(masksU16.constData(), count));
+			else
+				op->blend(count, dst, wrapPointer(source.constData(), count), wrapPointer(masksU16.constData(), count));
+		}));
+	}
+}
+
+void Test::test_surfaceSelectionMask()
+{
+	constexpr int width = Surface::tileWidth();
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	
+	Surface surface;
+	
+	for (const QPoint &key : { QPoint(0, 0), QPoint(1, 0), QPoint(-1, 2) })
+	{
+		Image tile(width, width);
+		
+		for (int y = 0; y < width; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				float a = unitDist(randomEngine);
+				tile.setPixel(x, y, Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine)));
+			}
+		}
+		
+		surface.setTile(key, tile);
+	}
+	
+	// the mask leaves the tile at (1, 0) out and has a tile without pixels under it
+	
+	MaskSurface mask;
+	
+	for (const QPoint &key : { QPoint(0, 0), QPoint(-1, 2), QPoint(3, 3) })
+	{
+		MaskImage maskTile(width, width);
+		
+		for (int y = 0; y < width; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+				maskTile.setPixel(x, y, AlphaF((x + y) % 5 == 0 ? 0.f : unitDist(randomEngine)));
+		}
+		
+		mask.setTile(key, maskTile);
+	}
+	
+	QPainterPath path;
+	path.addRect(0, 0, 10, 10);
+	
+	SurfaceSelection selection(path);
+	selection.setMask(mask);
+	
+	QCOMPARE(selection.type(), SurfaceSelection::TypeMask);
+	QVERIFY(selection.path().isEmpty());
+	QVERIFY(selection.surface().isEmpty());
+	
+	Surface result = selection.clip(surface);
+	
+	QVERIFY(!result.contains(QPoint(1, 0)));
+	QVERIFY(!result.contains(QPoint(3, 3)));
+	
+	// the same as a surface selection of the expanded mask where the mask has tiles
+	
+	Surface reference = SurfaceSelection(mask.toSurface()).clip(surface);
+	
+	for (const QPoint &key : surface.keys())
+	{
+		Image resultTile = result.tile(key);
+		Image referenceTile = reference.tile(key);
+		Image sourceTile = surface.tile(key);
+		MaskImage maskTile = mask.tile(key);
+		
+		for (int y = 0; y < width; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				Pixel expected = sourceTile.pixel(x, y) * maskTile.pixel(x, y).a();
+				
+				for (int c = 0; c < 4; ++c)
+				{
+					QVERIFY(std::fabs(resultTile.pixel(x, y).v()[c] - expected.v()[c]) < 1e-5f);
+					
+					if (mask.contains(key))
+						QVERIFY(std::fabs(resultTile.pixel(x, y).v()[c] - referenceTile.pixel(x, y).v()[c]) < 1e-5f);
+				}
+			}
+		}
+	}
+	
+	// setting another kind of selection drops the mask
+	
+	selection.setPath(QPainterPath());
+	QCOMPARE(selection.type(), SurfaceSelection::TypePath);
+	QVERIFY(selection.mask().isEmpty());
+}
+
+void Test::test_clipMaskHoles()
+{
+	constexpr int width = MaskSurface::tileWidth();
+	
+	// rows of 1 to 3 pixel holes, which must not be merged into blended runs
+	MaskImage maskTile(width, width);
+	maskTile.fill(AlphaF(1.f));
+	
+	QVector<QPoint> holes;
+	
+	for (int y = 0; y < width; ++y)
+	{
+		for (int x = 4 + y % 3; x + 3 < width; x += 8)
+		{
+			int length = 1 + (x / 8 + y) % 3;
+			
+			for (int i = 0; i < length; ++i)
+			{
+				maskTile.setPixel(x + i, y, AlphaF(0.f));
+				holes << QPoint(x + i, y);
+			}
+		}
+	}
+	
+	MaskSurface mask;
+	mask.setTile(QPoint(), maskTile);
+	
+	const Pixel background(0.5f, 0.25f, 0.125f, 0.0625f);
+	const Pixel color(1.f, 1.f, 0.f, 0.f);
+	
+	Image sourceImage(width, width);
+	sourceImage.fill(color);
+	
+	auto verifyHoles = [&](const Image &image)
+	{
+		for (const QPoint &p : holes)
+		{
+			if (!(image.pixel(p) == background))
+				return false;
+		}
+		return true;
+	};
+	
+	for (BlendMode::Index mode : { BlendMode::Source, BlendMode::Clear, BlendMode::DestinationIn, BlendMode::SourceIn })
+	{
+		Image filled(width, width);
+		filled.fill(background);
+		{
+			Painter painter(&filled);
+			painter.setClipMask(mask);
+			painter.setBlendMode(mode);
+			painter.setPixel(color);
+			painter.drawRect(QRectF(0, 0, width, width));
+		}
+		QVERIFY(verifyHoles(filled));
+		
+		Image drawn(width, width);
+		drawn.fill(background);
+		{
+			Painter painter(&drawn);
+			painter.setClipMask(mask);
+			painter.setBlendMode(mode);
+			painter.drawPreTransformedImage(QPoint(), sourceImage);
+		}
+		QVERIFY(verifyHoles(drawn));
+		
+		Surface surface;
+		surface.tileRef(QPoint()).fill(background);
+		{
+			SurfacePainter painter(&surface);
+			painter.setClipMask(mask);
+			painter.setBlendMode(mode);
+			painter.drawPreTransformedImage(QPoint(), sourceImage);
+		}
+		QVERIFY(verifyHoles(surface.tile(QPoint())));
+	}
+	
+	// the pixels inside the clip are still painted
+	Image image(width, width);
+	image.fill(background);
+	{
+		Painter painter(&image);
+		painter.setClipMask(mask);
+		painter.setBlendMode(BlendMode::Source);
+		painter.setPixel(color);
+		painter.drawRect(QRectF(0, 0, width, width));
+	}
+	QVERIFY(image.pixel(0, 0) == color);
+}
+
+void Test::test_drawDab()
+{
+	const Pixel color(1.f, 0.25f, 0.5f, 0.75f);
+	const Vec2D center(60.3, 40.7);
+	constexpr double diameter = 24;
+	
+	auto drawDab = [&](const QTransform &transform, double hardness)
+	{
+		Image image(128, 96);
+		image.fill(Pixel(0));
+		
+		Painter painter(&image);
+		painter.setPixel(color);
+		painter.setShapeTransform(transform);
+		painter.drawDab(center, diameter, hardness);
+		return image;
+	};
+	
+	auto maxDifference = [](const Image &image1, const Image &image2)
+	{
+		float difference = 0;
+		
+		for (int y = 0; y < image1.height(); ++y)
+		{
+			for (int x = 0; x < image1.width(); ++x)
+			{
+				for (int c = 0; c < 4; ++c)
+					difference = std::max(difference, std::fabs(image1.pixel(x, y).v()[c] - image2.pixel(x, y).v()[c]));
+			}
+		}
+		
+		return difference;
+	};
+	
+	// a slightly non-uniform scale takes the generic path of the paint engine
+	QTransform generic = QTransform::fromTranslate(center.x(), center.y()).scale(1, 1.001).translate(-center.x(), -center.y());
+	
+	for (double hardness : { 1.0, 0.5, 0.0 })
+	{
+		Image masked = drawDab(QTransform(), hardness);
+		
+		QVERIFY(std::fabs(masked.pixel(60, 40).a() - 1.f) < 0.1f);
+		QVERIFY(masked.pixel(60 + 14, 40).a() == 0.f);
+		QVERIFY(maxDifference(masked, drawDab(generic, hardness)) < 0.1f);
+	}
+	
+	// half way through the falloff of a half hard dab
+	QVERIFY(std::fabs(drawDab(QTransform(), 0.5).pixel(60, 31).a() - 0.5f) < 0.1f);
+	QVERIFY(std::fabs(drawDab(generic, 0.5).pixel(60, 31).a() - 0.5f) < 0.1f);
+	
+	// a dab across tiles is the same on a surface as on an image
+	Surface surface;
+	{
+		SurfacePainter painter(&surface);
+		painter.setPixel(color);
+		painter.drawDab(Vec2D(64.3, 63.8), diameter, 0.5);
+	}
+	QCOMPARE(surface.tileCount(), 4);
+	
+	Image image(128, 128);
+	image.fill(Pixel(0));
+	{
+		Painter painter(&image);
+		painter.setPixel(color);
+		painter.drawDab(Vec2D(64.3, 63.8), diameter, 0.5);
+	}
+	QVERIFY(surface.crop(image.rect()) == image);
+	
+	// ops which only remove the destination do not create tiles
+	Surface empty;
+	{
+		SurfacePainter painter(&empty);
+		painter.setPixel(color);
+		painter.setBlendMode(BlendMode::DestinationOut);
+		painter.drawDab(Vec2D(64.3, 63.8), diameter, 0.5);
+	}
+	QCOMPARE(empty.tileCount(), 0);
+}
+
+void Test::benchmark_drawDab()
+{
+	constexpr int dabCount = 20000;
+	
+	for (double diameter : { 4.0, 16.0, 64.0 })
+	{
+		Surface surface;
+		
+		QElapsedTimer timer;
+		timer.start();
+		
+		{
+			SurfacePainter painter(&surface);
+			painter.setPixel(Pixel(0.5f, 0.25f, 0.125f, 0.0625f));
+			
+			// a stroke of dabs spaced by a tenth of the diameter
+			for (int i = 0; i < dabCount; ++i)
+			{
+				double t = i * diameter * 0.1;
+				painter.drawDab(Vec2D(t, 200 + 100 * std::sin(t * 0.01)), diameter, 0.5);
+			}
+		}
+		
+		double seconds = timer.nsecsElapsed() * 1e-9;
+		
+		qDebug() << "diameter" << diameter << ":" << (dabCount / seconds) << "dabs/sec";
+	}
+}
+
+void Test::test_spanRuns()
+{
+	constexpr int width = MaskSurface::tileWidth();
+	
+	std::mt19937 randomEngine(0);
+	std::uniform_real_distribution<float> unitDist(0.f, 1.f);
+	std::uniform_int_distribution<int> runLengthDist(1, 8);
+	std::uniform_int_distribution<int> runTypeDist(0, 2);
+	
+	// runs of zero, full and partial values, which the renderers split into skipped, collapsed and blended runs
+	auto makeRunValues = [&]()
+	{
+		QVector<float> values;
+		
+		while (values.size() < width * width)
+		{
+			int type = runTypeDist(randomEngine);
+			
+			for (int i = runLengthDist(randomEngine); i > 0; --i)
+				values << (type == 0 ? 0.f : type == 1 ? 1.f : unitDist(randomEngine));
+		}
+		
+		values.resize(width * width);
+		return values;
+	};
+	
+	// HDR destinations with color channels above 1
+	Image destination(width, width);
+	
+	for (int y = 0; y < width; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+			destination.setPixel(x, y, Pixel(unitDist(randomEngine), 4.f * unitDist(randomEngine), 2.f * unitDist(randomEngine), unitDist(randomEngine)));
+	}
+	
+	QVector<float> sourceAlphas = makeRunValues();
+	Image source(width, width);
+	
+	for (int i = 0; i < width * width; ++i)
+	{
+		float a = sourceAlphas[i];
+		source.setPixel(i % width, i / width, Pixel(a, a * unitDist(randomEngine), a * unitDist(randomEngine), a * unitDist(randomEngine)));
+	}
+	
+	QVector<float> maskValues = makeRunValues();
+	MaskImage maskTile(width, width);
+	
+	for (int i = 0; i < width * width; ++i)
+		maskTile.setPixel(i % width, i / width, AlphaF(maskValues[i]));
+	
+	MaskSurface mask;
+	mask.setTile(QPoint(), maskTile);
+	
+	const Pixel color(0.75f, 0.5f, 0.25f, 0.125f);
+	
+	auto compare = [](const Image &result, const Image &reference)
+	{
+		for (int y = 0; y < result.height(); ++y)
+		{
+			for (int x = 0; x < result.width(); ++x)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					float r = result.pixel(x, y).v()[c];
+					float e = reference.pixel(x, y).v()[c];
+					
+					if (std::fabs(r - e) > 1e-5f * std::max(1.f, std::fabs(e)))
+						return false;
+				}
+			}
+		}
+		
+		return true;
+	};
+	
+	const BlendMode::Index modes[] = { BlendMode::SourceOver, BlendMode::Plus, BlendMode::Multiply, BlendMode::Screen, BlendMode::Source, BlendMode::DestinationOut };
+	
+	for (BlendMode::Index mode : modes)
+	{
+		BlendOp *op = BlendMode(mode).op();
+		
+		// the reference blends every pixel without splitting
+		
+		Image reference = destination;
+		reference.detach();
+		
+		for (int y = 0; y < width; ++y)
+			op->blend(width, reference.scanline(y), source.constScanline(y));
+		
+		Image result = destination;
+		result.detach();
+		{
+			Painter painter(&result);
+			painter.setBlendMode(mode);
+			painter.drawPreTransformedImage(QPoint(), source);
+		}
+		QVERIFY(compare(result, reference));
+		
+		// the clipped-out pixels are kept instead of blended with zero coverage
+		
+		reference = destination;
+		reference.detach();
+		
+		for (int y = 0; y < width; ++y)
+		{
+			op->blend(width, reference.scanline(y), color, wrapPointer(maskValues.constData() + y * width, width));
+			
+			for (int x = 0; x < width; ++x)
+			{
+				if (maskValues[y * width + x] == 0.f)
+					reference.setPixel(x, y, destination.pixel(x, y));
+			}
+		}
+		
+		result = destination;
+		result.detach();
+		{
+			Painter painter(&result);
+			painter.setBlendMode(mode);
+			painter.setClipMask(mask);
+			painter.setPixel(color);
+			painter.drawRect(QRectF(0, 0, width, width));
+		}
+		QVERIFY(compare(result, reference));
+	}
+}
+
+namespace
+{
+
+Image rasterizePolygons(const FixedMultiPolygon &polygons)
+{
+	Image image(64, 64);
+	image.clear();
+	
+	Painter painter(&image);
+	painter.setPixel(Pixel(1.f));
+	painter.drawPreTransformedPolygons(polygons);
+	
+	return image;
+}
+
+double coveredArea(const FixedMultiPolygon &polygons)
+{
+	Image image = rasterizePolygons(polygons);
+	double area = 0;
+	
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+			area += image.pixel(x, y).a();
+	}
+	
+	return area;
+}
+
+}
+
+void Test::test_polygonStroker()
+{
+	// covers of partial pixels are truncated by the rasterizer
+	constexpr double tolerance = 0.5;
+	
+	// round joins and caps are polygons of a few vertices for small widths
+	double circleArea = 0;
+	{
+		Polygon circle = Polygon::fromEllipse(Vec2D(), Vec2D(2));
+		for (int i = 0; i < circle.size(); ++i)
+		{
+			const Vec2D &p1 = circle.at(i);
+			const Vec2D &p2 = circle.at((i + 1) % circle.size());
+			circleArea += 0.5 * (p1.x() * p2.y() - p1.y() * p2.x());
+		}
+		circleArea = std::fabs(circleArea);
+	}
+	
+	PolygonStroker stroker(4.0);
+	
+	auto strokeArea = [&](const Polygon &polyline)
+	{
+		return coveredArea(stroker.stroke(polyline));
+	};
+	
+	auto verifyArea = [&](const Polygon &polyline, double expected)
+	{
+		double area = strokeArea(polyline);
+		if (std::fabs(area - expected) >= tolerance)
+			qDebug() << "area" << area << "expected" << expected;
+		return std::fabs(area - expected) < tolerance;
+	};
+	
+	Polygon line;
+	line << Vec2D(10, 20) << Vec2D(30, 20);
+	
+	Polygon corner = line;
+	corner << Vec2D(30, 40);
+	
+	Polygon reversal = line;
+	reversal << Vec2D(10, 20);
+	
+	// a right angle; the segments cover 156 and the outer corner is a 2x2 square
+	
+	stroker.setJoinStyle(PolygonStroker::JoinMiter);
+	QVERIFY(verifyArea(corner, 160));
+	stroker.setJoinStyle(PolygonStroker::JoinBevel);
+	QVERIFY(verifyArea(corner, 158));
+	stroker.setJoinStyle(PolygonStroker::JoinRound);
+	double roundArea = strokeArea(corner);
+	QVERIFY(158.5 < roundArea && roundArea < 159.5);
+	
+	// the miter of a right angle is sqrt(2) times the half width
+	
+	stroker.setJoinStyle(PolygonStroker::JoinMiter);
+	stroker.setMiterLimit(1.5);
+	QVERIFY(verifyArea(corner, 160));
+	stroker.setMiterLimit(1.3);
+	QVERIFY(verifyArea(corner, 158));
+	stroker.setMiterLimit(4.0);
+	
+	// a 180 degree turn
+	
+	stroker.setJoinStyle(PolygonStroker::JoinMiter);
+	QVERIFY(verifyArea(reversal, 88));
+	stroker.setJoinStyle(PolygonStroker::JoinBevel);
+	QVERIFY(verifyArea(reversal, 88));
+	
+	// the round join and the round caps at the start point show opposite halves of the same circle
+	stroker.setJoinStyle(PolygonStroker::JoinRound);
+	stroker.setCapStyle(PolygonStroker::CapRound);
+	QVERIFY(verifyArea(reversal, 80 + circleArea));
+	
+	// caps
+	
+	stroker.setCapStyle(PolygonStroker::CapFlat);
+	QVERIFY(verifyArea(line, 80));
+	stroker.setCapStyle(PolygonStroker::CapSquare);
+	QVERIFY(verifyArea(line, 96));
+	stroker.setCapStyle(PolygonStroker::CapRound);
+	QVERIFY(verifyArea(line, 80 + circleArea));
+	
+	Polygon dot;
+	dot << Vec2D(20, 20);
+	
+	stroker.setCapStyle(PolygonStroker::CapFlat);
+	QVERIFY(verifyArea(dot, 0));
+	stroker.setCapStyle(PolygonStroker::CapSquare);
+	QVERIFY(verifyArea(dot, 16));
+	stroker.setCapStyle(PolygonStroker::CapRound);
+	QVERIFY(verifyArea(dot, circleArea));
+	
+	// variable widths make a trapezoid; mismatched widths fall back to the uniform width
+	
+	stroker.setCapStyle(PolygonStroker::CapFlat);
+	
+	QVector<double> widths;
+	widths << 2 << 6;
+	
+	FixedMultiPolygon trapezoid = stroker.stroke(line, widths);
+	QCOMPARE(trapezoid.boundingRect(), QRectF(10, 17, 20, 6));
+	QVERIFY(std::fabs(coveredArea(trapezoid) - 80) < tolerance);
+	
+	widths << 8;
+	QCOMPARE(stroker.stroke(line, widths).boundingRect(), QRectF(10, 18, 20, 4));
+}
+
+void Test::test_fixedPolygonClip()
+{
+	QRect clipRect(16, 12, 30, 36);
+	
+	auto makePolygon = [](std::initializer_list<Vec2D> points)
+	{
+		Polygon polygon;
+		for (const Vec2D &p : points)
+			polygon << p;
+		return FixedPolygon(polygon);
+	};
+	
+	// shapes filled the same with the non-zero and the even-odd rules
+	
+	FixedMultiPolygon bowtie = makePolygon({ Vec2D(6, 6), Vec2D(58, 50), Vec2D(58, 6), Vec2D(6, 50) });
+	
+	FixedMultiPolygon holed;
+	holed << makePolygon({ Vec2D(8, 8), Vec2D(56, 8), Vec2D(56, 56), Vec2D(8, 56) });
+	holed << makePolygon({ Vec2D(20.5, 20.5), Vec2D(20.5, 40.25), Vec2D(40.75, 40.25), Vec2D(40.75, 20.5) });
+	holed << makePolygon({ Vec2D(2, 58), Vec2D(60, 58), Vec2D(30, 63) });
+	
+	// shapes that differ between the rules: overlapping parts and a pentagram
+	
+	FixedMultiPolygon overlapping;
+	overlapping << makePolygon({ Vec2D(10, 10), Vec2D(40, 10), Vec2D(40, 40), Vec2D(10, 40) });
+	overlapping << makePolygon({ Vec2D(25.5, 25.5), Vec2D(55.5, 25.5), Vec2D(55.5, 55.5), Vec2D(25.5, 55.5) });
+	
+	FixedMultiPolygon pentagram;
+	{
+		Polygon star;
+		for (int i = 0; i < 5; ++i)
+		{
+			double angle = 3.14159265358979323846 * (0.8 * i - 0.5);
+			star << Vec2D(32 + 28 * std::cos(angle), 32 + 28 * std::sin(angle));
+		}
+		pentagram << FixedPolygon(star);
+	}
+	
+	auto compareImages = [](const Image &image1, const Image &image2)
+	{
+		for (int y = 0; y < image1.height(); ++y)
+		{
+			for (int x = 0; x < image1.width(); ++x)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					if (std::fabs(image1.pixel(x, y).v()[c] - image2.pixel(x, y).v()[c]) >= 0.01f)
+					{
+						qDebug() << "differs at" << x << y << image1.pixel(x, y) << image2.pixel(x, y);
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	};
+	
+	for (const FixedMultiPolygon &polygons : { bowtie, holed, overlapping, pentagram })
+	{
+		Image clipped = rasterizePolygons(polygons.clipped(clipRect));
+		
+		// the unclipped fill, cut to the rectangle
+		Image reference = rasterizePolygons(polygons);
+		for (int y = 0; y < reference.height(); ++y)
+		{
+			for (int x = 0; x < reference.width(); ++x)
+			{
+				if (!clipRect.contains(x, y))
+					reference.setPixel(x, y, Pixel(0.f));
+			}
+		}
+		
+		QVERIFY(compareImages(clipped, reference));
+	}
+	
+	// the boolean intersection used before gives the same result where the rules agree
+	
+	FixedMultiPolygon clipPolygon = FixedPolygon::fromRect(clipRect);
+	
+	for (const FixedMultiPolygon &polygons : { bowtie, holed })
+		QVERIFY(compareImages(rasterizePolygons(polygons.clipped(clipRect)), rasterizePolygons(polygons & clipPolygon)));
+	
+	// and fills the overlap of same-oriented polygons with the even-odd rule
+	
+	QVERIFY(!compareImages(rasterizePolygons(pentagram.clipped(clipRect)), rasterizePolygons(pentagram & clipPolygon)));
+	
+	// the fused transform rounds halfway points like the plain conversion
+	{
+		Polygon ties;
+		for (int i = -4; i < 4; ++i)
+			ties << Vec2D((2 * i + 1) / 512.0, (2 * i + 1) / 512.0 + 1.0);
+		
+		FixedPolygon converted(ties);
+		FixedPolygon transformed(ties, Affine2D::fromScale(1));
+		
+		for (int i = 0; i < ties.size(); ++i)
+		{
+			QCOMPARE(qint64(transformed.at(i).x), qint64(converted.at(i).x));
+			QCOMPARE(qint64(transformed.at(i).y), qint64(converted.at(i).y));
+		}
+	}
+	
+	// polygons entirely outside or inside the rectangle
+	
+	QVERIFY(bowtie.clipped(QRect(100, 100, 10, 10)).isEmpty());
+	QCOMPARE(bowtie.clipped(QRect(0, 0, 64, 64)).size(), 1);
+	QCOMPARE(bowtie.clipped(QRect(0, 0, 64, 64)).first().size(), bowtie.first().size());
+}
+
+namespace
+{
+
+/*
+ * Compares the table-based span generator against the per-pixel generator on the gradient itself.
+ * Pixels at the wrap of a repeating gradient, where either side of the jump is acceptable, are skipped.
+ */
+template <class T_Method, SpreadType T_SpreadType>
+bool gradientSpansMatch(const ArgbGradient &gradient, const ColorGradientCache &cache, const T_Method &method, const QTransform &transform, float tolerance)
+{
+	constexpr int count = 203;	// not a multiple of the 4 pixel steps
+	
+	GradientSpanGenerator<T_Method, T_SpreadType> spanGenerator(&cache, &method, transform);
+	GradientGenerator<ArgbGradient, T_Method, T_SpreadType> generator(&gradient, &method);
+	
+	QVector<Pixel> span(count);
+	
+	for (int y = -40; y < 100; y += 7)
+	{
+		QPoint pos(-50, y);
+		spanGenerator.generate(pos, count, wrapPointer(span.data(), count));
+		
+		for (int i = 0; i < count; ++i)
+		{
+			Vec2D p = Vec2D(pos.x() + i + 0.5, pos.y() + 0.5) * transform;
+			float t = method.position(p);
+			
+			if (T_SpreadType == SpreadTypeRepeat && std::fabs(t - std::round(t)) < 1e-3f)
+				continue;
+			
+			Pixel expected = generator.at(p);
+			
+			for (int c = 0; c < 4; ++c)
+			{
+				if (std::fabs(span[i].v()[c] - expected.v()[c]) > tolerance)
+				{
+					qDebug() << "spread" << T_SpreadType << "at" << pos.x() + i << y << span[i] << expected;
+					return false;
+				}
+			}
+		}
+	}
+	
+	return true;
+}
+
+template <class T_Method>
+bool gradientSpansMatch(const ArgbGradient &gradient, const ColorGradientCache &cache, const T_Method &method, const QTransform &transform, float tolerance)
+{
+	return gradientSpansMatch<T_Method, SpreadTypePad>(gradient, cache, method, transform, tolerance)
+		&& gradientSpansMatch<T_Method, SpreadTypeRepeat>(gradient, cache, method, transform, tolerance)
+		&& gradientSpansMatch<T_Method, SpreadTypeReflective>(gradient, cache, method, transform, tolerance);
+}
+
+}
+
+void Test::test_gradientSpans()
+{
+	const Pixel color0(1.f, 1.f, 0.f, 0.f);
+	const Pixel color1(0.5f, 0.f, 0.5f, 0.f);
+	const Pixel color2(1.f, 0.f, 0.f, 1.f);
+	
+	ArgbGradient gradient;
+	gradient.addStop(0.f, color0);
+	gradient.addStop(0.3f, color1);
+	gradient.addStop(1.f, color2);
+	
+	// the stops, the interpolation between them and the ends
+	
+	auto verifyAt = [&](float x, const Pixel &expected)
+	{
+		Pixel p = gradient.at(x);
+		
+		for (int c = 0; c < 4; ++c)
+		{
+			if (std::fabs(p.v()[c] - expected.v()[c]) > 1e-6f)
+				return false;
+		}
+		
+		return true;
+	};
+	
+	QVERIFY(verifyAt(-0.5f, color0));
+	QVERIFY(verifyAt(0.f, color0));
+	QVERIFY(verifyAt(0.3f, color1));
+	QVERIFY(verifyAt(1.f, color2));
+	QVERIFY(verifyAt(1.5f, color2));
+	QVERIFY(verifyAt(0.15f, Pixel(0.75f, 0.5f, 0.25f, 0.f)));
+	QVERIFY(verifyAt(0.65f, Pixel(0.75f, 0.f, 0.25f, 0.5f)));
+	
+	ArgbGradient single;
+	single.addStop(0.5f, color1);
+	QVERIFY(single.at(0.f) == color1);
+	QVERIFY(single.at(1.f) == color1);
+	
+	QVERIFY(ArgbGradient().at(0.5f) == Pixel(0.f));
+	
+	// the span generator samples a table of 4096 intervals; the colors change by at most 1 / 0.3 per unit,
+	// so the nearest sample is off by at most 0.5 / 4096 / 0.3 ~ 4e-4 from the exact color
+	
+	constexpr float tolerance = 1e-3f;
+	
+	ColorGradientCache cache(&gradient, 4096);
+	
+	QTransform transform;
+	transform.rotate(20);
+	transform.scale(1.5, 0.75);
+	transform.translate(-20, 10);
+	
+	const QTransform transforms[] = { QTransform(), transform };
+	
+	for (const QTransform &t : transforms)
+	{
+		QVERIFY(gradientSpansMatch(gradient, cache, LinearGradientMethod(Vec2D(10, 5), Vec2D(70, 40)), t, tolerance));
+		QVERIFY(gradientSpansMatch(gradient, cache, RadialGradientMethod(Vec2D(32, 32), Vec2D(40, 25)), t, tolerance));
+		QVERIFY(gradientSpansMatch(gradient, cache, FocalGradientMethod(Vec2D(32, 32), Vec2D(40, 25), Vec2D(40, 36)), t, tolerance));
+	}
+}
+
+void Test::test_gradientLineCache()
+{
+	ArgbGradient gradient;
+	gradient.addStop(0.f, Pixel(1.f, 1.f, 0.f, 0.f));
+	gradient.addStop(0.3f, Pixel(0.5f, 0.f, 0.5f, 0.f));
+	gradient.addStop(1.f, Pixel(1.f, 0.f, 0.f, 1.f));
+	
+	// a horizontal gradient with a whole number of pixels as the period
+	const double start = 3.25, end = 35.25;
+	
+	// fills an image with the brush and compares it with the gradient evaluated at each pixel
+	auto verifyFill = [&](const Brush &brush, SpreadType spreadType, double offset)
+	{
+		Image image(128, 4);
+		image.clear();
+		{
+			Painter painter(&image);
+			painter.setBrush(brush);
+			painter.drawRect(0, 0, image.width(), image.height());
+		}
+		
+		for (int x = 0; x < image.width(); ++x)
+		{
+			double t = (x + 0.5 - (start + offset)) / (end - start);
+			Pixel expected = gradient.at(spreadGradientPosition(spreadType, t));
+			
+			for (int y = 0; y < image.height(); ++y)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					if (std::fabs(image.pixel(x, y).v()[c] - expected.v()[c]) > 1e-5f)
+					{
+						qDebug() << "differs at" << x << y << image.pixel(x, y) << expected;
+						return false;
+					}
+				}
+			}
+		}
+		
+		return true;
+	};
+	
+	Brush brush = Brush::fromLinearGradient(gradient, Vec2D(start, 0), Vec2D(end, 0));
+	
+	// the line is built once and shared by the copies of the brush
+	
+	auto line = brush.gradientLine(SpreadTypePad, start, end);
+	QVERIFY(line);
+	QVERIFY(brush.gradientLine(SpreadTypePad, start, end) == line);
+	
+	Brush copy = brush;
+	QVERIFY(copy.gradientLine(SpreadTypePad, start, end) == line);
+	
+	QVERIFY(verifyFill(brush, SpreadTypePad, 0));
+	QVERIFY(brush.gradientLine(SpreadTypePad, start, end) == line);
+	
+	// changing the spread type or the transform builds another line
+	
+	copy.setSpreadType(SpreadTypeRepeat);
+	QVERIFY(verifyFill(copy, SpreadTypeRepeat, 0));
+	QVERIFY(brush.gradientLine(SpreadTypeRepeat, start, end) != line);
+	
+	copy.setSpreadType(SpreadTypeReflective);
+	QVERIFY(verifyFill(copy, SpreadTypeReflective, 0));
+	
+	copy.setTransform(QTransform::fromTranslate(5.5, 0));
+	QVERIFY(verifyFill(copy, SpreadTypeReflective, 5.5));
+	
+	// the original brush is unchanged and gets its own line back
+	QVERIFY(verifyFill(brush, SpreadTypePad, 0));
+	
+	// a period which is not a whole number of pixels has no line
+	QVERIFY(!brush.gradientLine(SpreadTypeRepeat, start, end + 0.5));
+}
+
 QTEST_MAIN(Test)
@@ -16,6 +16,36 @@ public slots:
 private slots:
 	
 	void test_blend();
+	void test_curveSubdivision();
+	void benchmark_curveSubdivision();
+	void benchmark_drawPreTransformedSurface();
+	void test_drawTransformedSurface();
+	void benchmark_blendLayers();
+	void test_nonSeparableBlend();
+	void benchmark_nonSeparableBlend();
+	void test_pixelConversion();
+	void benchmark_pixelConversion();
+	void test_imageStream();
+	void test_tileCodec();
+	void test_tileCodecCorruption();
+	void benchmark_tileCodec();
+	void test_surfaceFile();
+	void test_surfaceJournal();
+	void test_thumbnail();
+	void test_imageImportFromFile();
+	void test_imageImportToSurface();
+	void test_pngSurfaceExport();
+	void test_floatImageExport();
+	void test_maskBlend();
+	void test_surfaceSelectionMask();
+	void test_clipMaskHoles();
+	void test_drawDab();
+	void benchmark_drawDab();
+	void test_spanRuns();
+	void test_polygonStroker();
+	void test_fixedPolygonClip();
+	void test_gradientSpans();
+	void test_gradientLineCache();
 };
 
 #endif // TEST_H